@@ -10,17 +10,23 @@ namespace GL
 
    VAO::~VAO()
    {
+      State::deleted_vertex_array(obj);
       GLSYM(glDeleteVertexArrays)(1, &obj);
    }
 
    void VAO::unbind()
    {
-      GLSYM(glBindVertexArray)(0);
+      State::bind_vertex_array(0);
    }
 
    void VAO::bind()
    {
-      GLSYM(glBindVertexArray)(obj);
+      State::bind_vertex_array(obj);
+   }
+
+   GLuint VAO::object() const
+   {
+      return obj;
    }
 
    Buffer::Buffer(GLenum type_) : type(type_)
@@ -30,17 +36,23 @@ namespace GL
 
    Buffer::~Buffer()
    {
+      State::deleted_buffer(obj);
       GLSYM(glDeleteBuffers)(1, &obj);
    }
 
    void Buffer::bind()
    {
-      GLSYM(glBindBuffer)(type, obj);
+      State::bind_buffer(type, obj);
+   }
+
+   GLuint Buffer::object() const
+   {
+      return obj;
    }
 
    void Buffer::unbind(GLenum type)
    {
-      GLSYM(glBindBuffer)(type, 0);
+      State::bind_buffer(type, 0);
    }
 
    UniformBuffer::UniformBuffer() : bound_target(0)
@@ -50,22 +62,23 @@ namespace GL
 
    UniformBuffer::~UniformBuffer()
    {
+      State::deleted_buffer(obj);
       GLSYM(glDeleteBuffers)(1, &obj);
    }
 
    void UniformBuffer::bind()
    {
-      GLSYM(glBindBuffer)(GL_UNIFORM_BUFFER, obj);
+      State::bind_buffer(GL_UNIFORM_BUFFER, obj);
    }
 
    void UniformBuffer::unbind()
    {
-      GLSYM(glBindBuffer)(GL_UNIFORM_BUFFER, 0);
+      State::bind_buffer(GL_UNIFORM_BUFFER, 0);
    }
 
    void UniformBuffer::bind(unsigned index)
    {
-      GLSYM(glBindBufferBase)(GL_UNIFORM_BUFFER, index, obj);
+      State::bind_buffer_base(GL_UNIFORM_BUFFER, index, obj);
       bound_target = index;
    }
 
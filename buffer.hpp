@@ -5,6 +5,7 @@
 #include "utils.hpp"
 #include "shader.hpp"
 #include "window.hpp"
+#include "state.hpp"
 
 namespace GL
 {
@@ -14,6 +15,7 @@ namespace GL
          VAO();
          ~VAO();
          void bind();
+         GLuint object() const;
 
          static void unbind();
 
@@ -28,6 +30,7 @@ namespace GL
          Buffer(GLenum type);
          ~Buffer();
          void bind();
+         GLuint object() const;
 
          static void unbind(GLenum type);
 
@@ -0,0 +1,775 @@
+#include "compress.hpp"
+#include "gl.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <limits>
+#include <fstream>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+
+namespace GLU
+{
+   namespace
+   {
+      // Channels are R, G, B, A of pixels 0-15, row by row.
+      struct Block
+      {
+         float c[4][16];
+      };
+
+      void load_block(const Image &image, unsigned bx, unsigned by, Block &block)
+      {
+         for (unsigned y = 0; y < 4; y++)
+         {
+            unsigned sy = std::min(by * 4 + y, image.height - 1);
+            const uint32_t *row = &image.pixels[size_t(sy) * image.width];
+            for (unsigned x = 0; x < 4; x++)
+            {
+               uint32_t pixel = row[std::min(bx * 4 + x, image.width - 1)];
+               block.c[0][y * 4 + x] = static_cast<float>((pixel >> 8) & 0xff);
+               block.c[1][y * 4 + x] = static_cast<float>((pixel >> 16) & 0xff);
+               block.c[2][y * 4 + x] = static_cast<float>(pixel >> 24);
+               block.c[3][y * 4 + x] = static_cast<float>(pixel & 0xff);
+            }
+         }
+      }
+
+      void store_block(Image &image, unsigned bx, unsigned by, const uint32_t *pixels)
+      {
+         for (unsigned y = 0; y < 4 && by * 4 + y < image.height; y++)
+            for (unsigned x = 0; x < 4 && bx * 4 + x < image.width; x++)
+               image.pixels[size_t(by * 4 + y) * image.width + bx * 4 + x] = pixels[y * 4 + x];
+      }
+
+      inline uint32_t pack(const uint8_t *rgba)
+      {
+         return (uint32_t(rgba[2]) << 24) | (uint32_t(rgba[1]) << 16) |
+            (uint32_t(rgba[0]) << 8) | rgba[3];
+      }
+
+      inline float clamp_channel(float v)
+      {
+         return std::min(255.0f, std::max(0.0f, v));
+      }
+
+      // Picks the closest of count palette entries for every pixel, comparing
+      // the first channels channels. Returns the summed squared error.
+      float closest(const Block &block, unsigned channels,
+            const float (*palette)[4], unsigned count, uint8_t *indices)
+      {
+         float total = 0.0f;
+#ifdef GL_LINEAR_SSE
+         // Four pixels against one palette entry at a time.
+         for (unsigned i = 0; i < 16; i += 4)
+         {
+            __m128 pixel[4];
+            for (unsigned c = 0; c < channels; c++)
+               pixel[c] = _mm_loadu_ps(&block.c[c][i]);
+
+            __m128 best = _mm_set1_ps(FLT_MAX);
+            __m128 best_index = _mm_setzero_ps();
+            for (unsigned e = 0; e < count; e++)
+            {
+               __m128 dist = _mm_setzero_ps();
+               for (unsigned c = 0; c < channels; c++)
+               {
+                  __m128 d = _mm_sub_ps(pixel[c], _mm_set1_ps(palette[e][c]));
+                  dist = _mm_add_ps(dist, _mm_mul_ps(d, d));
+               }
+
+               __m128 less = _mm_cmplt_ps(dist, best);
+               best = _mm_min_ps(dist, best);
+               best_index = _mm_or_ps(_mm_and_ps(less, _mm_set1_ps(static_cast<float>(e))),
+                     _mm_andnot_ps(less, best_index));
+            }
+
+            float error[4], index[4];
+            _mm_storeu_ps(error, best);
+            _mm_storeu_ps(index, best_index);
+            for (unsigned k = 0; k < 4; k++)
+            {
+               indices[i + k] = static_cast<uint8_t>(index[k]);
+               total += error[k];
+            }
+         }
+#else
+         for (unsigned i = 0; i < 16; i++)
+         {
+            float best = FLT_MAX;
+            for (unsigned e = 0; e < count; e++)
+            {
+               float dist = 0.0f;
+               for (unsigned c = 0; c < channels; c++)
+               {
+                  float d = block.c[c][i] - palette[e][c];
+                  dist += d * d;
+               }
+
+               if (dist < best)
+               {
+                  best = dist;
+                  indices[i] = e;
+               }
+            }
+            total += best;
+         }
+#endif
+         return total;
+      }
+
+      // Ends of the segment along the principal axis of the first channels
+      // channels that just covers every pixel of the block.
+      void principal_endpoints(const Block &block, unsigned channels, float *lo, float *hi)
+      {
+         float mean[4] = {0.0f};
+         for (unsigned c = 0; c < channels; c++)
+         {
+            for (unsigned i = 0; i < 16; i++)
+               mean[c] += block.c[c][i];
+            mean[c] /= 16.0f;
+         }
+
+         float cov[4][4] = {{0.0f}};
+         for (unsigned i = 0; i < 16; i++)
+            for (unsigned a = 0; a < channels; a++)
+               for (unsigned b = 0; b < channels; b++)
+                  cov[a][b] += (block.c[a][i] - mean[a]) * (block.c[b][i] - mean[b]);
+
+         // Power iteration, starting from the channel that varies the most.
+         unsigned widest = 0;
+         for (unsigned c = 1; c < channels; c++)
+            if (cov[c][c] > cov[widest][widest])
+               widest = c;
+
+         float axis[4];
+         for (unsigned c = 0; c < channels; c++)
+            axis[c] = cov[widest][c];
+
+         for (unsigned iter = 0; iter < 8; iter++)
+         {
+            float next[4] = {0.0f};
+            float scale = 0.0f;
+            for (unsigned a = 0; a < channels; a++)
+            {
+               for (unsigned b = 0; b < channels; b++)
+                  next[a] += cov[a][b] * axis[b];
+               scale = std::max(scale, std::fabs(next[a]));
+            }
+
+            if (scale < 1e-6f)
+               break;
+            for (unsigned c = 0; c < channels; c++)
+               axis[c] = next[c] / scale;
+         }
+
+         float length = 0.0f;
+         for (unsigned c = 0; c < channels; c++)
+            length += axis[c] * axis[c];
+
+         if (cov[widest][widest] < 1e-6f || length < 1e-12f)
+         {
+            std::copy(mean, mean + channels, lo);
+            std::copy(mean, mean + channels, hi);
+            return;
+         }
+
+         length = std::sqrt(length);
+         for (unsigned c = 0; c < channels; c++)
+            axis[c] /= length;
+
+         float tmin = FLT_MAX, tmax = -FLT_MAX;
+         for (unsigned i = 0; i < 16; i++)
+         {
+            float t = 0.0f;
+            for (unsigned c = 0; c < channels; c++)
+               t += (block.c[c][i] - mean[c]) * axis[c];
+            tmin = std::min(tmin, t);
+            tmax = std::max(tmax, t);
+         }
+
+         for (unsigned c = 0; c < channels; c++)
+         {
+            lo[c] = clamp_channel(mean[c] + tmin * axis[c]);
+            hi[c] = clamp_channel(mean[c] + tmax * axis[c]);
+         }
+      }
+
+      // Least squares endpoints for the indices already chosen, with
+      // pixel = (1 - weight) * a + weight * b. False if the weights
+      // can't tell the endpoints apart.
+      bool refit(const Block &block, unsigned channels, const uint8_t *indices,
+            const float *weights, float *a, float *b)
+      {
+         float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+         float ap[4] = {0.0f}, bp[4] = {0.0f};
+         for (unsigned i = 0; i < 16; i++)
+         {
+            float w = weights[indices[i]];
+            aa += (1.0f - w) * (1.0f - w);
+            ab += (1.0f - w) * w;
+            bb += w * w;
+            for (unsigned c = 0; c < channels; c++)
+            {
+               ap[c] += (1.0f - w) * block.c[c][i];
+               bp[c] += w * block.c[c][i];
+            }
+         }
+
+         float det = aa * bb - ab * ab;
+         if (std::fabs(det) < 1e-4f)
+            return false;
+
+         for (unsigned c = 0; c < channels; c++)
+         {
+            a[c] = clamp_channel((ap[c] * bb - bp[c] * ab) / det);
+            b[c] = clamp_channel((bp[c] * aa - ap[c] * ab) / det);
+         }
+         return true;
+      }
+
+      inline unsigned pack565(const float *rgb)
+      {
+         unsigned r = static_cast<unsigned>(rgb[0] * (31.0f / 255.0f) + 0.5f);
+         unsigned g = static_cast<unsigned>(rgb[1] * (63.0f / 255.0f) + 0.5f);
+         unsigned b = static_cast<unsigned>(rgb[2] * (31.0f / 255.0f) + 0.5f);
+         return (r << 11) | (g << 5) | b;
+      }
+
+      inline void unpack565(unsigned color, uint8_t *rgba)
+      {
+         unsigned r = color >> 11, g = (color >> 5) & 0x3f, b = color & 0x1f;
+         rgba[0] = (r << 3) | (r >> 2);
+         rgba[1] = (g << 2) | (g >> 4);
+         rgba[2] = (b << 3) | (b >> 2);
+         rgba[3] = 0xff;
+      }
+
+      // The palette of a BC1 color block. BC3 always uses four colors,
+      // BC1 only if color0 > color1, otherwise the last one is transparent black.
+      void color_palette(unsigned color0, unsigned color1, bool four, uint8_t (*palette)[4])
+      {
+         unpack565(color0, palette[0]);
+         unpack565(color1, palette[1]);
+         for (unsigned c = 0; c < 3; c++)
+         {
+            if (four)
+            {
+               palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+               palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+            }
+            else
+            {
+               palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+               palette[3][c] = 0;
+            }
+         }
+         palette[2][3] = 0xff;
+         palette[3][3] = four ? 0xff : 0;
+      }
+
+      // Always a four color block, so it is valid in BC3 as well.
+      float encode_color_endpoints(const Block &block, const float *lo, const float *hi,
+            uint8_t *out, uint8_t *indices)
+      {
+         unsigned color0 = pack565(hi);
+         unsigned color1 = pack565(lo);
+         if (color0 < color1)
+            std::swap(color0, color1);
+
+         uint8_t palette[4][4];
+         color_palette(color0, color1, true, palette);
+         float fpalette[4][4];
+         for (unsigned e = 0; e < 4; e++)
+            for (unsigned c = 0; c < 4; c++)
+               fpalette[e][c] = palette[e][c];
+
+         // With equal endpoints the decoder's palette has only one useful entry.
+         float error = closest(block, 3, fpalette, color0 == color1 ? 1 : 4, indices);
+
+         uint32_t bits = 0;
+         for (unsigned i = 0; i < 16; i++)
+            bits |= uint32_t(indices[i]) << (2 * i);
+
+         out[0] = color0 & 0xff;
+         out[1] = color0 >> 8;
+         out[2] = color1 & 0xff;
+         out[3] = color1 >> 8;
+         for (unsigned i = 0; i < 4; i++)
+            out[4 + i] = (bits >> (8 * i)) & 0xff;
+
+         return error;
+      }
+
+      void encode_color(const Block &block, uint8_t *out)
+      {
+         static const float weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+         float lo[4], hi[4];
+         principal_endpoints(block, 3, lo, hi);
+
+         uint8_t indices[16];
+         float error = encode_color_endpoints(block, lo, hi, out, indices);
+
+         float a[4], b[4];
+         if (refit(block, 3, indices, weights, a, b))
+         {
+            uint8_t refined[8];
+            if (encode_color_endpoints(block, b, a, refined, indices) < error)
+               std::copy(refined, refined + 8, out);
+         }
+      }
+
+      void encode_alpha(const Block &block, uint8_t *out)
+      {
+         float lo = *std::min_element(block.c[3], block.c[3] + 16);
+         float hi = *std::max_element(block.c[3], block.c[3] + 16);
+
+         // alpha0 > alpha1 selects the eight level palette, levels 2-7
+         // run from alpha0 towards alpha1.
+         uint64_t bits = 0;
+         if (hi > lo)
+         {
+            for (unsigned i = 0; i < 16; i++)
+            {
+               unsigned level = static_cast<unsigned>((block.c[3][i] - lo) * 7.0f / (hi - lo) + 0.5f);
+               unsigned index = level == 7 ? 0 : (level == 0 ? 1 : 8 - level);
+               bits |= uint64_t(index) << (3 * i);
+            }
+         }
+
+         out[0] = static_cast<uint8_t>(hi);
+         out[1] = static_cast<uint8_t>(lo);
+         for (unsigned i = 0; i < 6; i++)
+            out[2 + i] = (bits >> (8 * i)) & 0xff;
+      }
+
+      static const unsigned bc7_weights[16] = {
+         0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64,
+      };
+
+      struct BitWriter
+      {
+         uint8_t *out;
+         unsigned pos;
+
+         void put(unsigned value, unsigned bits)
+         {
+            for (unsigned i = 0; i < bits; i++, pos++)
+               if ((value >> i) & 1)
+                  out[pos >> 3] |= 1 << (pos & 7);
+         }
+      };
+
+      struct BitReader
+      {
+         const uint8_t *in;
+         unsigned pos;
+
+         unsigned get(unsigned bits)
+         {
+            unsigned value = 0;
+            for (unsigned i = 0; i < bits; i++, pos++)
+               value |= ((in[pos >> 3] >> (pos & 7)) & 1) << i;
+            return value;
+         }
+      };
+
+      // Mode 6 endpoints are 7 bits per channel and a p-bit shared by all
+      // four channels, tried both ways.
+      void quantize_bc7(const float *endpoint, unsigned *quant, unsigned &pbit)
+      {
+         float best = FLT_MAX;
+         for (unsigned p = 0; p < 2; p++)
+         {
+            unsigned q[4];
+            float error = 0.0f;
+            for (unsigned c = 0; c < 4; c++)
+            {
+               int v = static_cast<int>((endpoint[c] - p) * 0.5f + 0.5f);
+               q[c] = std::min(127, std::max(0, v));
+               float d = float((q[c] << 1) | p) - endpoint[c];
+               error += d * d;
+            }
+
+            if (error < best)
+            {
+               best = error;
+               pbit = p;
+               std::copy(q, q + 4, quant);
+            }
+         }
+      }
+
+      float encode_bc7_endpoints(const Block &block, const float *lo, const float *hi,
+            uint8_t *out, uint8_t *indices)
+      {
+         unsigned q[2][4], p[2];
+         quantize_bc7(lo, q[0], p[0]);
+         quantize_bc7(hi, q[1], p[1]);
+
+         float palette[16][4];
+         for (unsigned c = 0; c < 4; c++)
+         {
+            unsigned e0 = (q[0][c] << 1) | p[0];
+            unsigned e1 = (q[1][c] << 1) | p[1];
+            for (unsigned i = 0; i < 16; i++)
+               palette[i][c] = float(((64 - bc7_weights[i]) * e0 + bc7_weights[i] * e1 + 32) >> 6);
+         }
+
+         float error = closest(block, 4, palette, 16, indices);
+
+         // The first index is stored without its top bit, which has to be zero.
+         if (indices[0] & 8)
+         {
+            std::swap(q[0], q[1]);
+            std::swap(p[0], p[1]);
+            for (unsigned i = 0; i < 16; i++)
+               indices[i] = 15 - indices[i];
+         }
+
+         std::fill(out, out + 16, 0);
+         BitWriter writer = { out, 0 };
+         writer.put(1 << 6, 7);
+         for (unsigned c = 0; c < 4; c++)
+         {
+            writer.put(q[0][c], 7);
+            writer.put(q[1][c], 7);
+         }
+         writer.put(p[0], 1);
+         writer.put(p[1], 1);
+         writer.put(indices[0], 3);
+         for (unsigned i = 1; i < 16; i++)
+            writer.put(indices[i], 4);
+
+         return error;
+      }
+
+      void encode_bc7(const Block &block, uint8_t *out)
+      {
+         static const float weights[16] = {
+            0.0f / 64, 4.0f / 64, 9.0f / 64, 13.0f / 64, 17.0f / 64, 21.0f / 64, 26.0f / 64, 30.0f / 64,
+            34.0f / 64, 38.0f / 64, 43.0f / 64, 47.0f / 64, 51.0f / 64, 55.0f / 64, 60.0f / 64, 64.0f / 64,
+         };
+
+         float lo[4], hi[4];
+         principal_endpoints(block, 4, lo, hi);
+
+         uint8_t indices[16];
+         float error = encode_bc7_endpoints(block, lo, hi, out, indices);
+
+         float a[4], b[4];
+         if (refit(block, 4, indices, weights, a, b))
+         {
+            uint8_t refined[16];
+            if (encode_bc7_endpoints(block, a, b, refined, indices) < error)
+               std::copy(refined, refined + 16, out);
+         }
+      }
+
+      void decode_color(const uint8_t *in, bool bc1, uint8_t (*pixels)[4])
+      {
+         unsigned color0 = in[0] | (in[1] << 8);
+         unsigned color1 = in[2] | (in[3] << 8);
+         uint8_t palette[4][4];
+         color_palette(color0, color1, !bc1 || color0 > color1, palette);
+
+         for (unsigned i = 0; i < 16; i++)
+         {
+            unsigned index = (in[4 + i / 4] >> (2 * (i & 3))) & 3;
+            std::copy(palette[index], palette[index] + 4, pixels[i]);
+         }
+      }
+
+      void decode_alpha(const uint8_t *in, uint8_t (*pixels)[4])
+      {
+         unsigned alpha[8] = { in[0], in[1] };
+         for (unsigned i = 2; i < 8; i++)
+         {
+            if (alpha[0] > alpha[1])
+               alpha[i] = ((8 - i) * alpha[0] + (i - 1) * alpha[1]) / 7;
+            else if (i < 6)
+               alpha[i] = ((6 - i) * alpha[0] + (i - 1) * alpha[1]) / 5;
+            else
+               alpha[i] = i == 6 ? 0 : 0xff;
+         }
+
+         uint64_t bits = 0;
+         for (unsigned i = 0; i < 6; i++)
+            bits |= uint64_t(in[2 + i]) << (8 * i);
+         for (unsigned i = 0; i < 16; i++)
+            pixels[i][3] = alpha[(bits >> (3 * i)) & 7];
+      }
+
+      void decode_bc7(const uint8_t *in, uint8_t (*pixels)[4])
+      {
+         BitReader reader = { in, 0 };
+         if (reader.get(7) != (1 << 6))
+            throw GL::Exception("Only BC7 mode 6 blocks can be decoded ...\n");
+
+         unsigned e[2][4];
+         for (unsigned c = 0; c < 4; c++)
+         {
+            e[0][c] = reader.get(7) << 1;
+            e[1][c] = reader.get(7) << 1;
+         }
+         unsigned p0 = reader.get(1), p1 = reader.get(1);
+
+         for (unsigned i = 0; i < 16; i++)
+         {
+            unsigned w = bc7_weights[reader.get(i ? 4 : 3)];
+            for (unsigned c = 0; c < 4; c++)
+               pixels[i][c] = ((64 - w) * (e[0][c] | p0) + w * (e[1][c] | p1) + 32) >> 6;
+         }
+      }
+
+      size_t block_bytes(unsigned width, unsigned height, BlockFormat format)
+      {
+         return size_t((width + 3) / 4) * ((height + 3) / 4) * BlockSize(format);
+      }
+
+      // Layout of a .bc* file, followed by width, height and the blocks of each level.
+      struct BlockCacheHeader
+      {
+         char magic[4];
+         uint32_t format;
+         uint64_t source_size;
+         int64_t source_mtime;
+         uint32_t levels;
+      };
+   }
+
+   unsigned BlockSize(BlockFormat format)
+   {
+      switch (format)
+      {
+         case BlockBC1:
+            return 8;
+         case BlockBC3:
+         case BlockBC7:
+            return 16;
+         default:
+            throw GL::Exception("Invalid block format ...\n");
+      }
+   }
+
+   const char* BlockFormatName(BlockFormat format)
+   {
+      switch (format)
+      {
+         case BlockBC1:
+            return "BC1";
+         case BlockBC3:
+            return "BC3";
+         case BlockBC7:
+            return "BC7";
+         default:
+            return "none";
+      }
+   }
+
+   CompressedImage CompressImage(const Image &image, BlockFormat format, bool threaded)
+   {
+      CompressedImage out;
+      out.width = image.width;
+      out.height = image.height;
+      out.format = format;
+      out.blocks.resize(block_bytes(image.width, image.height, format));
+
+      unsigned blocks_x = (image.width + 3) / 4;
+      unsigned blocks_y = (image.height + 3) / 4;
+      unsigned size = BlockSize(format);
+
+      auto rows = [&](size_t begin, size_t end) {
+         Block block;
+         for (size_t y = begin; y < end; y++)
+         {
+            for (unsigned x = 0; x < blocks_x; x++)
+            {
+               load_block(image, x, y, block);
+               uint8_t *dst = &out.blocks[(y * blocks_x + x) * size];
+               switch (format)
+               {
+                  case BlockBC1:
+                     encode_color(block, dst);
+                     break;
+                  case BlockBC3:
+                     encode_alpha(block, dst);
+                     encode_color(block, dst + 8);
+                     break;
+                  default:
+                     encode_bc7(block, dst);
+                     break;
+               }
+            }
+         }
+      };
+
+      if (threaded)
+         ParallelFor(blocks_y, std::max(1u, 256 / blocks_x), rows);
+      else
+         rows(0, blocks_y);
+
+      return out;
+   }
+
+   std::vector<CompressedImage> CompressMipmaps(const std::vector<Image> &levels,
+         BlockFormat format, bool threaded)
+   {
+      std::vector<CompressedImage> out;
+      for (auto level = std::begin(levels); level != std::end(levels); ++level)
+         out.push_back(CompressImage(*level, format, threaded));
+      return out;
+   }
+
+   Image DecompressImage(const CompressedImage &image)
+   {
+      Image out;
+      out.width = image.width;
+      out.height = image.height;
+      out.pixels.resize(size_t(image.width) * image.height);
+
+      unsigned blocks_x = (image.width + 3) / 4;
+      unsigned blocks_y = (image.height + 3) / 4;
+      unsigned size = BlockSize(image.format);
+      if (image.blocks.size() != block_bytes(image.width, image.height, image.format))
+         throw GL::Exception("Compressed image has the wrong size ...\n");
+
+      for (unsigned y = 0; y < blocks_y; y++)
+      {
+         for (unsigned x = 0; x < blocks_x; x++)
+         {
+            const uint8_t *src = &image.blocks[(size_t(y) * blocks_x + x) * size];
+            uint8_t rgba[16][4];
+            switch (image.format)
+            {
+               case BlockBC1:
+                  decode_color(src, true, rgba);
+                  break;
+               case BlockBC3:
+                  decode_color(src + 8, false, rgba);
+                  decode_alpha(src, rgba);
+                  break;
+               default:
+                  decode_bc7(src, rgba);
+                  break;
+            }
+
+            uint32_t pixels[16];
+            for (unsigned i = 0; i < 16; i++)
+               pixels[i] = pack(rgba[i]);
+            store_block(out, x, y, pixels);
+         }
+      }
+
+      return out;
+   }
+
+   double PSNR(const Image &a, const Image &b, bool alpha)
+   {
+      if (a.width != b.width || a.height != b.height || a.pixels.size() != b.pixels.size())
+         throw GL::Exception("Images have different sizes ...\n");
+
+      uint32_t mask = alpha ? 0xffffffffu : 0xffffff00u;
+      double sum = 0.0;
+      for (size_t i = 0; i < a.pixels.size(); i++)
+      {
+         uint32_t pa = a.pixels[i] & mask, pb = b.pixels[i] & mask;
+         for (unsigned shift = 0; shift < 32; shift += 8)
+         {
+            int d = int((pa >> shift) & 0xff) - int((pb >> shift) & 0xff);
+            sum += d * d;
+         }
+      }
+
+      if (sum == 0.0)
+         return std::numeric_limits<double>::infinity();
+
+      double mse = sum / (double(a.pixels.size()) * (alpha ? 4 : 3));
+      return 10.0 * std::log10(255.0 * 255.0 / mse);
+   }
+
+   std::string BlockCachePath(const std::string &source, BlockFormat format)
+   {
+      switch (format)
+      {
+         case BlockBC1:
+            return source + ".bc1";
+         case BlockBC3:
+            return source + ".bc3";
+         case BlockBC7:
+            return source + ".bc7";
+         default:
+            throw GL::Exception("Invalid block format ...\n");
+      }
+   }
+
+   void SaveBlockCache(const std::string &source,
+         const std::vector<CompressedImage> &levels)
+   {
+      if (levels.empty())
+         throw GL::Exception("No levels to cache ...\n");
+
+      BlockCacheHeader header = {{ 'B', 'C', 'N', '1' }};
+      if (!FileStamp(source, header.source_size, header.source_mtime))
+         throw GL::Exception(join("Failed to stat file: ", source));
+      header.format = levels.front().format;
+      header.levels = levels.size();
+
+      std::string path = BlockCachePath(source, levels.front().format);
+      std::ofstream file(path, std::ios::out | std::ios::binary);
+      if (!file.is_open())
+         throw GL::Exception(join("Cannot open file: ", path));
+
+      file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      for (auto level = std::begin(levels); level != std::end(levels); ++level)
+      {
+         uint32_t size[2] = { level->width, level->height };
+         file.write(reinterpret_cast<const char*>(size), sizeof(size));
+         file.write(reinterpret_cast<const char*>(level->blocks.data()), level->blocks.size());
+      }
+
+      if (!file.good())
+         throw GL::Exception(join("Failed to write file: ", path));
+   }
+
+   bool LoadBlockCache(const std::string &source, BlockFormat format,
+         std::vector<CompressedImage> &levels)
+   {
+      uint64_t source_size;
+      int64_t source_mtime;
+      if (format == BlockNone || !FileStamp(source, source_size, source_mtime))
+         return false;
+
+      std::ifstream file(BlockCachePath(source, format), std::ios::in | std::ios::binary);
+      if (!file.is_open())
+         return false;
+
+      BlockCacheHeader header;
+      if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+            std::string(header.magic, 4) != "BCN1" ||
+            header.source_size != source_size || header.source_mtime != source_mtime ||
+            header.format != static_cast<uint32_t>(format) || !header.levels || header.levels > 32)
+         return false;
+
+      std::vector<CompressedImage> cached(header.levels);
+      for (auto level = std::begin(cached); level != std::end(cached); ++level)
+      {
+         uint32_t size[2];
+         if (!file.read(reinterpret_cast<char*>(size), sizeof(size)) ||
+               !size[0] || !size[1] || size[0] > 0xffff || size[1] > 0xffff)
+            return false;
+
+         level->width = size[0];
+         level->height = size[1];
+         level->format = format;
+         level->blocks.resize(block_bytes(size[0], size[1], format));
+         if (!file.read(reinterpret_cast<char*>(level->blocks.data()), level->blocks.size()))
+            return false;
+      }
+
+      levels.swap(cached);
+      return true;
+   }
+}
+
@@ -0,0 +1,63 @@
+#ifndef COMPRESS_HPP__
+#define COMPRESS_HPP__
+
+#include "image.hpp"
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace GLU
+{
+   enum BlockFormat
+   {
+      BlockNone,
+      // 5:6:5 color, 4 bpp. Alpha is dropped.
+      BlockBC1,
+      // BC1 color plus interpolated 8-bit alpha, 8 bpp.
+      BlockBC3,
+      // 8 bpp. The encoder only emits mode 6 (one subset, RGBA 7.7.7.7 + p-bit
+      // endpoints, 16 levels), which already beats BC3 on most content.
+      BlockBC7
+   };
+
+   // Bytes per 4x4 block.
+   unsigned BlockSize(BlockFormat format);
+   const char* BlockFormatName(BlockFormat format);
+
+   // 4x4 blocks in rows, bottom row first like Image.
+   // Blocks sticking out of the image repeat its edge pixels.
+   struct CompressedImage
+   {
+      unsigned width;
+      unsigned height;
+      BlockFormat format;
+      std::vector<uint8_t> blocks;
+   };
+
+   // Rows of blocks are split across threads unless threaded is false.
+   CompressedImage CompressImage(const Image &image, BlockFormat format,
+         bool threaded = true);
+   std::vector<CompressedImage> CompressMipmaps(const std::vector<Image> &levels,
+         BlockFormat format, bool threaded = true);
+
+   // Back to the Image packing, to measure what the encoder lost.
+   // Throws GL::Exception on BC7 modes CompressImage() doesn't emit.
+   Image DecompressImage(const CompressedImage &image);
+
+   // Peak signal to noise ratio in dB over R, G, B and, with alpha, A.
+   // Identical images return infinity.
+   double PSNR(const Image &a, const Image &b, bool alpha = true);
+
+   // Compressed chains are stored next to the source as <source>.bc1, .bc3
+   // or .bc7 and, like .mips files, only used while the source's size and
+   // modification time match.
+   std::string BlockCachePath(const std::string &source, BlockFormat format);
+   void SaveBlockCache(const std::string &source,
+         const std::vector<CompressedImage> &levels);
+   // Returns false if there is no cache or it is out of date.
+   bool LoadBlockCache(const std::string &source, BlockFormat format,
+         std::vector<CompressedImage> &levels);
+}
+
+#endif
+
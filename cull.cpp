@@ -0,0 +1,399 @@
+#include "cull.hpp"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CULL_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CULL_TARGET(isa)
+#else
+#define CULL_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+namespace GLU
+{
+   Frustum ExtractFrustum(const GL::GLMatrix &m)
+   {
+      Frustum frustum;
+
+      // Clip space is inside when -w <= x, y, z <= w.
+      // Each plane is row 3 plus or minus one of rows 0-2.
+      for (unsigned i = 0; i < 6; i++)
+      {
+         unsigned row = i / 2;
+         float sign = (i & 1) ? -1.0f : 1.0f;
+         float *plane = frustum.planes[i];
+
+         for (unsigned c = 0; c < 4; c++)
+            plane[c] = m(3, c) + sign * m(row, c);
+
+         float len = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+         if (len > 0.0f)
+         {
+            for (unsigned c = 0; c < 4; c++)
+               plane[c] /= len;
+         }
+      }
+
+      return frustum;
+   }
+
+   static void finish_sphere(GL::Geo::Bounds &bounds)
+   {
+      float r2 = 0.0f;
+      for (unsigned i = 0; i < 3; i++)
+      {
+         bounds.center[i] = 0.5f * (bounds.min[i] + bounds.max[i]);
+         float half = 0.5f * (bounds.max[i] - bounds.min[i]);
+         r2 += half * half;
+      }
+      bounds.radius = std::sqrt(r2);
+   }
+
+   GL::Geo::Bounds ComputeBounds(const std::vector<GL::Geo::Coord> &vertices)
+   {
+      GL::Geo::Bounds bounds;
+      if (vertices.empty())
+      {
+         std::fill(bounds.min, bounds.min + 3, 0.0f);
+         std::fill(bounds.max, bounds.max + 3, 0.0f);
+         finish_sphere(bounds);
+         return bounds;
+      }
+
+      std::copy(vertices[0].vertex, vertices[0].vertex + 3, bounds.min);
+      std::copy(vertices[0].vertex, vertices[0].vertex + 3, bounds.max);
+      for (auto vert = std::begin(vertices); vert != std::end(vertices); ++vert)
+      {
+         for (unsigned i = 0; i < 3; i++)
+         {
+            bounds.min[i] = std::min(bounds.min[i], vert->vertex[i]);
+            bounds.max[i] = std::max(bounds.max[i], vert->vertex[i]);
+         }
+      }
+
+      finish_sphere(bounds);
+      return bounds;
+   }
+
+   GL::Geo::Bounds MergeBounds(const GL::Geo::Bounds &a, const GL::Geo::Bounds &b)
+   {
+      GL::Geo::Bounds bounds;
+      for (unsigned i = 0; i < 3; i++)
+      {
+         bounds.min[i] = std::min(a.min[i], b.min[i]);
+         bounds.max[i] = std::max(a.max[i], b.max[i]);
+      }
+
+      finish_sphere(bounds);
+      return bounds;
+   }
+
+   GL::Geo::Bounds TransformBounds(const GL::Geo::Bounds &in, const GL::GLMatrix &m)
+   {
+      GL::Geo::Bounds bounds;
+
+      float half[3];
+      for (unsigned i = 0; i < 3; i++)
+         half[i] = 0.5f * (in.max[i] - in.min[i]);
+
+      float max_scale2 = 0.0f;
+      for (unsigned j = 0; j < 3; j++)
+      {
+         float scale2 = m(0, j) * m(0, j) + m(1, j) * m(1, j) + m(2, j) * m(2, j);
+         max_scale2 = std::max(max_scale2, scale2);
+      }
+
+      for (unsigned i = 0; i < 3; i++)
+      {
+         float center = m(i, 3);
+         float extent = 0.0f;
+         for (unsigned j = 0; j < 3; j++)
+         {
+            center += m(i, j) * in.center[j];
+            extent += std::fabs(m(i, j)) * half[j];
+         }
+
+         bounds.center[i] = center;
+         bounds.min[i] = center - extent;
+         bounds.max[i] = center + extent;
+      }
+
+      bounds.radius = in.radius * std::sqrt(max_scale2);
+      return bounds;
+   }
+
+   bool Intersects(const Frustum &frustum, const GL::Geo::Bounds &bounds)
+   {
+      bool straddles = false;
+      for (unsigned i = 0; i < 6; i++)
+      {
+         const float *p = frustum.planes[i];
+         float dist = p[0] * bounds.center[0] + p[1] * bounds.center[1] +
+            p[2] * bounds.center[2] + p[3];
+
+         if (dist < -bounds.radius)
+            return false;
+         if (dist < bounds.radius)
+            straddles = true;
+      }
+
+      if (!straddles)
+         return true;
+
+      // Test the corner furthest along each plane normal.
+      for (unsigned i = 0; i < 6; i++)
+      {
+         const float *p = frustum.planes[i];
+         float dist = p[3];
+         for (unsigned c = 0; c < 3; c++)
+            dist += p[c] * (p[c] >= 0.0f ? bounds.max[c] : bounds.min[c]);
+
+         if (dist < 0.0f)
+            return false;
+      }
+
+      return true;
+   }
+
+   BoundsArray::BoundsArray() : m_size(0), m_capacity(0)
+   {}
+
+   BoundsArray::BoundsArray(const BoundsArray &other) : m_size(0), m_capacity(0)
+   {
+      *this = other;
+   }
+
+   // The aligned start moves with the buffer address, so copy array by array.
+   BoundsArray& BoundsArray::operator=(const BoundsArray &other)
+   {
+      if (this == &other)
+         return *this;
+
+      storage.assign(other.storage.size(), 0.0f);
+      m_size = other.m_size;
+      m_capacity = other.m_capacity;
+      for (unsigned comp = 0; comp < Components && m_capacity; comp++)
+      {
+         const float *src = other.data(static_cast<Component>(comp));
+         std::copy(src, src + m_capacity, data(static_cast<Component>(comp)));
+      }
+
+      return *this;
+   }
+
+   const float* BoundsArray::data(Component comp) const
+   {
+      return const_cast<BoundsArray*>(this)->data(comp);
+   }
+
+   float* BoundsArray::data(Component comp)
+   {
+      if (storage.empty())
+         return nullptr;
+
+      // std::vector does not align beyond alignof(float).
+      uintptr_t base = reinterpret_cast<uintptr_t>(storage.data());
+      uintptr_t aligned = (base + alignment - 1) & ~uintptr_t(alignment - 1);
+      return reinterpret_cast<float*>(aligned) + comp * m_capacity;
+   }
+
+   void BoundsArray::grow()
+   {
+      size_t capacity = std::max<size_t>(lanes, m_capacity * 2);
+      std::vector<float> old_storage(capacity * Components + alignment / sizeof(float));
+      std::swap(storage, old_storage);
+
+      // Recompute the old layout on the old buffer to copy from it.
+      BoundsArray old;
+      old.storage.swap(old_storage);
+      old.m_capacity = m_capacity;
+      m_capacity = capacity;
+
+      for (unsigned comp = 0; comp < Components; comp++)
+      {
+         float *dst = data(static_cast<Component>(comp));
+         if (m_size)
+         {
+            const float *src = old.data(static_cast<Component>(comp));
+            std::copy(src, src + m_size, dst);
+         }
+         std::fill(dst + m_size, dst + m_capacity, 0.0f);
+      }
+   }
+
+   void BoundsArray::push_back(const GL::Geo::Bounds &bounds)
+   {
+      if (m_size == m_capacity)
+         grow();
+
+      for (unsigned c = 0; c < 3; c++)
+      {
+         data(static_cast<Component>(MinX + c))[m_size] = bounds.min[c];
+         data(static_cast<Component>(MaxX + c))[m_size] = bounds.max[c];
+      }
+      m_size++;
+   }
+
+   void BoundsArray::clear()
+   {
+      m_size = 0;
+   }
+
+   namespace
+   {
+      // Per plane, the corner furthest along the normal comes from
+      // the max array where the normal is positive, min otherwise.
+      struct PlaneInput
+      {
+         const float *x;
+         const float *y;
+         const float *z;
+      };
+
+      void select_planes(const Frustum &frustum, const BoundsArray &bounds,
+            PlaneInput (&input)[6])
+      {
+         for (unsigned i = 0; i < 6; i++)
+         {
+            const float *p = frustum.planes[i];
+            input[i].x = bounds.data(p[0] >= 0.0f ? BoundsArray::MaxX : BoundsArray::MinX);
+            input[i].y = bounds.data(p[1] >= 0.0f ? BoundsArray::MaxY : BoundsArray::MinY);
+            input[i].z = bounds.data(p[2] >= 0.0f ? BoundsArray::MaxZ : BoundsArray::MinZ);
+         }
+      }
+
+      void cull_scalar(const Frustum &frustum, const PlaneInput (&input)[6],
+            size_t count, uint8_t *visible)
+      {
+         for (size_t i = 0; i < count; i++)
+         {
+            bool inside = true;
+            for (unsigned j = 0; j < 6; j++)
+            {
+               const float *p = frustum.planes[j];
+               float dist = p[0] * input[j].x[i] + p[1] * input[j].y[i] + p[2] * input[j].z[i] + p[3];
+               inside &= dist >= 0.0f;
+            }
+            visible[i] = inside;
+         }
+      }
+
+#ifdef CULL_X86
+      CULL_TARGET("sse2")
+      void cull_sse(const Frustum &frustum, const PlaneInput (&input)[6],
+            size_t count, uint8_t *visible)
+      {
+         __m128 planes[6][4];
+         for (unsigned j = 0; j < 6; j++)
+            for (unsigned c = 0; c < 4; c++)
+               planes[j][c] = _mm_set1_ps(frustum.planes[j][c]);
+
+         // Arrays are padded to a multiple of BoundsArray::lanes.
+         for (size_t i = 0; i < count; i += 4)
+         {
+            __m128 outside = _mm_setzero_ps();
+            for (unsigned j = 0; j < 6; j++)
+            {
+               __m128 dist = _mm_add_ps(
+                     _mm_add_ps(_mm_mul_ps(planes[j][0], _mm_load_ps(input[j].x + i)),
+                        _mm_mul_ps(planes[j][1], _mm_load_ps(input[j].y + i))),
+                     _mm_add_ps(_mm_mul_ps(planes[j][2], _mm_load_ps(input[j].z + i)),
+                        planes[j][3]));
+               outside = _mm_or_ps(outside, _mm_cmplt_ps(dist, _mm_setzero_ps()));
+            }
+
+            int mask = _mm_movemask_ps(outside);
+            size_t lanes = std::min<size_t>(4, count - i);
+            for (size_t l = 0; l < lanes; l++)
+               visible[i + l] = !((mask >> l) & 1);
+         }
+      }
+
+      CULL_TARGET("avx")
+      void cull_avx(const Frustum &frustum, const PlaneInput (&input)[6],
+            size_t count, uint8_t *visible)
+      {
+         __m256 planes[6][4];
+         for (unsigned j = 0; j < 6; j++)
+            for (unsigned c = 0; c < 4; c++)
+               planes[j][c] = _mm256_set1_ps(frustum.planes[j][c]);
+
+         for (size_t i = 0; i < count; i += 8)
+         {
+            __m256 outside = _mm256_setzero_ps();
+            for (unsigned j = 0; j < 6; j++)
+            {
+               __m256 dist = _mm256_add_ps(
+                     _mm256_add_ps(_mm256_mul_ps(planes[j][0], _mm256_load_ps(input[j].x + i)),
+                        _mm256_mul_ps(planes[j][1], _mm256_load_ps(input[j].y + i))),
+                     _mm256_add_ps(_mm256_mul_ps(planes[j][2], _mm256_load_ps(input[j].z + i)),
+                        planes[j][3]));
+               outside = _mm256_or_ps(outside, _mm256_cmp_ps(dist, _mm256_setzero_ps(), _CMP_LT_OQ));
+            }
+
+            int mask = _mm256_movemask_ps(outside);
+            size_t lanes = std::min<size_t>(8, count - i);
+            for (size_t l = 0; l < lanes; l++)
+               visible[i + l] = !((mask >> l) & 1);
+         }
+      }
+
+      bool cpu_has_avx()
+      {
+#ifdef _MSC_VER
+         int info[4];
+         __cpuid(info, 1);
+         bool osxsave = (info[2] >> 27) & 1;
+         bool avx = (info[2] >> 28) & 1;
+         // The OS must save the YMM registers too.
+         return osxsave && avx && (_xgetbv(0) & 6) == 6;
+#else
+         return __builtin_cpu_supports("avx");
+#endif
+      }
+#endif
+   }
+
+   CullKernel BestCullKernel()
+   {
+#ifdef CULL_X86
+      static const CullKernel kernel = cpu_has_avx() ? CullAVX : CullSSE;
+      return kernel;
+#else
+      return CullScalar;
+#endif
+   }
+
+   void CullBounds(const Frustum &frustum, const BoundsArray &bounds,
+         uint8_t *visible, CullKernel kernel)
+   {
+      if (!bounds.size())
+         return;
+
+      PlaneInput input[6];
+      select_planes(frustum, bounds, input);
+
+      switch (kernel)
+      {
+#ifdef CULL_X86
+         case CullAVX:
+            if (BestCullKernel() == CullAVX)
+            {
+               cull_avx(frustum, input, bounds.size(), visible);
+               break;
+            }
+            // Fall through.
+         case CullSSE:
+            cull_sse(frustum, input, bounds.size(), visible);
+            break;
+#endif
+         default:
+            cull_scalar(frustum, input, bounds.size(), visible);
+            break;
+      }
+   }
+}
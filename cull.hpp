@@ -0,0 +1,77 @@
+#ifndef CULL_HPP__
+#define CULL_HPP__
+
+#include "gl.hpp"
+#include "structure.hpp"
+#include <vector>
+#include <stdint.h>
+
+namespace GLU
+{
+   // Six planes (left, right, bottom, top, near, far) as a, b, c, d with
+   // ax + by + cz + d >= 0 inside. Normals are unit length.
+   struct Frustum
+   {
+      float planes[6][4];
+   };
+
+   // Gribb/Hartmann extraction from a projection * view (* model) matrix.
+   // The planes are in the space the matrix transforms from.
+   Frustum ExtractFrustum(const GL::GLMatrix &matrix);
+
+   // Empty input gives an empty box at the origin.
+   GL::Geo::Bounds ComputeBounds(const std::vector<GL::Geo::Coord> &vertices);
+   GL::Geo::Bounds MergeBounds(const GL::Geo::Bounds &a, const GL::Geo::Bounds &b);
+
+   // Box enclosing the transformed box (Arvo), sphere scaled by
+   // the largest axis scale of matrix.
+   GL::Geo::Bounds TransformBounds(const GL::Geo::Bounds &bounds, const GL::GLMatrix &matrix);
+
+   // Sphere test first, the box is only tested when the sphere straddles a plane.
+   // Conservative, some boxes outside near frustum corners pass.
+   bool Intersects(const Frustum &frustum, const GL::Geo::Bounds &bounds);
+
+   // Boxes stored as six separate float arrays (min x/y/z, max x/y/z),
+   // each 32-byte aligned and padded to a multiple of 8 for CullBounds().
+   class BoundsArray
+   {
+      public:
+         enum Component { MinX, MinY, MinZ, MaxX, MaxY, MaxZ, Components };
+         enum { alignment = 32, lanes = 8 };
+
+         BoundsArray();
+         BoundsArray(const BoundsArray &other);
+         BoundsArray& operator=(const BoundsArray &other);
+
+         void push_back(const GL::Geo::Bounds &bounds);
+         void clear();
+         size_t size() const { return m_size; }
+
+         const float* data(Component comp) const;
+
+      private:
+         std::vector<float> storage;
+         size_t m_size;
+         size_t m_capacity;
+
+         float* data(Component comp);
+         void grow();
+   };
+
+   enum CullKernel
+   {
+      CullScalar,
+      CullSSE,
+      CullAVX
+   };
+
+   // The widest kernel the CPU supports, detected on first use.
+   CullKernel BestCullKernel();
+
+   // Box test as in Intersects(), without the sphere test, which never
+   // rejects more. visible[i] is set to 1 if box i may be inside, 0 if not.
+   void CullBounds(const Frustum &frustum, const BoundsArray &bounds,
+         uint8_t *visible, CullKernel kernel = BestCullKernel());
+}
+
+#endif
@@ -15,5 +15,54 @@ namespace GL
 
    Exception::~Exception() throw()
    {}
-}
 
+   sgl_function_t gl_functions[GLFunc_Count];
+
+   void LoadGLFunctions()
+   {
+      struct Entry
+      {
+         const char *sym;
+         sgl_function_t func;
+         bool required;
+      };
+
+      // GL 1.1 stuff is not found dynamically in Windows. :(
+      // Statically initialize them.
+      static const Entry entries[] = {
+#define GL_FUNC_CORE(sym) { #sym, reinterpret_cast<sgl_function_t>(sym), true },
+#define GL_FUNC(sym) { #sym, nullptr, true },
+#define GL_FUNC_OPT(sym) { #sym, nullptr, false },
+#include "gl_functions.hpp"
+#undef GL_FUNC_CORE
+#undef GL_FUNC
+#undef GL_FUNC_OPT
+      };
+
+      for (unsigned i = 0; i < GLFunc_Count; i++)
+      {
+         sgl_function_t func = entries[i].func;
+         if (!func)
+            func = sgl_get_proc_address(entries[i].sym);
+
+         if (!func && entries[i].required)
+            throw Exception(GLU::join("GL Symbol ", entries[i].sym, " not found!"));
+
+         gl_functions[i] = func;
+      }
+   }
+
+   bool HasExtension(const std::string &name)
+   {
+      GLint count = 0;
+      GLSYM(glGetIntegerv)(GL_NUM_EXTENSIONS, &count);
+      for (GLint i = 0; i < count; i++)
+      {
+         auto ext = reinterpret_cast<const char*>(GLSYM(glGetStringi)(GL_EXTENSIONS, i));
+         if (ext && name == ext)
+            return true;
+      }
+
+      return false;
+   }
+}
@@ -4,13 +4,25 @@
 
 #include "sgl/sgl.h"
 
+// The glext.h bundled for Windows predates GL 4.3.
+#ifndef GL_VERSION_4_3
+extern "C" void APIENTRY glMultiDrawElementsIndirect(GLenum mode, GLenum type,
+      const void *indirect, GLsizei drawcount, GLsizei stride);
+extern "C" void APIENTRY glCopyImageSubData(GLuint srcName, GLenum srcTarget, GLint srcLevel,
+      GLint srcX, GLint srcY, GLint srcZ, GLuint dstName, GLenum dstTarget, GLint dstLevel,
+      GLint dstX, GLint dstY, GLint dstZ, GLsizei srcWidth, GLsizei srcHeight, GLsizei srcDepth);
+#endif
+
 #include <stdexcept>
 #include <string>
 #include <cstring>
 #include <map>
 
-// On-the-fly extension wrangler :o
-#define GLSYM(sym) (::GL::sym_to_func<decltype(&sym)>(#sym))
+// Extension wrangler. Entry points are resolved once per context into a
+// table indexed by GLFunc_<sym>, so a call is a single indirect call.
+// Entry points must be listed in gl_functions.hpp.
+#define GLSYM(sym) (reinterpret_cast<decltype(&sym)>(::GL::gl_functions[::GL::GLFunc_##sym]))
+#define GLSYM_AVAILABLE(sym) (::GL::gl_functions[::GL::GLFunc_##sym] != nullptr)
 
 #include "utils.hpp"
 
@@ -33,23 +45,26 @@ namespace GL
 
 namespace GL
 {
-   template <class Func, class T>
-   inline Func sym_to_func(const T &gl_sym)
+   enum GLFunction
    {
-      auto &map = Window::get()->symbol(gl_sym);
+#define GL_FUNC_CORE(sym) GLFunc_##sym,
+#define GL_FUNC(sym) GLFunc_##sym,
+#define GL_FUNC_OPT(sym) GLFunc_##sym,
+#include "gl_functions.hpp"
+#undef GL_FUNC_CORE
+#undef GL_FUNC
+#undef GL_FUNC_OPT
+      GLFunc_Count
+   };
 
-      sgl_function_t symbol = map;
-      if (!symbol)
-      {
-         symbol = sgl_get_proc_address(gl_sym);
-         if (!symbol)
-            throw Exception(GLU::join("GL Symbol ", gl_sym, " not found!"));
+   extern sgl_function_t gl_functions[GLFunc_Count];
 
-         map = symbol;
-      }
+   // Fills in gl_functions for the current context.
+   // Throws if a required entry point is missing.
+   void LoadGLFunctions();
 
-      return reinterpret_cast<Func>(symbol);
-   }
+   // Queries the extension list of the current context.
+   bool HasExtension(const std::string &name);
 }
 
 #endif
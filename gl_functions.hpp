@@ -0,0 +1,94 @@
+// Every GL entry point called through GLSYM().
+// Included several times with different definitions of the macros below,
+// see gl.hpp. Calling a function not listed here fails to compile.
+//
+// GL_FUNC_CORE: GL 1.1. Windows only exports these statically.
+// GL_FUNC: Required by the GL 3.3 core context we create.
+// GL_FUNC_OPT: Extensions and newer entry points. Check with GLSYM_AVAILABLE().
+
+GL_FUNC_CORE(glBindTexture)
+GL_FUNC_CORE(glBlendFunc)
+GL_FUNC_CORE(glClear)
+GL_FUNC_CORE(glClearColor)
+GL_FUNC_CORE(glDeleteTextures)
+GL_FUNC_CORE(glDrawArrays)
+GL_FUNC_CORE(glDrawElements)
+GL_FUNC_CORE(glEnable)
+GL_FUNC_CORE(glGenTextures)
+GL_FUNC_CORE(glGetError)
+GL_FUNC_CORE(glGetIntegerv)
+GL_FUNC_CORE(glTexImage2D)
+GL_FUNC_CORE(glTexParameteri)
+GL_FUNC_CORE(glTexSubImage2D)
+GL_FUNC_CORE(glViewport)
+
+GL_FUNC(glActiveTexture)
+GL_FUNC(glAttachShader)
+GL_FUNC(glBindBuffer)
+GL_FUNC(glBindBufferBase)
+GL_FUNC(glBindFramebuffer)
+GL_FUNC(glBindRenderbuffer)
+GL_FUNC(glBindSampler)
+GL_FUNC(glBindVertexArray)
+GL_FUNC(glBufferData)
+GL_FUNC(glBufferSubData)
+GL_FUNC(glCheckFramebufferStatus)
+GL_FUNC(glClientWaitSync)
+GL_FUNC(glCompileShader)
+GL_FUNC(glCompressedTexImage2D)
+GL_FUNC(glCompressedTexSubImage2D)
+GL_FUNC(glCopyBufferSubData)
+GL_FUNC(glCreateProgram)
+GL_FUNC(glCreateShader)
+GL_FUNC(glDeleteBuffers)
+GL_FUNC(glDeleteFramebuffers)
+GL_FUNC(glDeleteProgram)
+GL_FUNC(glDeleteRenderbuffers)
+GL_FUNC(glDeleteShader)
+GL_FUNC(glDeleteSync)
+GL_FUNC(glDeleteVertexArrays)
+GL_FUNC(glDetachShader)
+GL_FUNC(glEnableVertexAttribArray)
+GL_FUNC(glFenceSync)
+GL_FUNC(glFramebufferRenderbuffer)
+GL_FUNC(glFramebufferTexture2D)
+GL_FUNC(glGenBuffers)
+GL_FUNC(glGenerateMipmap)
+GL_FUNC(glGenFramebuffers)
+GL_FUNC(glGenRenderbuffers)
+GL_FUNC(glGenSamplers)
+GL_FUNC(glGenVertexArrays)
+GL_FUNC(glGetActiveUniform)
+GL_FUNC(glGetActiveUniformBlockName)
+GL_FUNC(glGetAttribLocation)
+GL_FUNC(glGetProgramInfoLog)
+GL_FUNC(glGetProgramiv)
+GL_FUNC(glGetShaderInfoLog)
+GL_FUNC(glGetShaderiv)
+GL_FUNC(glGetStringi)
+GL_FUNC(glGetUniformLocation)
+GL_FUNC(glIsProgram)
+GL_FUNC(glIsShader)
+GL_FUNC(glLinkProgram)
+GL_FUNC(glMapBufferRange)
+GL_FUNC(glMultiDrawElementsBaseVertex)
+GL_FUNC(glRenderbufferStorage)
+GL_FUNC(glSamplerParameteri)
+GL_FUNC(glShaderSource)
+GL_FUNC(glTexBuffer)
+GL_FUNC(glUniform1i)
+GL_FUNC(glUniform2i)
+GL_FUNC(glUniform3f)
+GL_FUNC(glUniform3fv)
+GL_FUNC(glUniformBlockBinding)
+GL_FUNC(glUniformMatrix4fv)
+GL_FUNC(glUnmapBuffer)
+GL_FUNC(glUseProgram)
+GL_FUNC(glValidateProgram)
+GL_FUNC(glVertexAttribIPointer)
+GL_FUNC(glVertexAttribPointer)
+
+GL_FUNC_OPT(glCopyImageSubData)
+GL_FUNC_OPT(glDebugMessageCallbackARB)
+GL_FUNC_OPT(glDebugMessageControlARB)
+GL_FUNC_OPT(glMultiDrawElementsIndirect)
@@ -0,0 +1,871 @@
+#include "image.hpp"
+#include "gl.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <utility>
+#include <fstream>
+#include <cmath>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define IMAGE_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define IMAGE_TARGET(isa)
+#else
+#define IMAGE_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+namespace GLU
+{
+   namespace
+   {
+      void convert_scalar(const uint8_t *in, unsigned bits, size_t count, uint32_t *out)
+      {
+         if (bits == 32)
+         {
+            for (size_t i = 0; i < count; i++)
+            {
+               uint32_t b = in[i * 4 + 0];
+               uint32_t g = in[i * 4 + 1];
+               uint32_t r = in[i * 4 + 2];
+               uint32_t a = in[i * 4 + 3];
+
+               out[i] = (b << 24) | (g << 16) | (r << 8) | a;
+            }
+         }
+         else
+         {
+            for (size_t i = 0; i < count; i++)
+            {
+               uint32_t b = in[i * 3 + 0];
+               uint32_t g = in[i * 3 + 1];
+               uint32_t r = in[i * 3 + 2];
+               uint32_t a = 0xff;
+
+               out[i] = (b << 24) | (g << 16) | (r << 8) | a;
+            }
+         }
+      }
+
+#ifdef IMAGE_X86
+      // On little endian the packed pixel is stored as A, R, G, B, so
+      // 32-bit pixels are byte reversed and 24-bit pixels are reversed
+      // into bytes 1-3 with alpha or'ed into byte 0.
+      IMAGE_TARGET("ssse3")
+      void convert_ssse3(const uint8_t *in, unsigned bits, size_t count, uint32_t *out)
+      {
+         size_t i = 0;
+         if (bits == 32)
+         {
+            const __m128i reverse = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+                  11, 10, 9, 8, 15, 14, 13, 12);
+            for (; i + 4 <= count; i += 4)
+            {
+               __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 4 * i));
+               _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_shuffle_epi8(px, reverse));
+            }
+         }
+         else
+         {
+            const __m128i expand = _mm_setr_epi8(-1, 2, 1, 0, -1, 5, 4, 3,
+                  -1, 8, 7, 6, -1, 11, 10, 9);
+            const __m128i alpha = _mm_set1_epi32(0xff);
+            // 16-byte loads for 12 bytes of pixels, stop before overreading.
+            for (; i + 6 <= count; i += 4)
+            {
+               __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 3 * i));
+               _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                     _mm_or_si128(_mm_shuffle_epi8(px, expand), alpha));
+            }
+         }
+
+         convert_scalar(in + i * (bits / 8), bits, count - i, out + i);
+      }
+
+      IMAGE_TARGET("avx2")
+      void convert_avx2(const uint8_t *in, unsigned bits, size_t count, uint32_t *out)
+      {
+         size_t i = 0;
+         if (bits == 32)
+         {
+            const __m256i reverse = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+                  11, 10, 9, 8, 15, 14, 13, 12,
+                  3, 2, 1, 0, 7, 6, 5, 4,
+                  11, 10, 9, 8, 15, 14, 13, 12);
+            for (; i + 8 <= count; i += 8)
+            {
+               __m256i px = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + 4 * i));
+               _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_shuffle_epi8(px, reverse));
+            }
+         }
+         else
+         {
+            // Shuffles stay within 128-bit lanes, so pixels 4-7 (bytes 12-23)
+            // are first moved to the upper lane.
+            const __m256i spread = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+            const __m256i expand = _mm256_setr_epi8(-1, 2, 1, 0, -1, 5, 4, 3,
+                  -1, 8, 7, 6, -1, 11, 10, 9,
+                  -1, 2, 1, 0, -1, 5, 4, 3,
+                  -1, 8, 7, 6, -1, 11, 10, 9);
+            const __m256i alpha = _mm256_set1_epi32(0xff);
+            // 32-byte loads for 24 bytes of pixels.
+            for (; i + 11 <= count; i += 8)
+            {
+               __m256i px = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + 3 * i));
+               px = _mm256_permutevar8x32_epi32(px, spread);
+               _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i),
+                     _mm256_or_si256(_mm256_shuffle_epi8(px, expand), alpha));
+            }
+         }
+
+         convert_ssse3(in + i * (bits / 8), bits, count - i, out + i);
+      }
+
+      PixelKernel detect_kernel()
+      {
+#ifdef _MSC_VER
+         int info[4];
+         __cpuid(info, 1);
+         bool ssse3 = (info[2] >> 9) & 1;
+         bool osxsave = (info[2] >> 27) & 1;
+         __cpuid(info, 0);
+         bool avx2 = false;
+         if (info[0] >= 7)
+         {
+            __cpuidex(info, 7, 0);
+            // The OS must save the YMM registers too.
+            avx2 = osxsave && ((info[1] >> 5) & 1) && (_xgetbv(0) & 6) == 6;
+         }
+#else
+         bool ssse3 = __builtin_cpu_supports("ssse3");
+         bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+         if (avx2)
+            return PixelAVX2;
+         return ssse3 ? PixelSSSE3 : PixelScalar;
+      }
+#endif
+   }
+
+   PixelKernel BestPixelKernel()
+   {
+#ifdef IMAGE_X86
+      static const PixelKernel kernel = detect_kernel();
+      return kernel;
+#else
+      return PixelScalar;
+#endif
+   }
+
+   void ConvertBGR(const uint8_t *in, unsigned bits, size_t count,
+         uint32_t *out, PixelKernel kernel)
+   {
+      if (bits != 24 && bits != 32)
+         throw GL::Exception(join("Cannot convert ", bits, "-bit pixels."));
+
+      // Asking for more than the CPU has falls back to the best it does have.
+      kernel = std::min(kernel, BestPixelKernel());
+      switch (kernel)
+      {
+#ifdef IMAGE_X86
+         case PixelAVX2:
+            convert_avx2(in, bits, count, out);
+            break;
+         case PixelSSSE3:
+            convert_ssse3(in, bits, count, out);
+            break;
+#endif
+         default:
+            convert_scalar(in, bits, count, out);
+            break;
+      }
+   }
+
+   TGAHeader ParseTGAHeader(const uint8_t *data, size_t size, size_t file_size)
+   {
+      enum { header_size = 18 };
+      if (size < header_size || file_size < header_size)
+         throw GL::Exception("Targa file is truncated.");
+
+      TGAHeader header;
+      unsigned type = data[2];
+      switch (type)
+      {
+         case 2:
+         case 10:
+            header.gray = false;
+            break;
+         case 3:
+         case 11:
+            header.gray = true;
+            break;
+         default:
+            throw GL::Exception(join("Targa image type ", type, " not supported."));
+      }
+      header.compressed = type >= 9;
+
+      header.width = data[12] + data[13] * 256;
+      header.height = data[14] + data[15] * 256;
+      if (!header.width || !header.height)
+         throw GL::Exception(join("Targa with size ", header.width, "x", header.height, " not supported!"));
+
+      header.bits = data[16];
+      if (header.gray ? header.bits != 8 && header.bits != 16 :
+            header.bits != 24 && header.bits != 32)
+         throw GL::Exception(join("Targa with bit depth ", header.bits, " not supported!"));
+
+      header.right_origin = data[17] & 0x10;
+      header.top_origin = data[17] & 0x20;
+
+      // The image ID and an optional color map precede the pixels.
+      header.data_offset = header_size + data[0];
+      if (data[1])
+         header.data_offset += (data[5] + data[6] * 256) * ((data[7] + 7) / 8);
+
+      // Run-length packets hold at most 128 pixels, so even a perfectly
+      // compressed image has a lower bound on its size.
+      size_t count = size_t(header.width) * header.height;
+      size_t bytes = header.bits / 8;
+      size_t min_size = header.compressed ? (count + 127) / 128 * (1 + bytes) : count * bytes;
+      if (header.data_offset + min_size > file_size)
+         throw GL::Exception("Targa file is truncated.");
+
+      return header;
+   }
+
+   TGADecoder::TGADecoder(const TGAHeader &header, uint32_t *out)
+      : header(header), out(out), bytes(header.bits / 8),
+      remaining(size_t(header.width) * header.height), x(0), y(0),
+      packet_left(0), packet_rle(false), partial_size(0)
+   {}
+
+   bool TGADecoder::done() const
+   {
+      return !remaining;
+   }
+
+   void TGADecoder::convert(const uint8_t *in, size_t count, uint32_t *dst) const
+   {
+      // Short raw packets and run values are not worth a SIMD dispatch.
+      if (!header.gray && count >= 16)
+      {
+         ConvertBGR(in, header.bits, count, dst);
+         return;
+      }
+      else if (!header.gray)
+      {
+         for (size_t i = 0; i < count; i++, in += bytes)
+         {
+            uint32_t a = bytes == 4 ? in[3] : 0xff;
+            dst[i] = (uint32_t(in[0]) << 24) | (uint32_t(in[1]) << 16) | (uint32_t(in[2]) << 8) | a;
+         }
+         return;
+      }
+
+      for (size_t i = 0; i < count; i++)
+      {
+         uint32_t v = in[i * bytes];
+         uint32_t a = bytes == 2 ? in[i * bytes + 1] : 0xff;
+         dst[i] = (v << 24) | (v << 16) | (v << 8) | a;
+      }
+   }
+
+   uint32_t* TGADecoder::row() const
+   {
+      unsigned dst_y = header.top_origin ? header.height - 1 - y : y;
+      return out + size_t(dst_y) * header.width;
+   }
+
+   // Destination of the next pixels, count is clamped to the end of the row.
+   uint32_t* TGADecoder::row_span(size_t &count) const
+   {
+      count = std::min<size_t>(count, header.width - x);
+      return row() + x;
+   }
+
+   void TGADecoder::advance(size_t count)
+   {
+      remaining -= count;
+      x += count;
+      if (x < header.width)
+         return;
+
+      if (header.right_origin)
+         std::reverse(row(), row() + header.width);
+
+      x = 0;
+      y++;
+   }
+
+   void TGADecoder::write(const uint8_t *in, size_t count)
+   {
+      while (count)
+      {
+         size_t span = count;
+         uint32_t *dst = row_span(span);
+         convert(in, span, dst);
+         advance(span);
+         in += span * bytes;
+         count -= span;
+      }
+   }
+
+   void TGADecoder::fill(uint32_t value, size_t count)
+   {
+      while (count)
+      {
+         size_t span = count;
+         uint32_t *dst = row_span(span);
+         std::fill(dst, dst + span, value);
+         advance(span);
+         count -= span;
+      }
+   }
+
+   size_t TGADecoder::feed(const uint8_t *data, size_t size)
+   {
+      const uint8_t *start = data;
+      while (remaining && size)
+      {
+         if (!packet_left)
+         {
+            if (header.compressed)
+            {
+               packet_rle = *data & 0x80;
+               packet_left = (*data & 0x7f) + 1;
+               data++;
+               size--;
+            }
+            else
+               packet_left = remaining;
+
+            // Runs may cross rows, but not the end of the image.
+            packet_left = std::min(packet_left, remaining);
+            continue;
+         }
+
+         // A pixel split between two calls is gathered first.
+         if (partial_size || size < bytes)
+         {
+            size_t take = std::min<size_t>(bytes - partial_size, size);
+            std::copy(data, data + take, partial + partial_size);
+            partial_size += take;
+            data += take;
+            size -= take;
+            if (partial_size < bytes)
+               break;
+
+            partial_size = 0;
+            uint32_t value;
+            convert(partial, 1, &value);
+            size_t count = packet_rle ? packet_left : 1;
+            fill(value, count);
+            packet_left -= count;
+            continue;
+         }
+
+         if (packet_rle)
+         {
+            uint32_t value;
+            convert(data, 1, &value);
+            fill(value, packet_left);
+            packet_left = 0;
+            data += bytes;
+            size -= bytes;
+         }
+         else
+         {
+            size_t count = std::min<size_t>(packet_left, size / bytes);
+            write(data, count);
+            packet_left -= count;
+            data += count * bytes;
+            size -= count * bytes;
+         }
+      }
+
+      return data - start;
+   }
+
+   Image DecodeTGA(const uint8_t *data, size_t size)
+   {
+      auto header = ParseTGAHeader(data, size, size);
+
+      Image img;
+      img.width = header.width;
+      img.height = header.height;
+      img.pixels.resize(size_t(img.width) * img.height);
+
+      TGADecoder decoder(header, img.pixels.empty() ? nullptr : &img.pixels[0]);
+      decoder.feed(data + header.data_offset, size - header.data_offset);
+      if (!decoder.done())
+         throw GL::Exception("Targa file is truncated.");
+
+      return img;
+   }
+
+   Image LoadTGA(const std::string &path)
+   {
+      MappedFile file(path);
+      return DecodeTGA(reinterpret_cast<const uint8_t*>(file.data()), file.size());
+   }
+
+   namespace
+   {
+      struct MipTables
+      {
+         float srgb_to_linear[256];
+         float unorm_to_float[256];
+         // Indexed by linear * 4095, fine enough near black.
+         uint8_t linear_to_srgb[4096];
+         float kaiser[8];
+
+         MipTables()
+         {
+            for (unsigned i = 0; i < 256; i++)
+            {
+               float v = i / 255.0f;
+               unorm_to_float[i] = v;
+               srgb_to_linear[i] = v <= 0.04045f ? v / 12.92f :
+                  std::pow((v + 0.055f) / 1.055f, 2.4f);
+            }
+
+            for (unsigned i = 0; i < 4096; i++)
+            {
+               float v = i / 4095.0f;
+               float s = v <= 0.0031308f ? v * 12.92f :
+                  1.055f * std::pow(v, 1.0f / 2.4f) - 0.055f;
+               linear_to_srgb[i] = static_cast<uint8_t>(std::min(255.0f, s * 255.0f + 0.5f));
+            }
+
+            // Taps at source offsets -3.5 to 3.5 around the destination
+            // texel, sinc cut off at the new Nyquist rate, beta = 4.
+            const double pi = 3.14159265358979323846;
+            auto bessel_i0 = [](double x) {
+               double sum = 1.0, term = 1.0;
+               for (unsigned k = 1; k < 20; k++)
+               {
+                  term *= (x / (2 * k)) * (x / (2 * k));
+                  sum += term;
+               }
+               return sum;
+            };
+
+            double total = 0.0;
+            double weights[8];
+            for (unsigned i = 0; i < 8; i++)
+            {
+               double d = i - 3.5;
+               double sinc = std::sin(pi * d / 2.0) / (pi * d / 2.0);
+               double t = d / 4.0;
+               weights[i] = sinc * bessel_i0(4.0 * std::sqrt(1.0 - t * t)) / bessel_i0(4.0);
+               total += weights[i];
+            }
+            for (unsigned i = 0; i < 8; i++)
+               kaiser[i] = static_cast<float>(weights[i] / total);
+         }
+      };
+
+      // Built on first use, before any worker threads start.
+      const MipTables& mip_tables()
+      {
+         static const MipTables tables;
+         return tables;
+      }
+
+      // One RGBA texel in linear float, a single register with SSE.
+#ifdef GL_LINEAR_SSE
+      typedef __m128 Texel;
+
+      inline Texel texel(float r, float g, float b, float a)
+      {
+         return _mm_setr_ps(r, g, b, a);
+      }
+
+      inline Texel texel_zero()
+      {
+         return _mm_setzero_ps();
+      }
+
+      inline Texel texel_madd(Texel t, float w, Texel acc)
+      {
+         return GL::SSE::madd(t, _mm_set1_ps(w), acc);
+      }
+
+      inline Texel texel_load(const float *in)
+      {
+         return _mm_loadu_ps(in);
+      }
+
+      inline void texel_save(Texel t, float *out)
+      {
+         _mm_storeu_ps(out, t);
+      }
+
+      // Clamped to [0, 1].
+      inline void texel_store(Texel t, float *out)
+      {
+         _mm_storeu_ps(out, _mm_min_ps(_mm_max_ps(t, _mm_setzero_ps()), _mm_set1_ps(1.0f)));
+      }
+#else
+      struct Texel
+      {
+         float v[4];
+      };
+
+      inline Texel texel(float r, float g, float b, float a)
+      {
+         Texel t = {{ r, g, b, a }};
+         return t;
+      }
+
+      inline Texel texel_zero()
+      {
+         return texel(0.0f, 0.0f, 0.0f, 0.0f);
+      }
+
+      inline Texel texel_madd(Texel t, float w, Texel acc)
+      {
+         for (unsigned i = 0; i < 4; i++)
+            acc.v[i] += t.v[i] * w;
+         return acc;
+      }
+
+      inline Texel texel_load(const float *in)
+      {
+         return texel(in[0], in[1], in[2], in[3]);
+      }
+
+      inline void texel_save(Texel t, float *out)
+      {
+         std::copy(t.v, t.v + 4, out);
+      }
+
+      inline void texel_store(Texel t, float *out)
+      {
+         for (unsigned i = 0; i < 4; i++)
+            out[i] = std::min(std::max(t.v[i], 0.0f), 1.0f);
+      }
+#endif
+
+      inline Texel fetch(uint32_t px, const float *color)
+      {
+         return texel(color[(px >> 8) & 0xff], color[(px >> 16) & 0xff],
+               color[px >> 24], (px & 0xff) * (1.0f / 255.0f));
+      }
+
+      inline uint32_t encode(Texel t, const MipTables &tables, bool srgb)
+      {
+         float v[4];
+         texel_store(t, v);
+
+         uint32_t c[3];
+         for (unsigned i = 0; i < 3; i++)
+         {
+            c[i] = srgb ? tables.linear_to_srgb[static_cast<unsigned>(v[i] * 4095.0f + 0.5f)] :
+               static_cast<uint32_t>(v[i] * 255.0f + 0.5f);
+         }
+         uint32_t a = static_cast<uint32_t>(v[3] * 255.0f + 0.5f);
+
+         return (c[2] << 24) | (c[1] << 16) | (c[0] << 8) | a;
+      }
+
+      void downsample_box(const Image &src, Image &dst, size_t begin, size_t end,
+            const MipTables &tables, bool srgb)
+      {
+         const float *color = srgb ? tables.srgb_to_linear : tables.unorm_to_float;
+         for (size_t y = begin; y < end; y++)
+         {
+            const uint32_t *row0 = &src.pixels[std::min<size_t>(2 * y, src.height - 1) * src.width];
+            const uint32_t *row1 = &src.pixels[std::min<size_t>(2 * y + 1, src.height - 1) * src.width];
+            uint32_t *out = &dst.pixels[y * dst.width];
+
+            for (unsigned x = 0; x < dst.width; x++)
+            {
+               unsigned x0 = std::min(2 * x, src.width - 1);
+               unsigned x1 = std::min(2 * x + 1, src.width - 1);
+
+               Texel acc = texel_madd(fetch(row0[x0], color), 0.25f, texel_zero());
+               acc = texel_madd(fetch(row0[x1], color), 0.25f, acc);
+               acc = texel_madd(fetch(row1[x0], color), 0.25f, acc);
+               acc = texel_madd(fetch(row1[x1], color), 0.25f, acc);
+               out[x] = encode(acc, tables, srgb);
+            }
+         }
+      }
+
+      // Separable. Source rows are converted to linear and filtered
+      // horizontally once, into a ring of the 8 rows the current
+      // destination row needs, then combined vertically.
+      void downsample_kaiser(const Image &src, Image &dst, size_t begin, size_t end,
+            const MipTables &tables, bool srgb)
+      {
+         const float *color = srgb ? tables.srgb_to_linear : tables.unorm_to_float;
+         auto clamp = [](long v, unsigned size) {
+            return static_cast<size_t>(std::min<long>(std::max<long>(v, 0), size - 1));
+         };
+
+         size_t stride = 4 * size_t(dst.width);
+         std::vector<float> linear(4 * size_t(src.width));
+         std::vector<float> ring(8 * stride);
+
+         // Unclamped index of the next source row to filter into the ring.
+         long next = 2 * long(begin) - 3;
+         for (size_t y = begin; y < end; y++)
+         {
+            for (; next <= 2 * long(y) + 4; next++)
+            {
+               const uint32_t *row = &src.pixels[clamp(next, src.height) * src.width];
+               for (unsigned x = 0; x < src.width; x++)
+                  texel_save(fetch(row[x], color), &linear[4 * x]);
+
+               float *filtered = &ring[(next & 7) * stride];
+               for (unsigned x = 0; x < dst.width; x++)
+               {
+                  Texel acc = texel_zero();
+                  for (unsigned tx = 0; tx < 8; tx++)
+                  {
+                     acc = texel_madd(texel_load(&linear[4 * clamp(2 * long(x) - 3 + tx, src.width)]),
+                           tables.kaiser[tx], acc);
+                  }
+                  texel_save(acc, &filtered[4 * x]);
+               }
+            }
+
+            uint32_t *out = &dst.pixels[y * dst.width];
+            for (unsigned x = 0; x < dst.width; x++)
+            {
+               Texel acc = texel_zero();
+               for (unsigned ty = 0; ty < 8; ty++)
+               {
+                  long row = 2 * long(y) - 3 + ty;
+                  acc = texel_madd(texel_load(&ring[(row & 7) * stride + 4 * x]),
+                        tables.kaiser[ty], acc);
+               }
+               out[x] = encode(acc, tables, srgb);
+            }
+         }
+      }
+
+      // Layout of a .mips file, followed by width, height and the pixels of each level.
+      struct MipCacheHeader
+      {
+         char magic[4];
+         uint32_t filter;
+         uint64_t source_size;
+         int64_t source_mtime;
+         uint32_t srgb;
+         uint32_t levels;
+      };
+   }
+
+   std::vector<Image> GenerateMipmaps(Image base, MipFilter filter, bool srgb, bool threaded)
+   {
+      const MipTables &tables = mip_tables();
+
+      std::vector<Image> levels;
+      levels.push_back(std::move(base));
+      while (levels.back().width > 1 || levels.back().height > 1)
+      {
+         const Image &src = levels.back();
+         Image dst;
+         dst.width = std::max(1u, src.width / 2);
+         dst.height = std::max(1u, src.height / 2);
+         dst.pixels.resize(size_t(dst.width) * dst.height);
+
+         auto rows = [&](size_t begin, size_t end) {
+            if (filter == MipKaiser)
+               downsample_kaiser(src, dst, begin, end, tables, srgb);
+            else
+               downsample_box(src, dst, begin, end, tables, srgb);
+         };
+
+         if (threaded)
+            ParallelFor(dst.height, std::max(1u, 16384 / dst.width), rows);
+         else
+            rows(0, dst.height);
+
+         levels.push_back(std::move(dst));
+      }
+
+      return levels;
+   }
+
+   bool FileStamp(const std::string &path, uint64_t &size, int64_t &mtime)
+   {
+      struct stat st;
+      if (stat(path.c_str(), &st) < 0)
+         return false;
+
+      size = st.st_size;
+      mtime = st.st_mtime;
+      return true;
+   }
+
+   std::string MipCachePath(const std::string &source)
+   {
+      return source + ".mips";
+   }
+
+   void SaveMipCache(const std::string &source, const std::vector<Image> &levels,
+         MipFilter filter, bool srgb)
+   {
+      MipCacheHeader header = {{ 'M', 'I', 'P', '1' }};
+      if (!FileStamp(source, header.source_size, header.source_mtime))
+         throw GL::Exception(join("Failed to stat file: ", source));
+      header.filter = filter;
+      header.srgb = srgb;
+      header.levels = levels.size();
+
+      std::ofstream file(MipCachePath(source), std::ios::out | std::ios::binary);
+      if (!file.is_open())
+         throw GL::Exception(join("Cannot open file: ", MipCachePath(source)));
+
+      file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      for (auto level = std::begin(levels); level != std::end(levels); ++level)
+      {
+         uint32_t size[2] = { level->width, level->height };
+         file.write(reinterpret_cast<const char*>(size), sizeof(size));
+         file.write(reinterpret_cast<const char*>(level->pixels.data()),
+               level->pixels.size() * sizeof(uint32_t));
+      }
+
+      if (!file.good())
+         throw GL::Exception(join("Failed to write file: ", MipCachePath(source)));
+   }
+
+   bool LoadMipCache(const std::string &source, MipFilter filter, bool srgb,
+         std::vector<Image> &levels)
+   {
+      uint64_t source_size;
+      int64_t source_mtime;
+      if (!FileStamp(source, source_size, source_mtime))
+         return false;
+
+      std::ifstream file(MipCachePath(source), std::ios::in | std::ios::binary);
+      if (!file.is_open())
+         return false;
+
+      MipCacheHeader header;
+      if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+            std::string(header.magic, 4) != "MIP1" ||
+            header.source_size != source_size || header.source_mtime != source_mtime ||
+            header.filter != static_cast<uint32_t>(filter) ||
+            header.srgb != static_cast<uint32_t>(srgb) || !header.levels || header.levels > 32)
+         return false;
+
+      std::vector<Image> cached(header.levels);
+      for (auto level = std::begin(cached); level != std::end(cached); ++level)
+      {
+         uint32_t size[2];
+         if (!file.read(reinterpret_cast<char*>(size), sizeof(size)) ||
+               !size[0] || !size[1] || size[0] > 0xffff || size[1] > 0xffff)
+            return false;
+
+         level->width = size[0];
+         level->height = size[1];
+         level->pixels.resize(size_t(size[0]) * size[1]);
+         if (!file.read(reinterpret_cast<char*>(level->pixels.data()),
+                  level->pixels.size() * sizeof(uint32_t)))
+            return false;
+      }
+
+      levels.swap(cached);
+      return true;
+   }
+
+   std::vector<Image> LoadTGAMipmaps(const std::string &path, MipFilter filter, bool srgb)
+   {
+      std::vector<Image> levels;
+      if (!LoadMipCache(path, filter, srgb, levels))
+         levels = GenerateMipmaps(LoadTGA(path), filter, srgb);
+      return levels;
+   }
+
+   namespace
+   {
+      unsigned next_pow2(unsigned v)
+      {
+         unsigned p = 1;
+         while (p < v)
+            p <<= 1;
+         return p;
+      }
+   }
+
+   std::vector<AtlasTile> PackAtlas(const std::vector<const Image*> &images,
+         unsigned padding, unsigned max_size, Image &atlas)
+   {
+      struct Cell
+      {
+         unsigned index;
+         unsigned width, height;
+      };
+
+      std::vector<AtlasTile> tiles(images.size());
+      std::vector<Cell> cells;
+      for (unsigned i = 0; i < images.size(); i++)
+      {
+         tiles[i].x = tiles[i].y = tiles[i].width = tiles[i].height = 0;
+         Cell cell = { i, next_pow2(images[i]->width + 2 * padding),
+            next_pow2(images[i]->height + 2 * padding) };
+         if (cell.width <= max_size && cell.height <= max_size)
+            cells.push_back(cell);
+      }
+
+      // Shelves hold cells of one height. Heights and, within a shelf,
+      // widths only shrink, which keeps every cell aligned to its size.
+      std::sort(std::begin(cells), std::end(cells), [](const Cell &a, const Cell &b) {
+            return a.height != b.height ? a.height > b.height : a.width > b.width;
+         });
+
+      std::vector<std::pair<unsigned, unsigned>> origins(images.size());
+      unsigned x = 0, y = 0, shelf = 0, used_width = 0;
+      for (auto cell = std::begin(cells); cell != std::end(cells); ++cell)
+      {
+         if (cell->height != shelf || x + cell->width > max_size)
+         {
+            if (y + shelf + cell->height > max_size)
+               continue;
+            y += shelf;
+            x = 0;
+            shelf = cell->height;
+         }
+
+         origins[cell->index] = std::make_pair(x, y);
+         tiles[cell->index].x = x + padding;
+         tiles[cell->index].y = y + padding;
+         tiles[cell->index].width = images[cell->index]->width;
+         tiles[cell->index].height = images[cell->index]->height;
+         x += cell->width;
+         used_width = std::max(used_width, x);
+      }
+
+      atlas.width = next_pow2(std::max(1u, used_width));
+      atlas.height = next_pow2(std::max(1u, y + shelf));
+      atlas.pixels.assign(size_t(atlas.width) * atlas.height, 0);
+
+      for (auto cell = std::begin(cells); cell != std::end(cells); ++cell)
+      {
+         const Image &image = *images[cell->index];
+         if (!tiles[cell->index].width)
+            continue;
+
+         unsigned cx = origins[cell->index].first;
+         unsigned cy = origins[cell->index].second;
+         for (unsigned j = 0; j < cell->height; j++)
+         {
+            unsigned sy = std::min(unsigned(std::max(int(j) - int(padding), 0)), image.height - 1);
+            const uint32_t *src = &image.pixels[size_t(sy) * image.width];
+            uint32_t *dst = &atlas.pixels[size_t(cy + j) * atlas.width + cx];
+            for (unsigned i = 0; i < cell->width; i++)
+               dst[i] = src[std::min(unsigned(std::max(int(i) - int(padding), 0)), image.width - 1)];
+         }
+      }
+
+      return tiles;
+   }
+}
@@ -0,0 +1,139 @@
+#ifndef IMAGE_HPP__
+#define IMAGE_HPP__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace GLU
+{
+   // Pixels are packed as (b << 24) | (g << 16) | (r << 8) | a,
+   // i.e. GL_BGRA with GL_UNSIGNED_INT_8_8_8_8.
+   struct Image
+   {
+      unsigned width;
+      unsigned height;
+      std::vector<uint32_t> pixels;
+   };
+
+   enum PixelKernel
+   {
+      PixelScalar,
+      PixelSSSE3,
+      PixelAVX2
+   };
+
+   // The widest kernel the CPU supports, detected on first use.
+   PixelKernel BestPixelKernel();
+
+   // Converts count B, G, R (bits = 24) or B, G, R, A (bits = 32)
+   // pixels to the Image packing. 24-bit pixels get opaque alpha.
+   void ConvertBGR(const uint8_t *in, unsigned bits, size_t count,
+         uint32_t *out, PixelKernel kernel = BestPixelKernel());
+
+   struct TGAHeader
+   {
+      unsigned width;
+      unsigned height;
+      unsigned bits;
+      bool gray;
+      bool compressed;
+      // Row 0 of the file is the top row, GL expects the bottom one first.
+      bool top_origin;
+      // Rows are stored right to left.
+      bool right_origin;
+      // Start of the pixel data in the file.
+      size_t data_offset;
+   };
+
+   // Validates the header against file_size, the size of the whole file.
+   // Supports true color (types 2 and 10, 24 and 32-bit) and grayscale
+   // (types 3 and 11, 8-bit or 16-bit with alpha), raw or run-length encoded.
+   TGAHeader ParseTGAHeader(const uint8_t *data, size_t size, size_t file_size);
+
+   // Decodes Targa pixel data straight into out (width * height pixels,
+   // bottom row first), in as many pieces as it arrives in. Packets and
+   // pixels may be split anywhere between calls to feed().
+   class TGADecoder
+   {
+      public:
+         TGADecoder(const TGAHeader &header, uint32_t *out);
+
+         // Returns the number of bytes used, which is less than size only
+         // once the image is complete.
+         size_t feed(const uint8_t *data, size_t size);
+         bool done() const;
+
+      private:
+         TGAHeader header;
+         uint32_t *out;
+         unsigned bytes;
+         size_t remaining;
+         unsigned x, y;
+
+         size_t packet_left;
+         bool packet_rle;
+         uint8_t partial[4];
+         unsigned partial_size;
+
+         void convert(const uint8_t *in, size_t count, uint32_t *dst) const;
+         void write(const uint8_t *in, size_t count);
+         void fill(uint32_t value, size_t count);
+         uint32_t *row() const;
+         uint32_t *row_span(size_t &count) const;
+         void advance(size_t count);
+   };
+
+   // Throws GL::Exception on unsupported or truncated data.
+   Image DecodeTGA(const uint8_t *data, size_t size);
+   Image LoadTGA(const std::string &path);
+
+   enum MipFilter
+   {
+      // 2x2 average.
+      MipBox,
+      // 8x8 Kaiser windowed sinc, sharper than the box without ringing much.
+      MipKaiser
+   };
+
+   // The full mip chain down to 1x1, base first. With srgb the color
+   // channels are averaged in linear light, alpha always is linear.
+   // Rows of each level are split across threads unless threaded is false.
+   std::vector<Image> GenerateMipmaps(Image base, MipFilter filter = MipBox,
+         bool srgb = true, bool threaded = true);
+
+   // Size and modification time of path, which on-disk caches are keyed by.
+   bool FileStamp(const std::string &path, uint64_t &size, int64_t &mtime);
+
+   // Precomputed chains are stored next to the source as <source>.mips and
+   // are only used while the source's size and modification time match.
+   std::string MipCachePath(const std::string &source);
+   void SaveMipCache(const std::string &source, const std::vector<Image> &levels,
+         MipFilter filter, bool srgb);
+   // Returns false if there is no cache or it is out of date.
+   bool LoadMipCache(const std::string &source, MipFilter filter, bool srgb,
+         std::vector<Image> &levels);
+
+   // The cached chain if there is one, otherwise LoadTGA() and GenerateMipmaps().
+   std::vector<Image> LoadTGAMipmaps(const std::string &path,
+         MipFilter filter = MipBox, bool srgb = true);
+
+   // Where an image's pixels ended up in an atlas. Zero size if it didn't fit.
+   struct AtlasTile
+   {
+      unsigned x, y;
+      unsigned width, height;
+   };
+
+   // Packs as many images as fit into one atlas of at most max_size a side,
+   // largest first. Every image gets a power of two cell aligned to its size,
+   // filled with the image at (padding, padding) and its edges repeated around
+   // it, so box filtered mips never mix two images. Bilinear filtering stays
+   // within an image's cell down to mip level log2(padding).
+   std::vector<AtlasTile> PackAtlas(const std::vector<const Image*> &images,
+         unsigned padding, unsigned max_size, Image &atlas);
+}
+
+#endif
+
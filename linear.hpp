@@ -5,6 +5,22 @@
 #include <utility>
 #include <array>
 #include <type_traits>
+#include <cmath>
+
+// SSE is part of every x86-64 target, 32-bit builds must enable it.
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define GL_LINEAR_SSE
+#include <xmmintrin.h>
+#if defined(__FMA__)
+#include <immintrin.h>
+#endif
+#endif
+
+#ifdef _MSC_VER
+#define GL_ALIGN(n) __declspec(align(n))
+#else
+#define GL_ALIGN(n) __attribute__((aligned(n)))
+#endif
 
 namespace GL
 {
@@ -13,66 +29,132 @@ namespace GL
    template <class T, unsigned N>
    class Vector;
    template <unsigned M, unsigned N, class T>
-   Vector<T, N> vec_conv(const Vector<T, M> &in);
+   constexpr Vector<T, N> vec_conv(const Vector<T, M> &in);
+   template <class T>
+   class Matrix;
+
+   // Tag types selecting the element-wise constructors of Vector and Matrix.
+   namespace Detail
+   {
+      // Index packs stand in for loops, so results are built directly in
+      // the constructor instead of filling a zeroed temporary. This keeps
+      // the arithmetic constexpr in C++11 and unrolled at any -O level.
+      template <unsigned... I>
+      struct Indices {};
+
+      template <unsigned N, unsigned... I>
+      struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+
+      template <unsigned... I>
+      struct MakeIndices<0, I...>
+      {
+         typedef Indices<I...> type;
+      };
+
+      struct Add
+      {
+         template <class T>
+         constexpr T operator()(T a, T b) const
+         {
+            return a + b;
+         }
+      };
+
+      struct Sub
+      {
+         template <class T>
+         constexpr T operator()(T a, T b) const
+         {
+            return a - b;
+         }
+      };
+
+      struct Mul
+      {
+         template <class T>
+         constexpr T operator()(T a, T b) const
+         {
+            return a * b;
+         }
+      };
+
+      struct Product {};
+      // Leaves a Matrix uninitialized for code which overwrites all of it.
+      struct Uninitialized {};
+   }
 
+   // Plain arithmetic for any T, constexpr for constant operands.
+   // Matrix<float> * Vector<float, 4> uses SSE instead when available.
+   namespace Generic
+   {
+      template <class T>
+      constexpr Matrix<T> Multiply(const Matrix<T> &a, const Matrix<T> &b);
+      template <class T>
+      constexpr Vector<T, 4> Multiply(const Matrix<T> &mat, const Vector<T, 4> &vec);
+   }
+
+   // Trivially copyable, so copies are plain memory moves and
+   // arrays of vectors can be memcpy'd.
    template <class T, unsigned N = 4>
    class Vector
    {
+      typedef typename Detail::MakeIndices<N>::type Indices;
+
       public:
-         Vector()
-         {
-            std::fill(vec.begin(), vec.end(), static_cast<T>(0));
-         }
+         constexpr Vector() : vec() {}
 
          Vector(const T* list)
          {
-            std::copy(list, list + N, vec.begin());
+            std::copy(list, list + N, vec);
          }
 
          template <class U>
-         Vector(typename std::enable_if<N == 1, U>::type t1)
-         {
-            vec[0] = static_cast<T>(t1);
-         }
+         constexpr Vector(typename std::enable_if<N == 1, U>::type t1)
+            : vec{static_cast<T>(t1)} {}
 
          template <class U>
-         Vector(typename std::enable_if<N == 2, U>::type t1,
+         constexpr Vector(typename std::enable_if<N == 2, U>::type t1,
             U t2 = static_cast<U>(0))
-         {
-            vec[0] = static_cast<T>(t1);
-            vec[1] = static_cast<T>(t2);
-         }
+            : vec{static_cast<T>(t1), static_cast<T>(t2)} {}
 
          template <class U>
-         Vector(typename std::enable_if<N == 3, U>::type t1,
+         constexpr Vector(typename std::enable_if<N == 3, U>::type t1,
                U t2 = static_cast<U>(0),
                U t3 = static_cast<U>(0))
-         {
-            vec[0] = static_cast<T>(t1);
-            vec[1] = static_cast<T>(t2);
-            vec[2] = static_cast<T>(t3);
-         }
+            : vec{static_cast<T>(t1), static_cast<T>(t2), static_cast<T>(t3)} {}
 
          template <class U>
-         Vector(typename std::enable_if<N == 4, U>::type t1,
+         constexpr Vector(typename std::enable_if<N == 4, U>::type t1,
                U t2 = static_cast<U>(0),
                U t3 = static_cast<U>(0),
                U t4 = static_cast<U>(0))
-         {
-            vec[0] = static_cast<T>(t1);
-            vec[1] = static_cast<T>(t2);
-            vec[2] = static_cast<T>(t3);
-            vec[3] = static_cast<T>(t4);
-         }
+            : vec{static_cast<T>(t1), static_cast<T>(t2),
+               static_cast<T>(t3), static_cast<T>(t4)} {}
+
+         // Truncates or pads with zeros.
+         template <unsigned M>
+         constexpr Vector(const Vector<T, M> &in)
+            : Vector(in, Indices()) {}
+
+         // Element-wise op(a(i), b(i)) and op(a, b(i)).
+         template <class Op, unsigned... I>
+         constexpr Vector(Op op, const Vector<T, N> &a, const Vector<T, N> &b,
+               Detail::Indices<I...>)
+            : vec{op(a.vec[I], b.vec[I])...} {}
+
+         template <class Op, unsigned... I>
+         constexpr Vector(Op op, T a, const Vector<T, N> &b,
+               Detail::Indices<I...>)
+            : vec{op(a, b.vec[I])...} {}
 
          T* operator()()
          {
             return &vec[0];
          }
 
-         const T* operator()() const
+         constexpr const T* operator()() const
          {
-            return &vec[0];
+            return vec;
          }
 
          T& operator()(unsigned index)
@@ -80,42 +162,19 @@ namespace GL
             return vec[index];
          }
 
-         const T& operator()(unsigned index) const
+         constexpr const T& operator()(unsigned index) const
          {
             return vec[index];
          }
 
-         Vector<T, N>& operator=(const Vector<T, N> &in)
-         {
-            vec = in.vec;
-            return *this;
-         }
-
-         Vector(const Vector<T, N> &in)
-         {
-            *this = in;
-         }
-
-         template <unsigned M>
-         Vector(const Vector<T, M> &in)
-         {
-            *this = vec_conv<M, N>(in);
-         }
-
-         Vector<T, N> operator+(const Vector<T, N> &in) const
+         constexpr Vector<T, N> operator+(const Vector<T, N> &in) const
          {
-            Vector<T, N> res;
-            for (unsigned i = 0; i < N; i++)
-               res(i) = operator()(i) + in(i);
-            return res;
+            return Vector<T, N>(Detail::Add(), *this, in, Indices());
          }
 
-         Vector<T, N> operator-(const Vector<T, N> &in) const
+         constexpr Vector<T, N> operator-(const Vector<T, N> &in) const
          {
-            Vector<T, N> res;
-            for (unsigned i = 0; i < N; i++)
-               res(i) = operator()(i) - in(i);
-            return res;
+            return Vector<T, N>(Detail::Sub(), *this, in, Indices());
          }
 
          Vector<T, N>& operator+=(const Vector<T, N> &in)
@@ -133,49 +192,66 @@ namespace GL
          }
 
 
-         Vector<T, N> operator*(const Vector<T, N> &in) const
+         constexpr Vector<T, N> operator*(const Vector<T, N> &in) const
          {
-            Vector<T, N> res;
-            for (unsigned i = 0; i < N; i++)
-               res(i) = operator()(i) * in(i);
-            return res;
+            return Vector<T, N>(Detail::Mul(), *this, in, Indices());
          }
 
       private:
-         std::array<T, N> vec;
+         T vec[N];
+
+         template <unsigned M, unsigned... I>
+         constexpr Vector(const Vector<T, M> &in, Detail::Indices<I...>)
+            : vec{(I < M ? in(I < M ? I : 0) : static_cast<T>(0))...} {}
    };
 
+   // Trivially copyable like Vector.
    template <class T>
    class Matrix
    {
+      typedef typename Detail::MakeIndices<16>::type Indices;
+
       public:
-         Matrix()
-         {
-            std::fill(matrix, matrix + 16, static_cast<T>(0));
-         }
+         constexpr Matrix() : matrix() {}
+
+         explicit Matrix(Detail::Uninitialized) {}
 
          Matrix(const float *matrix_, unsigned size = 16)
          {
             std::copy(matrix_, matrix_ + std::min(16u, size), matrix);
          }
 
-         Matrix<T>& operator=(const Matrix<T> &mat)
-         {
-            std::copy(mat.matrix, mat.matrix + 16, matrix);
-            return *this;
-         }
+         // From rows, mainly for constant matrices.
+         constexpr Matrix(const Vector<T, 4> &r0, const Vector<T, 4> &r1,
+               const Vector<T, 4> &r2, const Vector<T, 4> &r3)
+            : matrix{r0(0), r0(1), r0(2), r0(3),
+               r1(0), r1(1), r1(2), r1(3),
+               r2(0), r2(1), r2(2), r2(3),
+               r3(0), r3(1), r3(2), r3(3)} {}
 
-         Matrix(const Matrix<T> &in)
-         {
-            *this = in;
-         }
+         // Element-wise op(a(r, c), b(r, c)) and op(a, b(r, c)).
+         template <class Op, unsigned... I>
+         constexpr Matrix(Op op, const Matrix<T> &a, const Matrix<T> &b,
+               Detail::Indices<I...>)
+            : matrix{op(a.matrix[I], b.matrix[I])...} {}
+
+         template <class Op, unsigned... I>
+         constexpr Matrix(Op op, T a, const Matrix<T> &b,
+               Detail::Indices<I...>)
+            : matrix{op(a, b.matrix[I])...} {}
+
+         // a * b, one row-column dot product per element.
+         template <unsigned... I>
+         constexpr Matrix(Detail::Product, const Matrix<T> &a, const Matrix<T> &b,
+               Detail::Indices<I...>)
+            : matrix{dot(a, b, I / 4, I % 4)...} {}
 
          T& operator()(unsigned r, unsigned c)
          {
             return matrix[r * 4 + c];
          }
 
-         const T& operator()(unsigned r, unsigned c) const
+         constexpr const T& operator()(unsigned r, unsigned c) const
          {
             return matrix[r * 4 + c];
          }
@@ -185,66 +261,38 @@ namespace GL
             return matrix;
          }
 
-         const T* operator()() const
+         constexpr const T* operator()() const
          {
             return matrix;
          }
 
-         Matrix<T> operator+(const Matrix<T> &in) const
+         constexpr Matrix<T> operator+(const Matrix<T> &in) const
          {
-            Matrix<T> ret;
-            for (unsigned i = 0; i < 4; i++)
-               for (unsigned j = 0; j < 4; j++)
-                  ret(i, j) = matrix(i, j) + in(i, j);
-
-            return ret;
+            return Matrix<T>(Detail::Add(), *this, in, Indices());
          }
 
-         Matrix<T> operator-(const Matrix<T> &in) const
+         constexpr Matrix<T> operator-(const Matrix<T> &in) const
          {
-            Matrix<T> ret;
-            for (unsigned i = 0; i < 4; i++)
-               for (unsigned j = 0; j < 4; j++)
-                  ret(i, j) = matrix(i, j) - in(i, j);
-
-            return ret;
+            return Matrix<T>(Detail::Sub(), *this, in, Indices());
          }
 
          Matrix<T> operator*(const Matrix<T> &in) const
          {
-            Matrix<T> out;
-            const Matrix<T> &a = *this;
-            const Matrix<T> &b = in;
-            for (unsigned i = 0; i < 4; i++)
-            {
-               for (unsigned j = 0; j < 4; j++)
-               {
-                  T dot = 0;
-                  for (unsigned k = 0; k < 4; k++)
-                  {
-                     dot += a(i, k) * b(k, j);
-                  }
-                  out(i, j) = dot;
-               }
-            }
-
-            return out;
+            return Generic::Multiply(*this, in);
          }
 
          Matrix<T>& operator+=(const Matrix<T> &in)
          {
-            for (unsigned i = 0; i < 4; i++)
-               for (unsigned j = 0; j < 4; j++)
-                  operator()(i, j) += in(i, j);
+            for (unsigned i = 0; i < 16; i++)
+               matrix[i] += in.matrix[i];
 
             return *this;
          }
 
          Matrix<T>& operator-=(const Matrix<T> &in)
          {
-            for (unsigned i = 0; i < 4; i++)
-               for (unsigned j = 0; j < 4; j++)
-                  operator()(i, j) -= in(i, j);
+            for (unsigned i = 0; i < 16; i++)
+               matrix[i] -= in.matrix[i];
 
             return *this;
          }
@@ -256,9 +304,117 @@ namespace GL
          }
 
       private:
-         T matrix[16];
+         // Row-major. Aligned for SSE loads of whole rows.
+         GL_ALIGN(16) T matrix[16];
+
+         static constexpr T dot(const Matrix<T> &a, const Matrix<T> &b,
+               unsigned r, unsigned c)
+         {
+            return a(r, 0) * b(0, c) + a(r, 1) * b(1, c) +
+               a(r, 2) * b(2, c) + a(r, 3) * b(3, c);
+         }
    };
 
+   namespace Generic
+   {
+      template <class T>
+      constexpr Matrix<T> Multiply(const Matrix<T> &a, const Matrix<T> &b)
+      {
+         return Matrix<T>(Detail::Product(), a, b,
+               typename Detail::MakeIndices<16>::type());
+      }
+
+      template <class T>
+      constexpr T RowDot(const Matrix<T> &mat, const Vector<T, 4> &vec, unsigned r)
+      {
+         return mat(r, 0) * vec(0) + mat(r, 1) * vec(1) +
+            mat(r, 2) * vec(2) + mat(r, 3) * vec(3);
+      }
+
+      template <class T>
+      constexpr Vector<T, 4> Multiply(const Matrix<T> &mat, const Vector<T, 4> &vec)
+      {
+         return Vector<T, 4>(RowDot(mat, vec, 0), RowDot(mat, vec, 1),
+               RowDot(mat, vec, 2), RowDot(mat, vec, 3));
+      }
+   }
+
+#ifdef GL_LINEAR_SSE
+   namespace SSE
+   {
+      // a * b + c, fused when the target has FMA.
+      inline __m128 madd(__m128 a, __m128 b, __m128 c)
+      {
+#ifdef __FMA__
+         return _mm_fmadd_ps(a, b, c);
+#else
+         return _mm_add_ps(_mm_mul_ps(a, b), c);
+#endif
+      }
+
+      // Row i of a * b is the sum of b's rows weighted by row i of a.
+      // Loads are unaligned: heap objects holding a Matrix are not
+      // guaranteed 16-byte alignment on 32-bit targets before C++17.
+      // Only pays off writing straight into an array, as TransformBatch()
+      // does. Returning a Matrix by value, the generic loop is faster.
+      inline void MultiplyMatrix(const float *a, const float *b, float *out)
+      {
+         __m128 b0 = _mm_loadu_ps(b + 0);
+         __m128 b1 = _mm_loadu_ps(b + 4);
+         __m128 b2 = _mm_loadu_ps(b + 8);
+         __m128 b3 = _mm_loadu_ps(b + 12);
+
+         for (unsigned i = 0; i < 4; i++)
+         {
+            const float *row = a + 4 * i;
+            __m128 res = _mm_mul_ps(_mm_set1_ps(row[0]), b0);
+            res = madd(_mm_set1_ps(row[1]), b1, res);
+            res = madd(_mm_set1_ps(row[2]), b2, res);
+            res = madd(_mm_set1_ps(row[3]), b3, res);
+            _mm_storeu_ps(out + 4 * i, res);
+         }
+      }
+
+      // Four row dot products, summed horizontally through a transpose.
+      inline void MultiplyVector(const float *mat, const float *vec, float *out)
+      {
+         __m128 v = _mm_loadu_ps(vec);
+         __m128 r0 = _mm_mul_ps(_mm_loadu_ps(mat + 0), v);
+         __m128 r1 = _mm_mul_ps(_mm_loadu_ps(mat + 4), v);
+         __m128 r2 = _mm_mul_ps(_mm_loadu_ps(mat + 8), v);
+         __m128 r3 = _mm_mul_ps(_mm_loadu_ps(mat + 12), v);
+         _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+         _mm_storeu_ps(out, _mm_add_ps(_mm_add_ps(r0, r1), _mm_add_ps(r2, r3)));
+      }
+   }
+
+   namespace SSE
+   {
+      inline __m128 cross(__m128 a, __m128 b)
+      {
+         __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+         __m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+         __m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+         return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+      }
+
+      // Rows of the cofactor matrix of the upper 3x3 of a row-major 4x4,
+      // i.e. the inverse transpose times the determinant. out holds three
+      // rows of four floats with a zero fourth column.
+      inline float Cofactor3(const float *mat, float *out)
+      {
+         __m128 r0 = _mm_loadu_ps(mat + 0);
+         __m128 r1 = _mm_loadu_ps(mat + 4);
+         __m128 r2 = _mm_loadu_ps(mat + 8);
+         __m128 c0 = cross(r1, r2);
+         _mm_storeu_ps(out + 0, c0);
+         _mm_storeu_ps(out + 4, cross(r2, r0));
+         _mm_storeu_ps(out + 8, cross(r0, r1));
+         return mat[0] * out[0] + mat[1] * out[1] + mat[2] * out[2];
+      }
+   }
+#endif
+
    typedef Matrix<GLfloat> GLMatrix;
 
    typedef Vector<GLfloat, 2> vec2;
@@ -269,71 +425,215 @@ namespace GL
    typedef Vector<GLint, 4> ivec4;
 
    template <class T>
-   Vector<T, 4> operator*(const Matrix<T>& mat, const Vector<T, 4> &vec)
+   constexpr Vector<T, 4> operator*(const Matrix<T>& mat, const Vector<T, 4> &vec)
    {
-      Vector<T, 4> out;
-      for (unsigned i = 0; i < 4; i++)
-      {
-         T sum = 0;
-         for (unsigned j = 0; j < 4; j++)
-         {
-            sum += mat(i, j) * vec(j);
-         }
-         out(i) = sum;
-      }
+      return Generic::Multiply(mat, vec);
+   }
+
+#ifdef GL_LINEAR_SSE
+   inline Vector<float, 4> operator*(const Matrix<float> &mat, const Vector<float, 4> &vec)
+   {
+      Vector<float, 4> out;
+      SSE::MultiplyVector(mat(), vec(), out());
       return out;
    }
+#endif
 
    template <class T, unsigned N>
-   Vector<T, N> operator*(T scale, const Vector<T, N> &in)
+   constexpr Vector<T, N> operator*(T scale, const Vector<T, N> &in)
    {
-      Vector<T, N> out;
-      for (unsigned i = 0; i < N; i++)
-      {
-         out(i) = scale * in(i);
-      }
-      return out;
+      return Vector<T, N>(Detail::Mul(), scale, in,
+            typename Detail::MakeIndices<N>::type());
    }
 
+   // Multiplying by -1 rather than subtracting from 0 keeps signed zeros.
    template <class T, unsigned N>
-   Vector<T, N> operator-(const Vector<T, N> &in)
+   constexpr Vector<T, N> operator-(const Vector<T, N> &in)
    {
-      Vector<T, N> ret;
-      for (unsigned i = 0; i < N; i++)
-         ret(i) = -in(i);
-      return ret;
+      return Vector<T, N>(Detail::Mul(), static_cast<T>(-1), in,
+            typename Detail::MakeIndices<N>::type());
    }
 
    template <class T>
-   Matrix<T> operator-(const Matrix<T> &in)
+   constexpr Matrix<T> operator-(const Matrix<T> &in)
    {
-      Matrix<T> out;
-      for (unsigned i = 0; i < 4; i++)
-         for (unsigned j = 0; j < 4; j++)
-            out(i, j) = -in(i, j);
-      return out;
+      return Matrix<T>(Detail::Mul(), static_cast<T>(-1), in,
+            typename Detail::MakeIndices<16>::type());
    }
 
-   template <class T, unsigned N>
-   Matrix<T> operator*(T scale, const Matrix<T> &in)
+   template <class T>
+   constexpr Matrix<T> operator*(T scale, const Matrix<T> &in)
    {
-      Matrix<T> out;
-      for (unsigned i = 0; i < 4; i++)
-         for (unsigned j = 0; j < 4; j++)
-            out(i, j) = scale * in(i, j);
-      return out;
+      return Matrix<T>(Detail::Mul(), scale, in,
+            typename Detail::MakeIndices<16>::type());
    }
 
    template <unsigned From, unsigned To, class T>
-   Vector<T, To> vec_conv(const Vector<T, From> &in)
+   constexpr Vector<T, To> vec_conv(const Vector<T, From> &in)
    {
-      Vector<T, To> out;
-      unsigned indices = std::min(To, From);
-      for (unsigned i = 0; i < indices; i++)
-         out(i) = in(i);
-
-      return out;
+      return Vector<T, To>(in);
    }
+
+   // Rotation as a unit quaternion w + xi + yj + zk. Composing two costs
+   // 16 multiplies against 64 for a matrix product. Angles follow the right
+   // hand rule like Rotate(RotX, ...), which Rotate(RotY, ...) does not:
+   // Rotate(RotY, deg) equals AxisAngle(vec3(0, 1, 0), -deg).
+   template <class T>
+   class Quaternion
+   {
+      public:
+         constexpr Quaternion() : w(1), x(0), y(0), z(0) {}
+
+         constexpr Quaternion(T w_, T x_, T y_, T z_)
+            : w(w_), x(x_), y(y_), z(z_) {}
+
+         // axis must have unit length.
+         static Quaternion<T> AxisAngle(const Vector<T, 3> &axis, T degrees)
+         {
+            T half = degrees * static_cast<T>(3.14159265358979323846 / 360.0);
+            T sine = std::sin(half);
+            return Quaternion<T>(std::cos(half),
+                  sine * axis(0), sine * axis(1), sine * axis(2));
+         }
+
+         // Shortest path interpolation, constant angular speed in t.
+         static Quaternion<T> Slerp(const Quaternion<T> &a, Quaternion<T> b, T t)
+         {
+            T cosine = a.dot(b);
+            if (cosine < 0)
+            {
+               b = Quaternion<T>(-b.w, -b.x, -b.y, -b.z);
+               cosine = -cosine;
+            }
+
+            // Nearly parallel, sin(angle) would lose all precision.
+            T wa = 1 - t, wb = t;
+            if (cosine < static_cast<T>(0.9995))
+            {
+               T angle = std::acos(cosine);
+               T inv_sine = 1 / std::sin(angle);
+               wa = std::sin(wa * angle) * inv_sine;
+               wb = std::sin(wb * angle) * inv_sine;
+            }
+
+            return Quaternion<T>(wa * a.w + wb * b.w, wa * a.x + wb * b.x,
+                  wa * a.y + wb * b.y, wa * a.z + wb * b.z).normalized();
+         }
+
+         // Rotates by in first, then by this.
+         constexpr Quaternion<T> operator*(const Quaternion<T> &in) const
+         {
+            return Quaternion<T>(
+                  w * in.w - x * in.x - y * in.y - z * in.z,
+                  w * in.x + x * in.w + y * in.z - z * in.y,
+                  w * in.y - x * in.z + y * in.w + z * in.x,
+                  w * in.z + x * in.y - y * in.x + z * in.w);
+         }
+
+         // The inverse rotation for unit quaternions.
+         constexpr Quaternion<T> conjugate() const
+         {
+            return Quaternion<T>(w, -x, -y, -z);
+         }
+
+         constexpr T dot(const Quaternion<T> &in) const
+         {
+            return w * in.w + x * in.x + y * in.y + z * in.z;
+         }
+
+         // Rounding drifts away from unit length over many compositions.
+         Quaternion<T> normalized() const
+         {
+            T factor = 1 / std::sqrt(dot(*this));
+            return Quaternion<T>(w * factor, x * factor, y * factor, z * factor);
+         }
+
+         // v + w * t + cross(q, t) with t = 2 * cross(q, v).
+         Vector<T, 3> rotate(const Vector<T, 3> &v) const
+         {
+            T tx = 2 * (y * v(2) - z * v(1));
+            T ty = 2 * (z * v(0) - x * v(2));
+            T tz = 2 * (x * v(1) - y * v(0));
+            return Vector<T, 3>(v(0) + w * tx + y * tz - z * ty,
+                  v(1) + w * ty + z * tx - x * tz,
+                  v(2) + w * tz + x * ty - y * tx);
+         }
+
+         constexpr Matrix<T> matrix() const
+         {
+            return Matrix<T>(
+                  Vector<T, 4>(1 - 2 * (y * y + z * z), 2 * (x * y - w * z), 2 * (x * z + w * y), T(0)),
+                  Vector<T, 4>(2 * (x * y + w * z), 1 - 2 * (x * x + z * z), 2 * (y * z - w * x), T(0)),
+                  Vector<T, 4>(2 * (x * z - w * y), 2 * (y * z + w * x), 1 - 2 * (x * x + y * y), T(0)),
+                  Vector<T, 4>(T(0), T(0), T(0), T(1)));
+         }
+
+         T w, x, y, z;
+   };
+
+   // Uniform scale, then rotation, then translation. Stays closed under
+   // composition and inversion, unlike a non-uniform scale.
+   template <class T>
+   class Transform
+   {
+      public:
+         Transform() : scale(1) {}
+
+         Transform(const Quaternion<T> &rotation_,
+               const Vector<T, 3> &translation_ = Vector<T, 3>(),
+               T scale_ = 1)
+            : rotation(rotation_), translation(translation_), scale(scale_) {}
+
+         // Rotation and translation interpolated separately, so an object
+         // turning while moving does not swing around the origin.
+         static Transform<T> Interpolate(const Transform<T> &a,
+               const Transform<T> &b, T t)
+         {
+            return Transform<T>(Quaternion<T>::Slerp(a.rotation, b.rotation, t),
+                  a.translation + t * (b.translation - a.translation),
+                  a.scale + t * (b.scale - a.scale));
+         }
+
+         // Applies in first, then this.
+         Transform<T> operator*(const Transform<T> &in) const
+         {
+            return Transform<T>(rotation * in.rotation,
+                  translation + scale * rotation.rotate(in.translation),
+                  scale * in.scale);
+         }
+
+         Transform<T> inverse() const
+         {
+            T inv_scale = 1 / scale;
+            auto inv_rotation = rotation.conjugate();
+            return Transform<T>(inv_rotation,
+                  -(inv_scale * inv_rotation.rotate(translation)), inv_scale);
+         }
+
+         Vector<T, 3> apply(const Vector<T, 3> &v) const
+         {
+            return translation + scale * rotation.rotate(v);
+         }
+
+         Matrix<T> matrix() const
+         {
+            Matrix<T> mat = rotation.matrix();
+            for (unsigned r = 0; r < 3; r++)
+            {
+               for (unsigned c = 0; c < 3; c++)
+                  mat(r, c) *= scale;
+               mat(r, 3) = translation(r);
+            }
+            return mat;
+         }
+
+         Quaternion<T> rotation;
+         Vector<T, 3> translation;
+         T scale;
+   };
+
+   typedef Quaternion<GLfloat> quat;
+   typedef Transform<GLfloat> GLTransform;
 }
 
 
@@ -3,24 +3,77 @@
 #include <vector>
 #include <iostream>
 #include <assert.h>
+#include <cstring>
 
 namespace GL
 {
+   namespace
+   {
+      const Program::UniformKey projection_matrix_key = Program::uniform_key("projection_matrix");
+      const Program::UniformKey light_matrix_key = Program::uniform_key("light_matrix");
+      const Program::UniformKey trans_matrix_key = Program::uniform_key("trans_matrix");
+      const Program::UniformKey normal_matrix_key = Program::uniform_key("normal_matrix");
+   }
+
+   Mesh::Mesh() :
+      num_indices(0), index_type(GL_UNSIGNED_INT),
+      model_bounds(GLU::ComputeBounds(std::vector<Geo::Coord>())),
+      vbo(GL_ARRAY_BUFFER), ibo(GL_ELEMENT_ARRAY_BUFFER),
+      cached_generation(0), auto_normal(false)
+   {}
+
    Mesh::Mesh(const std::string &obj) : 
-      num_vertices(0), vbo(GL_ARRAY_BUFFER)
+      num_indices(0), index_type(GL_UNSIGNED_INT),
+      model_bounds(GLU::ComputeBounds(std::vector<Geo::Coord>())),
+      vbo(GL_ARRAY_BUFFER), ibo(GL_ELEMENT_ARRAY_BUFFER),
+      cached_generation(0), auto_normal(false)
    {
       load_object(obj);
    }
 
    Mesh::Mesh(const std::vector<Geo::Triangle> &triangles) :
-      num_vertices(0), vbo(GL_ARRAY_BUFFER)
+      num_indices(0), index_type(GL_UNSIGNED_INT),
+      model_bounds(GLU::ComputeBounds(std::vector<Geo::Coord>())),
+      vbo(GL_ARRAY_BUFFER), ibo(GL_ELEMENT_ARRAY_BUFFER),
+      cached_generation(0), auto_normal(false)
    {
-      load_object(triangles);
+      load_object(GLU::IndexTriangles(triangles));
+   }
+
+   Mesh::Mesh(const Geo::IndexedMesh &mesh) :
+      num_indices(0), index_type(GL_UNSIGNED_INT),
+      model_bounds(GLU::ComputeBounds(std::vector<Geo::Coord>())),
+      vbo(GL_ARRAY_BUFFER), ibo(GL_ELEMENT_ARRAY_BUFFER),
+      cached_generation(0), auto_normal(false)
+   {
+      load_object(mesh);
    }
 
    void Mesh::set_shader(std::shared_ptr<Program> shader_)
    {
       shader = shader_;
+      if (shader)
+         prepare_shader(shader);
+   }
+
+   void Mesh::prepare_shader(const std::shared_ptr<Program> &shader_)
+   {
+      if (!scene_buffer)
+      {
+         scene_buffer = std::make_shared<UniformBuffer>();
+         scene_buffer->bind(scene_binding);
+         GLSYM(glBufferData)(GL_UNIFORM_BUFFER, sizeof(SceneBlock), nullptr, GL_DYNAMIC_DRAW);
+         UniformBuffer::unbind();
+         scene_dirty = true;
+      }
+
+      scene_buffer->bind_block(shader_, shader_->uniform_block_index("Scene"));
+   }
+
+   void Mesh::use_shader(const std::shared_ptr<Program> &shader_)
+   {
+      shader = shader_;
+      shader->use();
    }
 
    void Mesh::render()
@@ -31,22 +84,38 @@ namespace GL
       vao.bind();
       if (tex)
          tex->bind();
+      else
+         Texture::unbind(0);
 
-      GLSYM(glDrawArrays)(GL_TRIANGLES, 0, num_vertices);
-
-      VAO::unbind();
-      if (tex)
-         tex->unbind();
-      Program::unbind();
+      // Bindings are left in place, the next draw only changes what differs.
+      GLSYM(glDrawElements)(GL_TRIANGLES, num_indices, index_type, nullptr);
    }
 
-   void Mesh::load_object(const std::vector<Geo::Triangle> &triangles)
+   void Mesh::load_object(const Geo::IndexedMesh &mesh)
    {
       vao.bind();
       vbo.bind();
-      num_vertices = static_cast<GLsizei>(triangles.size() * 3);
+      ibo.bind();
+      num_indices = static_cast<GLsizei>(mesh.indices.size());
+      model_bounds = GLU::ComputeBounds(mesh.vertices);
 
-      GLSYM(glBufferData)(GL_ARRAY_BUFFER, triangles.size() * sizeof(Geo::Triangle), &triangles[0], GL_STATIC_DRAW);
+      GLSYM(glBufferData)(GL_ARRAY_BUFFER, mesh.vertices.size() * sizeof(Geo::Coord),
+            mesh.vertices.data(), GL_STATIC_DRAW);
+
+      // Use 16-bit indices whenever they can address every vertex.
+      if (mesh.vertices.size() <= 0x10000)
+      {
+         std::vector<GLushort> indices(mesh.indices.begin(), mesh.indices.end());
+         index_type = GL_UNSIGNED_SHORT;
+         GLSYM(glBufferData)(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort),
+               indices.data(), GL_STATIC_DRAW);
+      }
+      else
+      {
+         index_type = GL_UNSIGNED_INT;
+         GLSYM(glBufferData)(GL_ELEMENT_ARRAY_BUFFER, mesh.indices.size() * sizeof(GLuint),
+               mesh.indices.data(), GL_STATIC_DRAW);
+      }
 
       GLSYM(glVertexAttribPointer)(Program::VertexStream, 3, 
             GL_FLOAT, GL_FALSE, sizeof(Geo::Coord), (void*)Geo::VertexOffset);
@@ -62,11 +131,12 @@ namespace GL
 
       VAO::unbind();
       Buffer::unbind(GL_ARRAY_BUFFER);
+      Buffer::unbind(GL_ELEMENT_ARRAY_BUFFER);
    }
 
    void Mesh::load_object(const std::string &obj)
    {
-      load_object(GLU::LoadObject(obj));
+      load_object(GLU::LoadIndexedObject(obj));
    }
 
    void Mesh::set_texture(std::shared_ptr<Texture> tex)
@@ -74,14 +144,57 @@ namespace GL
       this->tex = tex;
    }
 
+   GLuint Mesh::texture_object() const
+   {
+      return tex ? tex->object() : 0;
+   }
+
+   GLuint Mesh::vao_object() const
+   {
+      return vao.object();
+   }
+
+   float Mesh::view_depth() const
+   {
+      auto model_view = transforms.camera * trans_matrix;
+      return -model_view(2, 3);
+   }
+
+   Geo::Bounds Mesh::bounds() const
+   {
+      return model_bounds;
+   }
+
+   Geo::Bounds Mesh::world_bounds() const
+   {
+      return GLU::TransformBounds(bounds(), trans_matrix);
+   }
+
+   bool Mesh::visible(const GLU::Frustum &frustum) const
+   {
+      return GLU::Intersects(frustum, world_bounds());
+   }
+
    void Mesh::set_viewport_size(const ivec2 &size)
    {
       viewport_size = size;
+      scene_dirty = true;
    }
 
    void Mesh::set_transform(const GLMatrix &matrix)
    {
+      if (std::memcmp(trans_matrix(), matrix(), sizeof(GLfloat) * 16) == 0)
+         return;
+
       trans_matrix = matrix;
+      cached_generation = 0;
+      if (auto_normal)
+         normal_matrix = GLU::Matrices::NormalMatrix(trans_matrix);
+   }
+
+   void Mesh::set_transform(const GLTransform &transform)
+   {
+      set_transform(transform.matrix());
    }
 
    void Mesh::set_normal(const GLMatrix &matrix)
@@ -89,19 +202,71 @@ namespace GL
       normal_matrix = matrix;
    }
 
+   void Mesh::set_auto_normal(bool enable)
+   {
+      if (enable && !auto_normal)
+         normal_matrix = GLU::Matrices::NormalMatrix(trans_matrix);
+      auto_normal = enable;
+   }
+
    void Mesh::set_light_transform(const GLMatrix &matrix)
    {
       transforms.light_matrix = matrix;
+      bump_generation();
    }
 
    void Mesh::set_projection(const GLMatrix &matrix)
    {
       transforms.projection = matrix;
+      transforms.view_projection = transforms.projection * transforms.camera;
+      bump_generation();
    }
 
    void Mesh::set_camera(const GLMatrix &matrix)
    {
       transforms.camera = matrix;
+      transforms.view_projection = transforms.projection * transforms.camera;
+      bump_generation();
+   }
+
+   void Mesh::bump_generation()
+   {
+      // 0 marks a mesh whose matrices were never computed.
+      if (++transforms.generation == 0)
+         transforms.generation = 1;
+   }
+
+   void Mesh::update_transforms(const std::vector<std::shared_ptr<Mesh>> &meshes)
+   {
+      // Scratch storage kept across frames so steady state does not allocate.
+      static std::vector<Mesh*> stale;
+      static std::vector<GLMatrix> models;
+      static std::vector<GLMatrix> out;
+
+      stale.clear();
+      models.clear();
+      for (auto mesh = std::begin(meshes); mesh != std::end(meshes); ++mesh)
+      {
+         if ((*mesh)->cached_generation == transforms.generation)
+            continue;
+
+         stale.push_back(mesh->get());
+         models.push_back((*mesh)->trans_matrix);
+      }
+
+      if (stale.empty())
+         return;
+
+      out.resize(2 * models.size());
+      GLU::Matrices::TransformBatch(models.data(), models.size(),
+            transforms.view_projection, transforms.light_matrix, out.data());
+
+      for (size_t i = 0; i < stale.size(); i++)
+      {
+         stale[i]->projection_matrix = out[2 * i + 0];
+         stale[i]->light_projection_matrix = out[2 * i + 1];
+         stale[i]->cached_generation = transforms.generation;
+      }
    }
 
    void Mesh::set_uniforms()
@@ -115,69 +280,80 @@ namespace GL
       if (index >= max_lights)
          throw Exception("Light index out of bounds ...\n");
 
-      lights.light_pos[index] = vec_conv<3, 4>(pos);
-      lights.light_color[index] = vec_conv<3, 4>(color);
+      lights.light_pos[index] = pos;
+      lights.light_color[index] = color;
       light_enabled[index] = true;
+      scene_dirty = true;
    }
 
    void Mesh::set_ambient(const vec3 &color)
    {
-      lights.light_ambient = vec_conv<3, 4>(color);
+      lights.light_ambient = color;
+      scene_dirty = true;
    }
 
    void Mesh::set_player_pos(const vec3 &pos)
    {
       player_pos = pos;
+      scene_dirty = true;
    }
 
    void Mesh::unset_light(unsigned index)
    {
       light_enabled[index] = false;
+      scene_dirty = true;
    }
 
    void Mesh::set_transforms()
    {
-      auto proj = transforms.projection * transforms.camera * trans_matrix;
-      auto light = transforms.light_matrix * trans_matrix;
+      if (cached_generation != transforms.generation)
+      {
+         projection_matrix = transforms.view_projection * trans_matrix;
+         light_projection_matrix = transforms.light_matrix * trans_matrix;
+         cached_generation = transforms.generation;
+      }
 
-      GLSYM(glUniformMatrix4fv)(shader->uniform("projection_matrix"), 1,
-            GL_TRUE, proj());
-      GLSYM(glUniformMatrix4fv)(shader->uniform("light_matrix"), 1,
-            GL_TRUE, light());
-      GLSYM(glUniformMatrix4fv)(shader->uniform("trans_matrix"), 1, 
+      GLSYM(glUniformMatrix4fv)(shader->uniform(projection_matrix_key), 1,
+            GL_TRUE, projection_matrix());
+      GLSYM(glUniformMatrix4fv)(shader->uniform(light_matrix_key), 1,
+            GL_TRUE, light_projection_matrix());
+      GLSYM(glUniformMatrix4fv)(shader->uniform(trans_matrix_key), 1, 
             GL_TRUE, trans_matrix());
-      GLSYM(glUniformMatrix4fv)(shader->uniform("normal_matrix"), 1, 
+      GLSYM(glUniformMatrix4fv)(shader->uniform(normal_matrix_key), 1, 
             GL_TRUE, normal_matrix());
    }
 
    void Mesh::set_lights()
    {
-      Lights li;
-      li.lights = 0;
-      li.light_ambient = lights.light_ambient;
+      if (!scene_dirty || !scene_buffer)
+         return;
+
+      SceneBlock block;
+      std::memset(&block, 0, sizeof(block));
+
+      unsigned count = 0;
       for (unsigned i = 0; i < max_lights; i++)
       {
          if (!light_enabled[i])
             continue;
 
-         std::copy(lights.light_pos[i](), lights.light_pos[i]() + 4,
-               li.light_pos[li.lights]());
-         std::copy(lights.light_color[i](), lights.light_color[i]() + 4,
-               li.light_color[li.lights]());
-         li.lights++;
+         std::copy(lights.light_pos[i](), lights.light_pos[i]() + 3,
+               block.lights_pos[count]);
+         std::copy(lights.light_color[i](), lights.light_color[i]() + 3,
+               block.lights_color[count]);
+         count++;
       }
 
-      GLSYM(glUniform1i)(shader->uniform("lights_count"), li.lights);
-      GLSYM(glUniform3f)(shader->uniform("light_ambient"),
-            li.light_ambient(0), li.light_ambient(1), li.light_ambient(2));
-      GLSYM(glUniform3fv)(shader->uniform("lights_pos"), li.lights,
-            li.light_pos[0]());
-      GLSYM(glUniform3fv)(shader->uniform("lights_color"), li.lights,
-            li.light_color[0]());
-      GLSYM(glUniform3f)(shader->uniform("player_pos"),
-            player_pos(0), player_pos(1), player_pos(2));
-      GLSYM(glUniform2i)(shader->uniform("viewport_size"),
-            viewport_size(0), viewport_size(1));
+      block.lights_count = count;
+      std::copy(lights.light_ambient(), lights.light_ambient() + 3, block.light_ambient);
+      std::copy(player_pos(), player_pos() + 3, block.player_pos);
+      block.viewport_size[0] = viewport_size(0);
+      block.viewport_size[1] = viewport_size(1);
+
+      scene_buffer->bind();
+      GLSYM(glBufferSubData)(GL_UNIFORM_BUFFER, 0, sizeof(block), &block);
+      UniformBuffer::unbind();
+      scene_dirty = false;
    }
 
    std::shared_ptr<Program> Mesh::shader;
@@ -186,5 +362,7 @@ namespace GL
    std::array<bool, Mesh::max_lights> Mesh::light_enabled;
    GL::vec3 Mesh::player_pos;
    GL::ivec2 Mesh::viewport_size;
+   std::shared_ptr<UniformBuffer> Mesh::scene_buffer;
+   bool Mesh::scene_dirty = true;
 }
 
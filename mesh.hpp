@@ -7,6 +7,7 @@
 #include "structure.hpp"
 #include "texture.hpp"
 #include "utils.hpp"
+#include "cull.hpp"
 #include <string>
 #include <array>
 
@@ -17,8 +18,14 @@ namespace GL
       public:
          Mesh(const std::string &obj);
          Mesh(const std::vector<Geo::Triangle> &triangles);
+         Mesh(const Geo::IndexedMesh &mesh);
+         virtual ~Mesh() {}
          virtual void render();
          static void set_shader(std::shared_ptr<Program> shader);
+         // Binds the Scene block of shader. Needed once per program.
+         static void prepare_shader(const std::shared_ptr<Program> &shader);
+         // Switches to a program prepare_shader() has already seen.
+         static void use_shader(const std::shared_ptr<Program> &shader);
 
          static void set_projection(const GLMatrix &matrix);
          static void set_camera(const GLMatrix &matrix);
@@ -26,19 +33,46 @@ namespace GL
          static void set_viewport_size(const ivec2 &size);
          static void set_player_pos(const vec3 &pos);
          static void set_light_transform(const GLMatrix &matrix);
+         // Computes the projection and light matrices of every mesh whose
+         // cache is stale in one GLU::Matrices::TransformBatch() call,
+         // instead of per mesh when it is first drawn. Call after the last
+         // transform, camera or light change of the frame.
+         static void update_transforms(const std::vector<std::shared_ptr<Mesh>> &meshes);
          void set_transform(const GLMatrix &matrix);
+         void set_transform(const GLTransform &transform);
          void set_normal(const GLMatrix &matrix);
+         // Derive the normal matrix from set_transform() with
+         // GLU::Matrices::NormalMatrix() instead of set_normal().
+         // It is only recomputed when the transform actually changes.
+         void set_auto_normal(bool enable);
          void set_texture(std::shared_ptr<Texture> tex);
 
+         // Used to build render queue sort keys.
+         GLuint texture_object() const;
+         GLuint vao_object() const;
+         // Distance of the mesh origin in front of the camera.
+         float view_depth() const;
+
+         // Model space bounds, computed at load time.
+         virtual Geo::Bounds bounds() const;
+         // bounds() moved by set_transform().
+         Geo::Bounds world_bounds() const;
+         bool visible(const GLU::Frustum &frustum) const;
+
          static void set_light(unsigned index,
                const vec3 &pos, const vec3 &color);
          static void unset_light(unsigned index);
          static void set_ambient(const vec3 &color);
 
-      private:
-         void operator=(const Mesh&);
-         GLsizei num_vertices;
+      protected:
+         // For subclasses which upload geometry themselves.
+         Mesh();
+
+         GLsizei num_indices;
+         GLenum index_type;
+         Geo::Bounds model_bounds;
          Buffer vbo;
+         Buffer ibo;
          VAO vao;
 
          static std::shared_ptr<Program> shader;
@@ -46,12 +80,23 @@ namespace GL
 
          struct Transforms
          {
+            Transforms() : generation(1) {}
+
             GLMatrix projection;
             GLMatrix camera;
+            GLMatrix view_projection;
             GLMatrix light_matrix;
+            // Bumped when any of the above changes.
+            unsigned generation;
          } static transforms;
          GLMatrix trans_matrix;
          GLMatrix normal_matrix;
+         // view_projection and light_matrix times trans_matrix,
+         // valid while cached_generation == transforms.generation.
+         GLMatrix projection_matrix;
+         GLMatrix light_projection_matrix;
+         unsigned cached_generation;
+         bool auto_normal;
          enum { max_lights = 8 };
          static std::array<bool, max_lights> light_enabled;
          struct Lights
@@ -59,16 +104,37 @@ namespace GL
             vec3 light_ambient;
             vec3 light_pos[max_lights];
             vec3 light_color[max_lights];
-            GLint lights;
          } static lights;
          static vec3 player_pos;
          static ivec2 viewport_size;
 
+         // Mirrors the std140 "Scene" uniform block in shader.fp.
+         // It is identical for every mesh, so it is only uploaded
+         // when one of the static setters changed it.
+         struct SceneBlock
+         {
+            GLfloat lights_pos[max_lights][4];
+            GLfloat lights_color[max_lights][4];
+            GLfloat light_ambient[4];
+            GLfloat player_pos[4];
+            GLint viewport_size[2];
+            GLint lights_count;
+            GLint padding;
+         };
+         enum { scene_binding = 0 };
+         static std::shared_ptr<UniformBuffer> scene_buffer;
+         static bool scene_dirty;
+
+         static void set_lights();
+
+      private:
+         void operator=(const Mesh&);
+
          void load_object(const std::string &obj);
-         void load_object(const std::vector<Geo::Triangle> &obj);
+         void load_object(const Geo::IndexedMesh &obj);
          void set_uniforms();
-         void set_lights();
          void set_transforms();
+         static void bump_generation();
    };
 }
 
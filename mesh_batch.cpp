@@ -0,0 +1,304 @@
+#include "mesh_batch.hpp"
+#include <algorithm>
+
+namespace GL
+{
+   namespace
+   {
+      const Program::UniformKey view_projection_key = Program::uniform_key("view_projection");
+      const Program::UniformKey light_view_projection_key = Program::uniform_key("light_view_projection");
+      const Program::UniformKey trans_matrix_key = Program::uniform_key("trans_matrix");
+      const Program::UniformKey normal_matrix_key = Program::uniform_key("normal_matrix");
+
+      // Must match the binding of draw_transforms in the *_batch.vp shaders.
+      const unsigned transform_unit = 2;
+
+      // Grows buffer to capacity bytes, keeping its first used bytes. The
+      // name stays the same, so VAOs pointing at it stay valid.
+      void grow_buffer(GLuint buffer, size_t used, size_t capacity)
+      {
+         GLuint scratch = 0;
+         if (used)
+         {
+            GLSYM(glGenBuffers)(1, &scratch);
+            State::bind_buffer(GL_COPY_WRITE_BUFFER, scratch);
+            GLSYM(glBufferData)(GL_COPY_WRITE_BUFFER, used, nullptr, GL_STREAM_COPY);
+            State::bind_buffer(GL_COPY_READ_BUFFER, buffer);
+            GLSYM(glCopyBufferSubData)(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used);
+         }
+
+         State::bind_buffer(GL_COPY_WRITE_BUFFER, buffer);
+         GLSYM(glBufferData)(GL_COPY_WRITE_BUFFER, capacity, nullptr, GL_STATIC_DRAW);
+
+         if (scratch)
+         {
+            State::bind_buffer(GL_COPY_READ_BUFFER, scratch);
+            GLSYM(glCopyBufferSubData)(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used);
+            State::deleted_buffer(scratch);
+            GLSYM(glDeleteBuffers)(1, &scratch);
+         }
+      }
+
+      // The copy targets leave the VAO and element array bindings alone.
+      void write_buffer(GLuint buffer, size_t offset, size_t size, const void *data)
+      {
+         State::bind_buffer(GL_COPY_WRITE_BUFFER, buffer);
+         GLSYM(glBufferSubData)(GL_COPY_WRITE_BUFFER, offset, size, data);
+      }
+   }
+
+   // Geometry of every part of every batch. Parts are appended as they are
+   // added and the buffers double when full. Space is only given back when
+   // the last batch is destroyed, which suits batches built at load time.
+   struct MeshBatch::Arena
+   {
+      enum { min_vertices = 1 << 16, min_indices = 1 << 18 };
+
+      Buffer vertices;
+      Buffer draw_ids;
+      Buffer indices;
+      size_t vertex_count, vertex_capacity;
+      size_t index_count, index_capacity;
+
+      Arena() : vertices(GL_ARRAY_BUFFER), draw_ids(GL_ARRAY_BUFFER),
+         indices(GL_ELEMENT_ARRAY_BUFFER),
+         vertex_count(0), vertex_capacity(0), index_count(0), index_capacity(0)
+      {}
+
+      // Fills in base_vertex and first_index of cmd.
+      void append(const Geo::IndexedMesh &mesh, GLuint draw, DrawCommand &cmd)
+      {
+         size_t vertex_need = vertex_count + mesh.vertices.size();
+         if (vertex_need > vertex_capacity)
+         {
+            size_t capacity = std::max(std::max(2 * vertex_capacity, vertex_need), size_t(min_vertices));
+            grow_buffer(vertices.object(), vertex_count * sizeof(Geo::Coord), capacity * sizeof(Geo::Coord));
+            grow_buffer(draw_ids.object(), vertex_count * sizeof(GLuint), capacity * sizeof(GLuint));
+            vertex_capacity = capacity;
+         }
+
+         size_t index_need = index_count + mesh.indices.size();
+         if (index_need > index_capacity)
+         {
+            size_t capacity = std::max(std::max(2 * index_capacity, index_need), size_t(min_indices));
+            grow_buffer(indices.object(), index_count * sizeof(GLuint), capacity * sizeof(GLuint));
+            index_capacity = capacity;
+         }
+
+         std::vector<GLuint> ids(mesh.vertices.size(), draw);
+         write_buffer(vertices.object(), vertex_count * sizeof(Geo::Coord),
+               mesh.vertices.size() * sizeof(Geo::Coord), mesh.vertices.data());
+         write_buffer(draw_ids.object(), vertex_count * sizeof(GLuint),
+               ids.size() * sizeof(GLuint), ids.data());
+         write_buffer(indices.object(), index_count * sizeof(GLuint),
+               mesh.indices.size() * sizeof(GLuint), mesh.indices.data());
+
+         cmd.base_vertex = vertex_count;
+         cmd.first_index = index_count;
+         vertex_count = vertex_need;
+         index_count = index_need;
+      }
+
+      static std::shared_ptr<Arena> get()
+      {
+         static std::weak_ptr<Arena> shared;
+         auto arena = shared.lock();
+         if (!arena)
+         {
+            arena = std::make_shared<Arena>();
+            shared = arena;
+         }
+         return arena;
+      }
+   };
+
+   MeshBatch::MeshBatch() :
+      arena(Arena::get()),
+      bounds_dirty(true),
+      indirect_buffer(GL_DRAW_INDIRECT_BUFFER),
+      transform_buffer(GL_TEXTURE_BUFFER),
+      transform_tex(0),
+      commands_dirty(false), transforms_dirty(false)
+   {
+      use_indirect = GLSYM_AVAILABLE(glMultiDrawElementsIndirect) &&
+         HasExtension("GL_ARB_multi_draw_indirect");
+
+      GLSYM(glGenTextures)(1, &transform_tex);
+
+      // The shared buffers keep their names as they grow, so this holds.
+      vao.bind();
+      arena->vertices.bind();
+      GLSYM(glVertexAttribPointer)(Program::VertexStream, 3,
+            GL_FLOAT, GL_FALSE, sizeof(Geo::Coord), (void*)Geo::VertexOffset);
+      GLSYM(glEnableVertexAttribArray)(Program::VertexStream);
+
+      GLSYM(glVertexAttribPointer)(Program::NormalStream, 3,
+            GL_FLOAT, GL_FALSE, sizeof(Geo::Coord), (void*)Geo::NormalOffset);
+      GLSYM(glEnableVertexAttribArray)(Program::NormalStream);
+
+      GLSYM(glVertexAttribPointer)(Program::TextureStream, 2,
+            GL_FLOAT, GL_FALSE, sizeof(Geo::Coord), (void*)Geo::TextureOffset);
+      GLSYM(glEnableVertexAttribArray)(Program::TextureStream);
+
+      arena->draw_ids.bind();
+      GLSYM(glVertexAttribIPointer)(Program::DrawIDStream, 1,
+            GL_UNSIGNED_INT, sizeof(GLuint), nullptr);
+      GLSYM(glEnableVertexAttribArray)(Program::DrawIDStream);
+
+      arena->indices.bind();
+
+      VAO::unbind();
+      Buffer::unbind(GL_ARRAY_BUFFER);
+      Buffer::unbind(GL_ELEMENT_ARRAY_BUFFER);
+   }
+
+   MeshBatch::~MeshBatch()
+   {
+      State::deleted_texture(transform_tex);
+      GLSYM(glDeleteTextures)(1, &transform_tex);
+   }
+
+   unsigned MeshBatch::add(const Geo::IndexedMesh &mesh)
+   {
+      unsigned draw = commands.size();
+
+      DrawCommand cmd;
+      cmd.count = mesh.indices.size();
+      cmd.instance_count = 1;
+      cmd.base_instance = 0;
+      arena->append(mesh, draw, cmd);
+      commands.push_back(cmd);
+
+      counts.push_back(cmd.count);
+      offsets.push_back(reinterpret_cast<const GLvoid*>(cmd.first_index * sizeof(GLuint)));
+      base_vertices.push_back(cmd.base_vertex);
+
+      part_bounds.push_back(GLU::ComputeBounds(mesh.vertices));
+
+      draw_transforms.resize(draw_transforms.size() + texels_per_draw * 4);
+      set_part_matrix(draw, 0, GLU::Matrices::Identity());
+      set_part_matrix(draw, 1, GLU::Matrices::Identity());
+
+      num_indices += cmd.count;
+      commands_dirty = use_indirect;
+      bounds_dirty = true;
+      return draw;
+   }
+
+   unsigned MeshBatch::parts() const
+   {
+      return commands.size();
+   }
+
+   void MeshBatch::set_part_matrix(unsigned draw, unsigned slot, const GLMatrix &matrix)
+   {
+      if (draw >= commands.size())
+         throw Exception("Batch draw index out of bounds ...\n");
+
+      GLfloat *out = &draw_transforms[(draw * texels_per_draw + slot * 4) * 4];
+      for (unsigned c = 0; c < 4; c++)
+         for (unsigned r = 0; r < 4; r++)
+            *out++ = matrix(r, c);
+
+      transforms_dirty = true;
+   }
+
+   void MeshBatch::set_part_transform(unsigned draw, const GLMatrix &matrix)
+   {
+      set_part_matrix(draw, 0, matrix);
+      bounds_dirty = true;
+   }
+
+   void MeshBatch::set_part_normal(unsigned draw, const GLMatrix &matrix)
+   {
+      set_part_matrix(draw, 1, matrix);
+   }
+
+   Geo::Bounds MeshBatch::bounds() const
+   {
+      if (!bounds_dirty)
+         return merged_bounds;
+
+      merged_bounds = model_bounds;
+      for (unsigned i = 0; i < part_bounds.size(); i++)
+      {
+         // Back from the column-major layout in draw_transforms.
+         GLMatrix matrix;
+         const GLfloat *in = &draw_transforms[i * texels_per_draw * 4];
+         for (unsigned c = 0; c < 4; c++)
+            for (unsigned r = 0; r < 4; r++)
+               matrix(r, c) = *in++;
+
+         auto part = GLU::TransformBounds(part_bounds[i], matrix);
+         merged_bounds = i ? GLU::MergeBounds(merged_bounds, part) : part;
+      }
+
+      bounds_dirty = false;
+      return merged_bounds;
+   }
+
+   void MeshBatch::upload_commands()
+   {
+      indirect_buffer.bind();
+      GLSYM(glBufferData)(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawCommand),
+            commands.data(), GL_STATIC_DRAW);
+      Buffer::unbind(GL_DRAW_INDIRECT_BUFFER);
+
+      commands_dirty = false;
+   }
+
+   void MeshBatch::upload_transforms()
+   {
+      transform_buffer.bind();
+      GLSYM(glBufferData)(GL_TEXTURE_BUFFER, draw_transforms.size() * sizeof(GLfloat),
+            draw_transforms.data(), GL_DYNAMIC_DRAW);
+      Buffer::unbind(GL_TEXTURE_BUFFER);
+
+      State::bind_texture(transform_unit, GL_TEXTURE_BUFFER, transform_tex);
+      GLSYM(glTexBuffer)(GL_TEXTURE_BUFFER, GL_RGBA32F, transform_buffer.object());
+
+      transforms_dirty = false;
+   }
+
+   void MeshBatch::render()
+   {
+      if (commands.empty())
+         return;
+
+      if (commands_dirty)
+         upload_commands();
+      if (transforms_dirty)
+         upload_transforms();
+
+      shader->use();
+      set_lights();
+
+      GLSYM(glUniformMatrix4fv)(shader->uniform(view_projection_key), 1,
+            GL_TRUE, transforms.view_projection());
+      GLSYM(glUniformMatrix4fv)(shader->uniform(light_view_projection_key), 1,
+            GL_TRUE, transforms.light_matrix());
+      GLSYM(glUniformMatrix4fv)(shader->uniform(trans_matrix_key), 1,
+            GL_TRUE, trans_matrix());
+      GLSYM(glUniformMatrix4fv)(shader->uniform(normal_matrix_key), 1,
+            GL_TRUE, normal_matrix());
+
+      vao.bind();
+      if (tex)
+         tex->bind();
+      else
+         Texture::unbind(0);
+      State::bind_texture(transform_unit, GL_TEXTURE_BUFFER, transform_tex);
+
+      if (use_indirect)
+      {
+         indirect_buffer.bind();
+         GLSYM(glMultiDrawElementsIndirect)(GL_TRIANGLES, GL_UNSIGNED_INT,
+               nullptr, commands.size(), 0);
+      }
+      else
+      {
+         GLSYM(glMultiDrawElementsBaseVertex)(GL_TRIANGLES, counts.data(),
+               GL_UNSIGNED_INT, offsets.data(), counts.size(), base_vertices.data());
+      }
+   }
+}
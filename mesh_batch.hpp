@@ -0,0 +1,86 @@
+#ifndef MESH_BATCH_HPP__
+#define MESH_BATCH_HPP__
+
+#include "mesh.hpp"
+#include <vector>
+#include <memory>
+
+namespace GL
+{
+   // Many meshes sharing a texture, drawn with a single multi-draw call.
+   // The geometry of every batch is sub-allocated from one vertex, one
+   // draw ID and one index buffer shared by all of them.
+   //
+   // Each part has its own model and normal matrix, read in the vertex
+   // shader from a buffer texture by a per-vertex draw ID (Program::DrawIDStream).
+   // The batch's own set_transform()/set_normal() apply on top of them.
+   // Requires the *_batch.vp vertex shaders.
+   //
+   // Uses glMultiDrawElementsIndirect with GL_ARB_multi_draw_indirect and
+   // glMultiDrawElementsBaseVertex on plain GL 3.3.
+   class MeshBatch : public Mesh
+   {
+      public:
+         MeshBatch();
+         ~MeshBatch();
+
+         // Returns the draw index of the new part. Parts start out with
+         // identity matrices. The geometry goes straight to the shared
+         // buffers, the batch keeps no copy of it.
+         unsigned add(const Geo::IndexedMesh &mesh);
+         unsigned parts() const;
+
+         void set_part_transform(unsigned draw, const GLMatrix &matrix);
+         void set_part_normal(unsigned draw, const GLMatrix &matrix);
+
+         // Union of the parts moved by their part transforms.
+         Geo::Bounds bounds() const;
+
+         void render();
+
+      private:
+         void operator=(const MeshBatch&);
+
+         // Layout of a glMultiDrawElementsIndirect command.
+         struct DrawCommand
+         {
+            GLuint count;
+            GLuint instance_count;
+            GLuint first_index;
+            GLint base_vertex;
+            GLuint base_instance;
+         };
+
+         struct Arena;
+         std::shared_ptr<Arena> arena;
+
+         std::vector<DrawCommand> commands;
+
+         // glMultiDrawElementsBaseVertex arguments.
+         std::vector<GLsizei> counts;
+         std::vector<const GLvoid*> offsets;
+         std::vector<GLint> base_vertices;
+
+         // Column-major model and normal matrix per part.
+         enum { texels_per_draw = 8 };
+         std::vector<GLfloat> draw_transforms;
+
+         std::vector<Geo::Bounds> part_bounds;
+         mutable Geo::Bounds merged_bounds;
+         mutable bool bounds_dirty;
+
+         Buffer indirect_buffer;
+         Buffer transform_buffer;
+         GLuint transform_tex;
+
+         bool use_indirect;
+         bool commands_dirty;
+         bool transforms_dirty;
+
+         void upload_commands();
+         void upload_transforms();
+         void set_part_matrix(unsigned draw, unsigned slot, const GLMatrix &matrix);
+   };
+}
+
+#endif
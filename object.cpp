@@ -1,13 +1,16 @@
 #include "object.hpp"
 #include "utils.hpp"
+#include "optimize.hpp"
+#include "texture_cache.hpp"
 #include <iostream>
-#include <fstream>
 #include <string>
 #include <array>
 #include <vector>
 #include <cstdlib>
 #include <cstring>
 #include <map>
+#include <algorithm>
+#include <thread>
 #include <assert.h>
 
 namespace GLU
@@ -17,316 +20,846 @@ namespace GLU
       Vertex,
       Normal,
       Texture,
-      Elem
+      Elem,
+      Material,
+      None
    };
 
-   static void parse_indices(char *list, size_t indices[3], size_t offsets[3])
+   // Files smaller than this are parsed on the calling thread.
+   static const size_t min_chunk_size = 1 << 20;
+   static const size_t min_batch_faces = 1 << 16;
+
+   typedef std::vector<std::array<float, 3>> lvec3;
+   typedef std::vector<std::array<float, 2>> lvec2;
+
+   struct Face
+   {
+      // 1-based (vertex, texture, normal) indices, 0 if not present.
+      size_t indices[3][3];
+      // Bit (3 * i + j) is set if indices[i][j] was given relative to
+      // the end of its chunk and still needs the chunk's base offset.
+      unsigned relative;
+   };
+
+   // Faces following a "texture" directive.
+   struct Group
+   {
+      size_t first_face;
+      std::string material;
+   };
+
+   struct ObjData
+   {
+      lvec3 vertices;
+      lvec3 normals;
+      lvec2 tex_coords;
+      std::vector<Face> faces;
+      std::vector<Group> groups;
+   };
+
+   static inline bool is_space(char c)
+   {
+      return c == ' ' || c == '\t' || c == '\r';
+   }
+
+   // Tokenizes directly over the (read-only) file data.
+   // [ptr, end) is the remainder of the current line.
+   static inline bool next_token(const char *&ptr, const char *end,
+         const char *&tok, const char *&tok_end)
+   {
+      while (ptr < end && is_space(*ptr))
+         ptr++;
+      if (ptr == end)
+         return false;
+
+      tok = ptr;
+      while (ptr < end && !is_space(*ptr))
+         ptr++;
+      tok_end = ptr;
+      return true;
+   }
+
+   static inline bool token_is(const char *tok, const char *tok_end, const char *str)
+   {
+      size_t len = std::strlen(str);
+      return static_cast<size_t>(tok_end - tok) == len && std::memcmp(tok, str, len) == 0;
+   }
+
+   // Exact for plain decimals with at most 15 significant digits:
+   // both the mantissa and 10^exp are exactly representable as double,
+   // so the single division rounds the same way strtod() does.
+   static inline bool parse_float_fast(const char *ptr, const char *end, double &out)
    {
+      static const double pow10[] = {
+         1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+         1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+         1e21, 1e22,
+      };
+
+      bool negative = false;
+      if (ptr < end && (*ptr == '-' || *ptr == '+'))
+      {
+         negative = *ptr == '-';
+         ptr++;
+      }
+
+      unsigned long long mantissa = 0;
+      unsigned digits = 0; // Significant digits.
+      unsigned read = 0;
+      int exp = 0;
+
+      while (ptr < end && *ptr >= '0' && *ptr <= '9')
+      {
+         mantissa = mantissa * 10 + (*ptr++ - '0');
+         if (mantissa)
+            digits++;
+         read++;
+      }
+
+      if (ptr < end && *ptr == '.')
+      {
+         ptr++;
+         while (ptr < end && *ptr >= '0' && *ptr <= '9')
+         {
+            mantissa = mantissa * 10 + (*ptr++ - '0');
+            if (mantissa)
+               digits++;
+            read++;
+            exp--;
+         }
+      }
+
+      // A bare sign or "." is left for strtod() to judge.
+      if (ptr != end || !read || digits > 15 || exp < -22)
+         return false;
+
+      out = static_cast<double>(mantissa) / pow10[-exp];
+      if (negative)
+         out = -out;
+      return true;
+   }
+
+   static inline float parse_float(const char *tok, const char *tok_end)
+   {
+      double val;
+      if (parse_float_fast(tok, tok_end, val))
+         return static_cast<float>(val);
+
+      // The mapping is not NUL-terminated, so strtod() needs a small copy.
+      char buf[64];
+      size_t len = std::min(static_cast<size_t>(tok_end - tok), sizeof(buf) - 1);
+      std::memcpy(buf, tok, len);
+      buf[len] = '\0';
+      return static_cast<float>(std::strtod(buf, nullptr));
+   }
+
+   static inline long parse_int(const char *&ptr, const char *end)
+   {
+      bool negative = false;
+      if (ptr < end && (*ptr == '-' || *ptr == '+'))
+      {
+         negative = *ptr == '-';
+         ptr++;
+      }
+
+      long val = 0;
+      while (ptr < end && *ptr >= '0' && *ptr <= '9')
+         val = val * 10 + (*ptr++ - '0');
+
+      return negative ? -val : val;
+   }
+
+   static unsigned parse_indices(const char *ptr, const char *end, size_t indices[3], const size_t offsets[3])
+   {
+      unsigned relative = 0;
       for (unsigned i = 0; i < 3; i++)
          indices[i] = 0;
 
-      char *end = list;
-      for (unsigned i = 0; i < 3; i++, end++)
+      for (unsigned i = 0; i < 3; i++)
       {
-         char *old = end;
-
-         int indice = std::strtol(old, &end, 0);
+         long indice = parse_int(ptr, end);
          if (indice > 0)
             indices[i] = indice;
          else if (indice < 0) // Relative to end
+         {
             indices[i] = offsets[i] + indice + 1;
+            relative |= 1u << i;
+         }
 
-         if (end[0] == '\0')
+         if (ptr >= end || *ptr != '/')
             break;
+         ptr++;
       }
+
+      return relative;
    }
 
-   static bool get_attr(char *line, Attr &attr, float elems[3], size_t indices[3][3], size_t offsets[3])
+   static Attr get_attr(const char *line, const char *end, float elems[3],
+         size_t indices[3][3], unsigned &relative, const size_t offsets[3])
    {
-      char *elem = std::strtok(line, " ");
-      if (!elem)
-         return false;
+      const char *tok, *tok_end;
+      if (!next_token(line, end, tok, tok_end))
+         return None;
 
-      std::string vert_type = elem;
-      if (vert_type == "v")
+      Attr attr;
+      if (token_is(tok, tok_end, "v"))
          attr = Vertex;
-      else if (vert_type == "vn")
+      else if (token_is(tok, tok_end, "vn"))
          attr = Normal;
-      else if (vert_type == "vt")
+      else if (token_is(tok, tok_end, "vt"))
          attr = Texture;
-      else if (vert_type == "f")
+      else if (token_is(tok, tok_end, "f"))
          attr = Elem;
+      else if (token_is(tok, tok_end, "texture"))
+         return Material;
       else
-         return false;
+         return None;
 
       if (attr == Elem)
       {
-         for (unsigned i = 0; i < 3 && elem; i++)
+         relative = 0;
+         for (unsigned i = 0; i < 3; i++)
          {
-            elem = std::strtok(nullptr, " ");
-            if (elem)
-               parse_indices(elem, indices[i], offsets);
-            else
-               return false;
+            if (!next_token(line, end, tok, tok_end))
+               return None;
+            relative |= parse_indices(tok, tok_end, indices[i], offsets) << (3 * i);
          }
       }
       else
       {
-         for (unsigned i = 0; i < 3 && elem; i++)
+         for (unsigned i = 0; i < 3; i++)
          {
-            elem = std::strtok(nullptr, " ");
-            if (elem)
-               elems[i] = static_cast<float>(strtod(elem, nullptr));
+            elems[i] = 0.0f;
+            if (next_token(line, end, tok, tok_end))
+               elems[i] = parse_float(tok, tok_end);
          }
       }
 
-      return true;
+      return attr;
    }
 
-   typedef std::vector<std::array<float, 3>> lvec3;
-   typedef std::vector<std::array<float, 2>> lvec2;
-
-   static GL::Geo::Triangle triangle_from_indices(
-         const lvec3 &vertices, const lvec3 &normals, const lvec2 &tex_coords, size_t indices[3][3])
+   // texture <name> => <directory><name>.tga
+   static std::string material_path(const char *line, const char *end, const std::string &directory)
    {
-      GL::Geo::Triangle tri;
-      std::memset(&tri, 0, sizeof(tri));
+      while (end > line && is_space(end[-1]))
+         end--;
 
-      for (unsigned i = 0; i < 3; i++)
+      const char *name = end;
+      while (name > line && name[-1] != ' ')
+         name--;
+
+      std::string path = directory;
+      path.append(name, end);
+      path += ".tga";
+      return path;
+   }
+
+   static void parse_object(const char *ptr, const char *end, const std::string &directory, ObjData &data)
+   {
+      while (ptr < end)
       {
-         if (indices[i][0])
-         {
-            size_t real_indice = indices[i][0] - 1;
-            if (real_indice >= vertices.size())
-               throw GL::Exception("Object face index exceeds maximum recorded vertices!");
+         const char *line = ptr;
+         const char *line_end = static_cast<const char*>(std::memchr(ptr, '\n', end - ptr));
+         if (!line_end)
+            line_end = end;
+         ptr = line_end + 1;
 
-            for (unsigned j = 0; j < 3; j++)
-               tri.coord[i].vertex[j] = vertices[real_indice][j];
-         }
+         float elems[3];
+         size_t indices[3][3];
+         unsigned relative;
+         size_t offsets[3] = { data.vertices.size(), data.tex_coords.size(), data.normals.size() };
 
-         if (indices[i][1])
+         switch (get_attr(line, line_end, elems, indices, relative, offsets))
          {
-            size_t real_indice = indices[i][1] - 1;
-            if (real_indice >= tex_coords.size())
-               throw GL::Exception("Object face index exceeds maximum recorded texture coordinates!");
+            case Vertex:
+            {
+               std::array<float, 3> arr = {{ elems[0], elems[1], elems[2] }};
+               data.vertices.push_back(arr);
+               break;
+            }
+
+            case Texture:
+            {
+               std::array<float, 2> arr = {{ elems[0], elems[1] }};
+               data.tex_coords.push_back(arr);
+               break;
+            }
+
+            case Normal:
+            {
+               std::array<float, 3> arr = {{ elems[0], elems[1], elems[2] }};
+               data.normals.push_back(arr);
+               break;
+            }
+
+            case Elem:
+            {
+               Face face;
+               std::memcpy(face.indices, indices, sizeof(indices));
+               face.relative = relative;
+               data.faces.push_back(face);
+               break;
+            }
 
-            for (unsigned j = 0; j < 2; j++)
-               tri.coord[i].tex[j] = tex_coords[real_indice][j];
+            case Material:
+            {
+               Group group;
+               group.first_face = data.faces.size();
+               group.material = material_path(line, line_end, directory);
+               data.groups.push_back(group);
+               break;
+            }
+
+            default:
+               break;
          }
+      }
+   }
 
-         if (indices[i][2])
-         {
-            size_t real_indice = indices[i][2] - 1;
-            if (real_indice >= normals.size())
-               throw GL::Exception("Object face index exceeds maximum recorded normal coordinates!");
+   // Concatenates chunks in file order. Indices that were relative to the end
+   // of a chunk are rebased so the result matches a serial parse exactly.
+   static void merge_chunks(std::vector<ObjData> &chunks, ObjData &data)
+   {
+      std::vector<std::array<size_t, 3>> bases(chunks.size());
+      std::vector<size_t> face_bases(chunks.size());
+      std::array<size_t, 3> base = {{ 0, 0, 0 }};
+      size_t face_base = 0;
+
+      for (size_t i = 0; i < chunks.size(); i++)
+      {
+         bases[i] = base;
+         face_bases[i] = face_base;
+         base[0] += chunks[i].vertices.size();
+         base[1] += chunks[i].tex_coords.size();
+         base[2] += chunks[i].normals.size();
+         face_base += chunks[i].faces.size();
+      }
+
+      data.vertices.resize(base[0]);
+      data.tex_coords.resize(base[1]);
+      data.normals.resize(base[2]);
+      data.faces.resize(face_base);
+
+      ParallelFor(chunks.size(), 1, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++)
+            {
+               ObjData &chunk = chunks[i];
+               std::copy(chunk.vertices.begin(), chunk.vertices.end(), data.vertices.begin() + bases[i][0]);
+               std::copy(chunk.tex_coords.begin(), chunk.tex_coords.end(), data.tex_coords.begin() + bases[i][1]);
+               std::copy(chunk.normals.begin(), chunk.normals.end(), data.normals.begin() + bases[i][2]);
+
+               Face *out = &data.faces[face_bases[i]];
+               for (size_t f = 0; f < chunk.faces.size(); f++)
+               {
+                  Face face = chunk.faces[f];
+                  for (unsigned j = 0; j < 9; j++)
+                     if (face.relative & (1u << j))
+                        face.indices[j / 3][j % 3] += bases[i][j % 3];
+                  face.relative = 0;
+                  out[f] = face;
+               }
+
+               lvec3().swap(chunk.vertices);
+               lvec2().swap(chunk.tex_coords);
+               lvec3().swap(chunk.normals);
+               std::vector<Face>().swap(chunk.faces);
+            }
+         });
 
-            for (unsigned j = 0; j < 3; j++)
-               tri.coord[i].normal[j] = normals[real_indice][j];
+      for (size_t i = 0; i < chunks.size(); i++)
+      {
+         for (auto group = std::begin(chunks[i].groups); group != std::end(chunks[i].groups); ++group)
+         {
+            data.groups.push_back(*group);
+            data.groups.back().first_face += face_bases[i];
          }
       }
+   }
 
-      return tri;
+   static void load_object(const std::string &path, ObjData &data)
+   {
+      std::string directory = path;
+      auto itr = directory.find_last_of("/\\");
+      if (itr != std::string::npos)
+         directory = directory.substr(0, itr + 1);
+      else
+         directory = "";
+
+      MappedFile file(path);
+      const char *begin = file.data();
+      const char *end = begin + file.size();
+
+      // Split into newline aligned chunks, one per core.
+      size_t num_chunks = std::max(std::min(file.size() / min_chunk_size,
+               static_cast<size_t>(std::thread::hardware_concurrency())), size_t(1));
+
+      std::vector<const char*> bounds;
+      bounds.push_back(begin);
+      for (size_t i = 1; i < num_chunks; i++)
+      {
+         const char *ptr = std::max(begin + file.size() * i / num_chunks, bounds.back());
+         ptr = static_cast<const char*>(std::memchr(ptr, '\n', end - ptr));
+         bounds.push_back(ptr ? ptr + 1 : end);
+      }
+      bounds.push_back(end);
+
+      if (num_chunks == 1)
+      {
+         parse_object(begin, end, directory, data);
+         return;
+      }
+
+      std::vector<ObjData> chunks(num_chunks);
+      ParallelFor(num_chunks, 1, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++)
+               parse_object(bounds[i], bounds[i + 1], directory, chunks[i]);
+         });
+
+      merge_chunks(chunks, data);
    }
 
-   std::vector<GL::Geo::Triangle> LoadObject(const std::string &path)
+   static GL::Geo::Coord coord_from_indices(
+         const lvec3 &vertices, const lvec3 &normals, const lvec2 &tex_coords, const size_t indices[3])
    {
-      std::vector<GL::Geo::Triangle> triangles;
-      lvec3 vertices;
-      lvec3 normals;
-      lvec2 tex_coords;
+      GL::Geo::Coord coord;
+      std::memset(&coord, 0, sizeof(coord));
 
-      std::fstream file(path, std::ios::in);
-      if (!file.is_open())
-         throw GL::Exception(join("Failed to open OBJ: ", path));
+      if (indices[0])
+      {
+         size_t real_indice = indices[0] - 1;
+         if (real_indice >= vertices.size())
+            throw GL::Exception("Object face index exceeds maximum recorded vertices!");
 
-      while (!file.eof())
+         for (unsigned j = 0; j < 3; j++)
+            coord.vertex[j] = vertices[real_indice][j];
+      }
+
+      if (indices[1])
       {
-         char buf_[256];
-         file.getline(buf_, sizeof(buf_));
-         if (file.bad())
-            throw GL::Exception("Failed to load object!");
+         size_t real_indice = indices[1] - 1;
+         if (real_indice >= tex_coords.size())
+            throw GL::Exception("Object face index exceeds maximum recorded texture coordinates!");
 
-         std::string buf(buf_);
+         for (unsigned j = 0; j < 2; j++)
+            coord.tex[j] = tex_coords[real_indice][j];
+      }
 
-         float elems[3];
-         size_t indices[3][3];
-         Attr attr;
-         size_t arr[3] = { vertices.size(), tex_coords.size(), normals.size() };
+      if (indices[2])
+      {
+         size_t real_indice = indices[2] - 1;
+         if (real_indice >= normals.size())
+            throw GL::Exception("Object face index exceeds maximum recorded normal coordinates!");
+
+         for (unsigned j = 0; j < 3; j++)
+            coord.normal[j] = normals[real_indice][j];
+      }
 
-         std::vector<char> mut_buf(buf.begin(), buf.end());
-         mut_buf.push_back('\0');
+      return coord;
+   }
 
-         if (get_attr(mut_buf.data(), attr, elems, indices, arr))
+   static GL::Geo::Triangle triangle_from_indices(
+         const lvec3 &vertices, const lvec3 &normals, const lvec2 &tex_coords, const size_t indices[3][3])
+   {
+      GL::Geo::Triangle tri;
+      for (unsigned i = 0; i < 3; i++)
+         tri.coord[i] = coord_from_indices(vertices, normals, tex_coords, indices[i]);
+      return tri;
+   }
+
+   // Open addressing hash set which hands out vertex ids
+   // in order of first appearance.
+   template <class Key, class Hash>
+   class VertexDedup
+   {
+      public:
+         VertexDedup(size_t expected) : mask(15)
+         {
+            while (mask + 1 < 2 * expected)
+               mask = 2 * mask + 1;
+            slots.assign(mask + 1, empty);
+            keys.reserve(expected);
+         }
+
+         uint32_t insert(const Key &key, bool &inserted)
          {
-            switch (attr)
+            size_t slot = hash(key) & mask;
+            while (slots[slot] != empty)
             {
-               case Vertex:
+               if (std::memcmp(&keys[slots[slot]], &key, sizeof(Key)) == 0)
                {
-                  std::array<float, 3> arr;
-                  for (unsigned i = 0; i < 3; i++)
-                     arr[i] = elems[i];
-
-                  vertices.push_back(arr);
-                  break;
+                  inserted = false;
+                  return slots[slot];
                }
+               slot = (slot + 1) & mask;
+            }
 
-               case Texture:
-               {
-                  std::array<float, 2> arr;
-                  for (unsigned i = 0; i < 2; i++)
-                     arr[i] = elems[i];
-                  tex_coords.push_back(arr);
-                  break;
-               }
+            uint32_t id = static_cast<uint32_t>(keys.size());
+            if (id == empty)
+               throw GL::Exception("Mesh exceeds maximum number of unique vertices!");
 
-               case Normal:
-               {
-                  std::array<float, 3> arr;
-                  for (unsigned i = 0; i < 3; i++)
-                     arr[i] = elems[i];
-                  normals.push_back(arr);
-                  break;
-               }
+            slots[slot] = id;
+            keys.push_back(key);
+            inserted = true;
+
+            if (2 * keys.size() > mask)
+               grow();
+            return id;
+         }
 
-               case Elem:
-                  triangles.push_back(triangle_from_indices(vertices, normals, tex_coords, indices));
-                  break;
+      private:
+         enum : uint32_t { empty = ~0u };
+         std::vector<uint32_t> slots;
+         std::vector<Key> keys;
+         Hash hash;
+         size_t mask;
 
-               default:
-                  break;
+         void grow()
+         {
+            mask = 2 * mask + 1;
+            slots.assign(mask + 1, empty);
+            for (uint32_t id = 0; id < keys.size(); id++)
+            {
+               size_t slot = hash(keys[id]) & mask;
+               while (slots[slot] != empty)
+                  slot = (slot + 1) & mask;
+               slots[slot] = id;
             }
          }
+   };
+
+   static inline size_t hash_mix(uint64_t h)
+   {
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdull;
+      h ^= h >> 33;
+      return static_cast<size_t>(h);
+   }
+
+   struct CornerKey
+   {
+      size_t indices[3];
+   };
+
+   struct CornerHash
+   {
+      size_t operator()(const CornerKey &key) const
+      {
+         return hash_mix(key.indices[0] * 0x9e3779b97f4a7c15ull ^
+               key.indices[1] * 0xc2b2ae3d27d4eb4full ^
+               key.indices[2] * 0x165667b19e3779f9ull);
       }
+   };
+
+   struct CoordHash
+   {
+      size_t operator()(const GL::Geo::Coord &coord) const
+      {
+         uint32_t words[sizeof(coord) / sizeof(uint32_t)];
+         std::memcpy(words, &coord, sizeof(coord));
+
+         uint64_t h = 0;
+         for (unsigned i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+            h = (h ^ words[i]) * 0x9e3779b97f4a7c15ull;
+         return hash_mix(h);
+      }
+   };
+
+   // Shares a vertex between all corners with the same v/vt/vn triple.
+   static GL::Geo::IndexedMesh build_indexed(const ObjData &data, size_t first, size_t last)
+   {
+      GL::Geo::IndexedMesh mesh;
+      mesh.indices.reserve(3 * (last - first));
+
+      VertexDedup<CornerKey, CornerHash> dedup(last - first);
+      for (size_t i = first; i < last; i++)
+      {
+         for (unsigned j = 0; j < 3; j++)
+         {
+            CornerKey key;
+            std::memcpy(key.indices, data.faces[i].indices[j], sizeof(key.indices));
+
+            bool inserted;
+            uint32_t id = dedup.insert(key, inserted);
+            if (inserted)
+            {
+               mesh.vertices.push_back(coord_from_indices(data.vertices,
+                        data.normals, data.tex_coords, key.indices));
+            }
+            mesh.indices.push_back(id);
+         }
+      }
+
+      return mesh;
+   }
+
+   static std::vector<GL::Geo::Triangle> build_triangles(const ObjData &data, size_t first, size_t last)
+   {
+      std::vector<GL::Geo::Triangle> triangles(last - first);
+      ParallelFor(last - first, min_batch_faces, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+               triangles[i] = triangle_from_indices(data.vertices,
+                     data.normals, data.tex_coords, data.faces[first + i].indices);
+            }
+         });
 
       return triangles;
    }
 
-   std::vector<std::shared_ptr<GL::Mesh>> LoadTexturedMeshes(const std::string &path)
+   std::vector<GL::Geo::Triangle> LoadObject(const std::string &path)
    {
-      std::vector<std::shared_ptr<GL::Mesh>> meshes;
-      std::vector<GL::Geo::Triangle> triangles;
+      ObjData data;
+      load_object(path, data);
+      return build_triangles(data, 0, data.faces.size());
+   }
 
-      lvec3 vertices;
-      lvec3 normals;
-      lvec2 tex_coords;
+   GL::Geo::IndexedMesh LoadIndexedObject(const std::string &path)
+   {
+      ObjData data;
+      load_object(path, data);
+      return build_indexed(data, 0, data.faces.size());
+   }
 
-      std::fstream file(path, std::ios::in);
-      if (!file.is_open())
-         throw GL::Exception(join("Failed to open OBJ: ", path));
+   GL::Geo::IndexedMesh IndexTriangles(const std::vector<GL::Geo::Triangle> &triangles)
+   {
+      GL::Geo::IndexedMesh mesh;
+      mesh.indices.reserve(3 * triangles.size());
 
-      std::string directory = path;
-      auto itr = directory.find_last_of("/\\");
-      if (itr != std::string::npos)
-         directory = directory.substr(0, itr + 1);
-      else
-         directory = "";
+      VertexDedup<GL::Geo::Coord, CoordHash> dedup(triangles.size());
+      for (auto tri = std::begin(triangles); tri != std::end(triangles); ++tri)
+      {
+         for (unsigned i = 0; i < 3; i++)
+         {
+            bool inserted;
+            uint32_t id = dedup.insert(tri->coord[i], inserted);
+            if (inserted)
+               mesh.vertices.push_back(tri->coord[i]);
+            mesh.indices.push_back(id);
+         }
+      }
 
-      std::string current_material;
-      std::map<std::string, std::shared_ptr<GL::Texture>> tex_map;
+      return mesh;
+   }
+
+   std::vector<ObjectGroup> LoadObjectGroups(const std::string &path, bool optimize)
+   {
+      std::vector<ObjectGroup> groups;
+
+      ObjData data;
+      load_object(path, data);
+
+      // Faces before the first texture directive are untextured.
+      size_t num_groups = data.groups.size();
+      for (size_t i = 0; i <= num_groups; i++)
+      {
+         size_t first = i ? data.groups[i - 1].first_face : 0;
+         size_t last = i < num_groups ? data.groups[i].first_face : data.faces.size();
+         if (first == last)
+            continue;
+
+         groups.push_back(ObjectGroup());
+         if (i > 0)
+            groups.back().texture = data.groups[i - 1].material;
+         groups.back().mesh = build_indexed(data, first, last);
+      }
 
-      while (!file.eof())
+      if (optimize)
       {
-         char buf_[256];
-         file.getline(buf_, sizeof(buf_));
-         if (file.bad())
-            throw GL::Exception("Failed to load object!");
+         ParallelFor(groups.size(), 1, [&groups](size_t begin, size_t end) {
+               for (size_t i = begin; i < end; i++)
+                  OptimizeMesh(groups[i].mesh);
+            });
+      }
 
-         std::string buf(buf_);
+      return groups;
+   }
+
+   TextureAtlas PackTextureAtlas(std::vector<ObjectGroup> &groups,
+         unsigned max_tile, unsigned max_size, unsigned padding)
+   {
+      TextureAtlas atlas;
 
-         if (std::strstr(buf.c_str(), "texture") == buf.c_str())
+      // Tiles are clamped at their edges, so repeating UVs can't be packed.
+      std::map<std::string, std::vector<unsigned>> users;
+      for (unsigned i = 0; i < groups.size(); i++)
+      {
+         if (groups[i].texture.empty())
+            continue;
+
+         const auto &vertices = groups[i].mesh.vertices;
+         bool unit = std::all_of(std::begin(vertices), std::end(vertices),
+               [](const GL::Geo::Coord &coord) {
+                  return coord.tex[0] >= 0.0f && coord.tex[0] <= 1.0f &&
+                     coord.tex[1] >= 0.0f && coord.tex[1] <= 1.0f;
+               });
+         if (unit)
+            users[groups[i].texture].push_back(i);
+      }
+
+      std::vector<Image> images;
+      std::vector<const std::vector<unsigned>*> image_users;
+      for (auto user = std::begin(users); user != std::end(users); ++user)
+      {
+         // Textures too large to pack are left for Texture to load, so only
+         // their header is read here.
+         MappedFile file(user->first);
+         auto data = reinterpret_cast<const uint8_t*>(file.data());
+         TGAHeader header = ParseTGAHeader(data, file.size(), file.size());
+         if (header.width > max_tile || header.height > max_tile)
+            continue;
+
+         images.push_back(DecodeTGA(data, file.size()));
+         image_users.push_back(&user->second);
+      }
+
+      if (images.size() < 2)
+         return atlas;
+
+      std::vector<const Image*> packing;
+      for (auto image = std::begin(images); image != std::end(images); ++image)
+         packing.push_back(&*image);
+
+      Image page;
+      auto tiles = PackAtlas(packing, padding, max_size, page);
+      for (unsigned i = 0; i < tiles.size(); i++)
+      {
+         const AtlasTile &tile = tiles[i];
+         if (!tile.width)
+            continue;
+
+         float scale[2] = { float(tile.width) / page.width, float(tile.height) / page.height };
+         float offset[2] = { float(tile.x) / page.width, float(tile.y) / page.height };
+         for (auto group = std::begin(*image_users[i]); group != std::end(*image_users[i]); ++group)
          {
-            if (triangles.size() > 0)
+            auto &vertices = groups[*group].mesh.vertices;
+            for (auto coord = std::begin(vertices); coord != std::end(vertices); ++coord)
             {
-               meshes.push_back(std::make_shared<GL::Mesh>(triangles));
-               if (current_material.size() > 0)
-               {
-                  auto ptr = tex_map[current_material];
-                  if (ptr)
-                     meshes.back()->set_texture(ptr);
-                  else
-                  {
-                     auto tex = std::make_shared<GL::Texture>(current_material);
-                     meshes.back()->set_texture(tex);
-                     tex_map[current_material] = tex;
-                  }
-               }
-
-               triangles.clear();
+               coord->tex[0] = coord->tex[0] * scale[0] + offset[0];
+               coord->tex[1] = coord->tex[1] * scale[1] + offset[1];
             }
+            atlas.groups.push_back(*group);
+         }
+      }
+
+      if (atlas.groups.empty())
+         return atlas;
+      std::sort(std::begin(atlas.groups), std::end(atlas.groups));
+
+      // Level k has padding >> k texels around each tile.
+      unsigned levels = 1;
+      while ((padding >> levels) > 0)
+         levels++;
+
+      atlas.levels = GenerateMipmaps(std::move(page));
+      if (atlas.levels.size() > levels)
+         atlas.levels.resize(levels);
+
+      return atlas;
+   }
+
+   // Textures built in memory can't be compressed, streamed or budgeted.
+   static bool can_pack(bool pack_atlas)
+   {
+      return pack_atlas && GL::Texture::get_compression() == BlockNone && !GL::Texture::get_streamer();
+   }
 
-            current_material = directory;
-            auto path = buf.substr(buf.find_last_of(' ') + 1);
-            path = path.substr(0, path.find_last_of('\r'));
-            current_material += path;
-            current_material += ".tga";
+   std::vector<std::shared_ptr<GL::Mesh>> LoadTexturedMeshes(const std::string &path,
+         bool optimize, bool pack_atlas)
+   {
+      std::vector<std::shared_ptr<GL::Mesh>> meshes;
+      std::map<std::string, std::shared_ptr<GL::Texture>> tex_map;
+
+      auto groups = LoadObjectGroups(path, optimize);
+      TextureAtlas atlas;
+      if (can_pack(pack_atlas))
+         atlas = PackTextureAtlas(groups);
+
+      std::vector<uint8_t> packed(groups.size());
+      if (!atlas.groups.empty())
+      {
+         // One texture, so one mesh and one draw for all of them.
+         GL::Geo::IndexedMesh merged;
+         for (auto index = std::begin(atlas.groups); index != std::end(atlas.groups); ++index)
+         {
+            const auto &mesh = groups[*index].mesh;
+            uint32_t base = merged.vertices.size();
+            merged.vertices.insert(std::end(merged.vertices),
+                  std::begin(mesh.vertices), std::end(mesh.vertices));
+            for (auto i = std::begin(mesh.indices); i != std::end(mesh.indices); ++i)
+               merged.indices.push_back(base + *i);
+            packed[*index] = 1;
          }
 
-         float elems[3];
-         size_t indices[3][3];
-         Attr attr;
-         size_t arr[3] = { vertices.size(), tex_coords.size(), normals.size() };
+         meshes.push_back(std::make_shared<GL::Mesh>(merged));
+         meshes.back()->set_texture(std::make_shared<GL::Texture>(atlas.levels));
+      }
+
+      for (auto group = std::begin(groups); group != std::end(groups); ++group)
+      {
+         if (packed[group - std::begin(groups)])
+            continue;
 
-         std::vector<char> mut_buf(buf.begin(), buf.end());
-         mut_buf.push_back('\0');
+         meshes.push_back(std::make_shared<GL::Mesh>(group->mesh));
 
-         if (get_attr(mut_buf.data(), attr, elems, indices, arr))
+         const std::string &current_material = group->texture;
+         if (current_material.empty())
+            continue;
+
+         auto ptr = tex_map[current_material];
+         if (ptr)
+            meshes.back()->set_texture(ptr);
+         else
          {
-            switch (attr)
-            {
-               case Vertex:
-               {
-                  std::array<float, 3> arr;
-                  for (unsigned i = 0; i < 3; i++)
-                     arr[i] = elems[i];
-                  vertices.push_back(arr);
-                  break;
-               }
+            auto tex = GL::TextureCache::load(current_material);
+            meshes.back()->set_texture(tex);
+            tex_map[current_material] = tex;
+         }
+      }
 
-               case Texture:
-               {
-                  std::array<float, 2> arr;
-                  for (unsigned i = 0; i < 2; i++)
-                     arr[i] = elems[i];
-                  tex_coords.push_back(arr);
-                  break;
-               }
+      return meshes;
+   }
 
-               case Normal:
-               {
-                  std::array<float, 3> arr;
-                  for (unsigned i = 0; i < 3; i++)
-                     arr[i] = elems[i];
-                  normals.push_back(arr);
-                  break;
-               }
+   std::vector<std::shared_ptr<GL::MeshBatch>> LoadBatchedMeshes(const std::string &path,
+         bool optimize, bool pack_atlas)
+   {
+      std::vector<std::shared_ptr<GL::MeshBatch>> batches;
+      std::map<std::string, std::shared_ptr<GL::MeshBatch>> batch_map;
 
-               case Elem:
-                  triangles.push_back(triangle_from_indices(vertices, normals, tex_coords, indices));
-                  break;
+      auto groups = LoadObjectGroups(path, optimize);
+      TextureAtlas atlas;
+      if (can_pack(pack_atlas))
+         atlas = PackTextureAtlas(groups);
 
-               default:
-                  break;
-            }
+      std::vector<uint8_t> packed(groups.size());
+      if (!atlas.groups.empty())
+      {
+         auto batch = std::make_shared<GL::MeshBatch>();
+         batch->set_texture(std::make_shared<GL::Texture>(atlas.levels));
+         for (auto index = std::begin(atlas.groups); index != std::end(atlas.groups); ++index)
+         {
+            batch->add(groups[*index].mesh);
+            packed[*index] = 1;
          }
+         batches.push_back(batch);
       }
 
-      if (triangles.size() > 0)
+      for (auto group = std::begin(groups); group != std::end(groups); ++group)
       {
-         meshes.push_back(std::make_shared<GL::Mesh>(triangles));
-         if (current_material.size() > 0)
+         if (packed[group - std::begin(groups)])
+            continue;
+
+         auto &batch = batch_map[group->texture];
+         if (!batch)
          {
-            auto ptr = tex_map[current_material];
-            if (ptr)
-               meshes.back()->set_texture(ptr);
-            else
-            {
-               auto tex = std::make_shared<GL::Texture>(current_material);
-               meshes.back()->set_texture(tex);
-               tex_map[current_material] = tex;
-            }
+            batch = std::make_shared<GL::MeshBatch>();
+            if (!group->texture.empty())
+               batch->set_texture(GL::TextureCache::load(group->texture));
+            batches.push_back(batch);
          }
+
+         batch->add(group->mesh);
       }
 
-      return meshes;
+      return batches;
    }
 }
@@ -4,12 +4,49 @@
 #include "gl.hpp"
 #include "structure.hpp"
 #include "mesh.hpp"
+#include "mesh_batch.hpp"
+#include "image.hpp"
 #include <vector>
 
 namespace GLU
 {
    std::vector<GL::Geo::Triangle> LoadObject(const std::string &path);
-   std::vector<std::shared_ptr<GL::Mesh>> LoadTexturedMeshes(const std::string &path);
+   GL::Geo::IndexedMesh LoadIndexedObject(const std::string &path);
+   GL::Geo::IndexedMesh IndexTriangles(const std::vector<GL::Geo::Triangle> &triangles);
+
+   // Faces sharing a texture directive.
+   // texture is empty for faces preceding the first directive.
+   struct ObjectGroup
+   {
+      std::string texture;
+      GL::Geo::IndexedMesh mesh;
+   };
+
+   struct TextureAtlas
+   {
+      // Box filtered and cut off where the tiles' padding runs out.
+      std::vector<Image> levels;
+      // Indices of the groups now textured by the atlas, ascending.
+      std::vector<unsigned> groups;
+   };
+
+   // Packs the textures of groups that are at most max_tile pixels a side
+   // and only addressed with UVs in [0, 1] into one atlas, see PackAtlas(),
+   // and remaps the UVs of those groups. Their texture field is left as is.
+   // Packs nothing unless at least two textures qualify.
+   TextureAtlas PackTextureAtlas(std::vector<ObjectGroup> &groups,
+         unsigned max_tile = 256, unsigned max_size = 2048, unsigned padding = 8);
+
+   // optimize runs GLU::OptimizeMesh() on every group.
+   std::vector<ObjectGroup> LoadObjectGroups(const std::string &path, bool optimize = false);
+   // With pack_atlas, groups packed by PackTextureAtlas() are merged into one
+   // mesh. Packing is skipped while Texture compression or a streamer is set.
+   std::vector<std::shared_ptr<GL::Mesh>> LoadTexturedMeshes(const std::string &path,
+         bool optimize = false, bool pack_atlas = false);
+   // As LoadTexturedMeshes(), but groups sharing a texture, or the atlas,
+   // become parts of one batch.
+   std::vector<std::shared_ptr<GL::MeshBatch>> LoadBatchedMeshes(const std::string &path,
+         bool optimize = false, bool pack_atlas = false);
 }
 
 #endif
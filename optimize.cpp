@@ -0,0 +1,249 @@
+#include "optimize.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace GLU
+{
+   VertexCacheStats AnalyzeVertexCache(const std::vector<uint32_t> &indices,
+         size_t num_vertices, unsigned cache_size)
+   {
+      VertexCacheStats stats = { 0.0f, 0.0f };
+      if (indices.empty())
+         return stats;
+
+      // Timestamp of when each vertex entered the cache.
+      // A vertex is cached if it entered less than cache_size misses ago.
+      std::vector<size_t> entered(num_vertices, 0);
+      std::vector<bool> used(num_vertices, false);
+      size_t misses = 0;
+      size_t unique = 0;
+
+      for (auto itr = std::begin(indices); itr != std::end(indices); ++itr)
+      {
+         uint32_t index = *itr;
+         if (!used[index])
+         {
+            used[index] = true;
+            unique++;
+         }
+         else if (misses - entered[index] < cache_size)
+            continue;
+
+         entered[index] = misses;
+         misses++;
+      }
+
+      stats.acmr = static_cast<float>(misses) / (indices.size() / 3);
+      stats.atvr = static_cast<float>(misses) / unique;
+      return stats;
+   }
+
+   namespace
+   {
+      enum { max_cache_size = 32 };
+
+      const float cache_decay_power = 1.5f;
+      const float last_tri_score = 0.75f;
+      const float valence_boost_scale = 2.0f;
+      const float valence_boost_power = 0.5f;
+
+      struct VertexScore
+      {
+         float cache[max_cache_size];
+         float valence[64];
+
+         VertexScore()
+         {
+            for (unsigned i = 0; i < max_cache_size; i++)
+            {
+               if (i < 3)
+                  cache[i] = last_tri_score;
+               else
+               {
+                  float scaler = 1.0f / (max_cache_size - 3);
+                  cache[i] = std::pow(1.0f - (i - 3) * scaler, cache_decay_power);
+               }
+            }
+
+            for (unsigned i = 0; i < 64; i++)
+               valence[i] = valence_boost_scale * std::pow(static_cast<float>(i), -valence_boost_power);
+            valence[0] = 0.0f;
+         }
+
+         float operator()(int cache_pos, unsigned live_tris) const
+         {
+            if (live_tris == 0)
+               return -1.0f;
+
+            float score = cache_pos >= 0 ? cache[cache_pos] : 0.0f;
+            if (live_tris < 64)
+               score += valence[live_tris];
+            else
+               score += valence_boost_scale * std::pow(static_cast<float>(live_tris), -valence_boost_power);
+            return score;
+         }
+      };
+   }
+
+   void OptimizeVertexCache(GL::Geo::IndexedMesh &mesh)
+   {
+      static const VertexScore vertex_score;
+
+      const std::vector<uint32_t> &indices = mesh.indices;
+      size_t num_tris = indices.size() / 3;
+      size_t num_vertices = mesh.vertices.size();
+      if (num_tris == 0)
+         return;
+
+      // Triangle adjacency per vertex.
+      std::vector<unsigned> live_tris(num_vertices, 0);
+      for (auto itr = std::begin(indices); itr != std::end(indices); ++itr)
+         live_tris[*itr]++;
+
+      std::vector<size_t> adjacency_offset(num_vertices + 1, 0);
+      for (size_t i = 0; i < num_vertices; i++)
+         adjacency_offset[i + 1] = adjacency_offset[i] + live_tris[i];
+
+      std::vector<uint32_t> adjacency(indices.size());
+      {
+         std::vector<size_t> fill(adjacency_offset.begin(), adjacency_offset.end() - 1);
+         for (size_t i = 0; i < indices.size(); i++)
+            adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+      }
+
+      std::vector<int> cache_pos(num_vertices, -1);
+      std::vector<float> score(num_vertices);
+      for (size_t i = 0; i < num_vertices; i++)
+         score[i] = vertex_score(-1, live_tris[i]);
+
+      std::vector<bool> emitted(num_tris, false);
+      size_t best_tri = 0;
+      float best_score = -1.0f;
+      for (size_t i = 0; i < num_tris; i++)
+      {
+         float s = score[indices[3 * i + 0]] + score[indices[3 * i + 1]] + score[indices[3 * i + 2]];
+         if (s > best_score)
+         {
+            best_score = s;
+            best_tri = i;
+         }
+      }
+
+      std::vector<uint32_t> out;
+      out.reserve(indices.size());
+
+      uint32_t cache[max_cache_size + 3];
+      unsigned cache_count = 0;
+
+      size_t scan_pos = 0;
+
+      for (size_t emitted_tris = 0; emitted_tris < num_tris; emitted_tris++)
+      {
+         if (best_tri == num_tris)
+         {
+            // Nothing in the cache touches a live triangle, fall back to a linear scan.
+            while (emitted[scan_pos])
+               scan_pos++;
+            best_tri = scan_pos;
+         }
+
+         emitted[best_tri] = true;
+
+         // Push the triangle's vertices to the front of the LRU cache.
+         uint32_t new_cache[max_cache_size + 3];
+         unsigned new_count = 0;
+         for (unsigned i = 0; i < 3; i++)
+         {
+            uint32_t v = indices[3 * best_tri + i];
+            out.push_back(v);
+            if (std::find(new_cache, new_cache + new_count, v) == new_cache + new_count)
+               new_cache[new_count++] = v;
+
+            // Remove triangle from the vertex' live list.
+            uint32_t *adj = &adjacency[adjacency_offset[v]];
+            unsigned count = live_tris[v];
+            for (unsigned j = 0; j < count; j++)
+            {
+               if (adj[j] == best_tri)
+               {
+                  adj[j] = adj[count - 1];
+                  break;
+               }
+            }
+            live_tris[v]--;
+         }
+
+         unsigned tri_count = new_count;
+         for (unsigned i = 0; i < cache_count; i++)
+         {
+            uint32_t v = cache[i];
+            if (std::find(new_cache, new_cache + tri_count, v) == new_cache + tri_count)
+               new_cache[new_count++] = v;
+         }
+
+         // Vertices which fell out of the cache.
+         for (unsigned i = max_cache_size; i < new_count; i++)
+         {
+            cache_pos[new_cache[i]] = -1;
+            score[new_cache[i]] = vertex_score(-1, live_tris[new_cache[i]]);
+         }
+
+         cache_count = std::min(new_count, static_cast<unsigned>(max_cache_size));
+         std::copy(new_cache, new_cache + cache_count, cache);
+
+         for (unsigned i = 0; i < cache_count; i++)
+         {
+            cache_pos[cache[i]] = i;
+            score[cache[i]] = vertex_score(i, live_tris[cache[i]]);
+         }
+
+         // Rescore triangles touched by the cache and pick the best one.
+         best_tri = num_tris;
+         best_score = -1.0f;
+         for (unsigned i = 0; i < cache_count; i++)
+         {
+            uint32_t v = cache[i];
+            const uint32_t *adj = &adjacency[adjacency_offset[v]];
+            for (unsigned j = 0; j < live_tris[v]; j++)
+            {
+               uint32_t tri = adj[j];
+               float s = score[indices[3 * tri + 0]] + score[indices[3 * tri + 1]] + score[indices[3 * tri + 2]];
+               if (s > best_score)
+               {
+                  best_score = s;
+                  best_tri = tri;
+               }
+            }
+         }
+      }
+
+      mesh.indices.swap(out);
+   }
+
+   void OptimizeVertexFetch(GL::Geo::IndexedMesh &mesh)
+   {
+      static const uint32_t unused = ~0u;
+      std::vector<uint32_t> remap(mesh.vertices.size(), unused);
+      std::vector<GL::Geo::Coord> vertices;
+      vertices.reserve(mesh.vertices.size());
+
+      for (auto itr = std::begin(mesh.indices); itr != std::end(mesh.indices); ++itr)
+      {
+         uint32_t &index = remap[*itr];
+         if (index == unused)
+         {
+            index = static_cast<uint32_t>(vertices.size());
+            vertices.push_back(mesh.vertices[*itr]);
+         }
+         *itr = index;
+      }
+
+      mesh.vertices.swap(vertices);
+   }
+
+   void OptimizeMesh(GL::Geo::IndexedMesh &mesh)
+   {
+      OptimizeVertexCache(mesh);
+      OptimizeVertexFetch(mesh);
+   }
+}
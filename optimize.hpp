@@ -0,0 +1,36 @@
+#ifndef OPTIMIZE_HPP__
+#define OPTIMIZE_HPP__
+
+#include "gl.hpp"
+#include "structure.hpp"
+#include <vector>
+#include <stdint.h>
+
+namespace GLU
+{
+   struct VertexCacheStats
+   {
+      // Average cache miss ratio. Vertex shader invocations per triangle.
+      // 3.0 is the worst case, ~0.5 the best case for regular meshes.
+      float acmr;
+      // Average transform to vertex ratio. 1.0 is optimal.
+      float atvr;
+   };
+
+   // Simulates a FIFO post-transform cache with cache_size entries.
+   VertexCacheStats AnalyzeVertexCache(const std::vector<uint32_t> &indices,
+         size_t num_vertices, unsigned cache_size = 16);
+
+   // Reorders triangles for post-transform cache reuse (Forsyth's
+   // linear-speed vertex cache optimisation).
+   void OptimizeVertexCache(GL::Geo::IndexedMesh &mesh);
+
+   // Reorders vertices in order of first use so the vertex buffer is
+   // fetched linearly. Unreferenced vertices are dropped.
+   void OptimizeVertexFetch(GL::Geo::IndexedMesh &mesh);
+
+   // OptimizeVertexCache() followed by OptimizeVertexFetch().
+   void OptimizeMesh(GL::Geo::IndexedMesh &mesh);
+}
+
+#endif
@@ -0,0 +1,239 @@
+#include "render_queue.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace GL
+{
+   RenderQueue::RenderQueue() : passes(max_passes)
+   {
+      for (auto pass = std::begin(passes); pass != std::end(passes); ++pass)
+      {
+         pass->cull = false;
+         pass->stats.drawn = 0;
+         pass->stats.culled = 0;
+      }
+   }
+
+   void RenderQueue::set_pass(unsigned pass,
+         std::function<void ()> begin, std::function<void ()> end)
+   {
+      if (pass >= max_passes)
+         throw Exception("Render pass out of bounds ...\n");
+
+      passes[pass].begin = begin;
+      passes[pass].end = end;
+   }
+
+   void RenderQueue::set_frustum(unsigned pass, const GLU::Frustum &frustum)
+   {
+      if (pass >= max_passes)
+         throw Exception("Render pass out of bounds ...\n");
+
+      passes[pass].cull = true;
+      passes[pass].frustum = frustum;
+   }
+
+   void RenderQueue::disable_culling(unsigned pass)
+   {
+      if (pass >= max_passes)
+         throw Exception("Render pass out of bounds ...\n");
+
+      passes[pass].cull = false;
+   }
+
+   RenderQueue::PassStats RenderQueue::stats(unsigned pass) const
+   {
+      if (pass >= max_passes)
+         throw Exception("Render pass out of bounds ...\n");
+
+      return passes[pass].stats;
+   }
+
+   unsigned RenderQueue::program_index(const std::shared_ptr<Program> &program)
+   {
+      auto itr = std::find(std::begin(programs), std::end(programs), program);
+      if (itr != std::end(programs))
+         return itr - std::begin(programs);
+
+      if (programs.size() >= max_programs)
+         throw Exception("Too many programs in render queue ...\n");
+
+      Mesh::prepare_shader(program);
+      programs.push_back(program);
+      return programs.size() - 1;
+   }
+
+   uint64_t RenderQueue::sort_key(unsigned pass, unsigned program,
+         GLuint texture, float depth, GLuint vao)
+   {
+      // Non-negative floats order the same as their bit patterns, and
+      // with the sign bit clear the top 16 bits fit in bits 15-30.
+      if (!(depth > 0.0f))
+         depth = 0.0f;
+      uint32_t depth_bits;
+      std::memcpy(&depth_bits, &depth, sizeof(depth_bits));
+
+      return (uint64_t(pass & 0xf) << 60) |
+         (uint64_t(program & 0xfff) << 48) |
+         (uint64_t(texture & 0xffff) << 32) |
+         (uint64_t((depth_bits >> 15) & 0xffff) << 16) |
+         uint64_t(vao & 0xffff);
+   }
+
+   void RenderQueue::push(unsigned pass, const std::shared_ptr<Program> &program,
+         Mesh &mesh)
+   {
+      if (pass >= max_passes)
+         throw Exception("Render pass out of bounds ...\n");
+
+      if (passes[pass].cull)
+      {
+         passes[pass].bounds.push_back(mesh.world_bounds());
+         passes[pass].pending.push_back(packets.size());
+      }
+      passes[pass].stats.drawn++;
+
+      Packet packet;
+      packet.key = sort_key(pass, program_index(program),
+            mesh.texture_object(), mesh.view_depth(), mesh.vao_object());
+      packet.index = meshes.size();
+
+      packets.push_back(packet);
+      meshes.push_back(&mesh);
+   }
+
+   void RenderQueue::RadixSort(std::vector<Packet> &packets,
+         std::vector<Packet> &scratch)
+   {
+      enum { rounds = 8, buckets = 256 };
+
+      // All histograms in one read of the input.
+      std::vector<size_t> counts(rounds * buckets);
+      for (auto packet = std::begin(packets); packet != std::end(packets); ++packet)
+      {
+         uint64_t key = packet->key;
+         for (unsigned r = 0; r < rounds; r++)
+            counts[r * buckets + ((key >> (8 * r)) & 0xff)]++;
+      }
+
+      scratch.resize(packets.size());
+      Packet *src = packets.data();
+      Packet *dst = scratch.data();
+      for (unsigned r = 0; r < rounds; r++)
+      {
+         size_t *count = &counts[r * buckets];
+         uint64_t digit = (packets.empty() ? 0 : (src[0].key >> (8 * r)) & 0xff);
+         if (count[digit] == packets.size())
+            continue;
+
+         size_t offset = 0;
+         for (unsigned i = 0; i < buckets; i++)
+         {
+            size_t tmp = count[i];
+            count[i] = offset;
+            offset += tmp;
+         }
+
+         for (size_t i = 0; i < packets.size(); i++)
+            dst[count[(src[i].key >> (8 * r)) & 0xff]++] = src[i];
+
+         std::swap(src, dst);
+      }
+
+      if (src != packets.data())
+         packets.swap(scratch);
+   }
+
+   void RenderQueue::cull()
+   {
+      bool culled = false;
+      for (auto pass = std::begin(passes); pass != std::end(passes); ++pass)
+      {
+         if (pass->pending.empty())
+            continue;
+
+         if (!culled)
+            keep.assign(packets.size(), 1);
+         culled = true;
+
+         visible.resize(pass->bounds.size());
+         GLU::CullBounds(pass->frustum, pass->bounds, visible.data());
+
+         for (size_t i = 0; i < pass->pending.size(); i++)
+         {
+            if (visible[i])
+               continue;
+
+            keep[pass->pending[i]] = 0;
+            pass->stats.drawn--;
+            pass->stats.culled++;
+         }
+
+         pass->bounds.clear();
+         pass->pending.clear();
+      }
+
+      if (!culled)
+         return;
+
+      packets.erase(std::remove_if(std::begin(packets), std::end(packets),
+               [this](const Packet &packet) { return !keep[packet.index]; }),
+            std::end(packets));
+   }
+
+   void RenderQueue::sort()
+   {
+      cull();
+      RadixSort(packets, scratch);
+   }
+
+   void RenderQueue::execute()
+   {
+      auto packet = std::begin(packets);
+      for (unsigned pass = 0; pass < max_passes; pass++)
+      {
+         bool active = passes[pass].begin || passes[pass].end;
+         if (!active && (packet == std::end(packets) || (packet->key >> 60) != pass))
+            continue;
+
+         if (passes[pass].begin)
+            passes[pass].begin();
+
+         unsigned program = ~0u;
+         for (; packet != std::end(packets) && (packet->key >> 60) == pass; ++packet)
+         {
+            unsigned index = (packet->key >> 48) & 0xfff;
+            if (index != program)
+            {
+               program = index;
+               Mesh::use_shader(programs[program]);
+            }
+
+            meshes[packet->index]->render();
+         }
+
+         if (passes[pass].end)
+            passes[pass].end();
+      }
+   }
+
+   void RenderQueue::clear()
+   {
+      packets.clear();
+      meshes.clear();
+      programs.clear();
+
+      for (auto pass = std::begin(passes); pass != std::end(passes); ++pass)
+      {
+         pass->stats.drawn = 0;
+         pass->stats.culled = 0;
+         pass->bounds.clear();
+         pass->pending.clear();
+      }
+   }
+
+   size_t RenderQueue::size() const
+   {
+      return packets.size();
+   }
+}
@@ -0,0 +1,103 @@
+#ifndef RENDER_QUEUE_HPP__
+#define RENDER_QUEUE_HPP__
+
+#include "gl.hpp"
+#include "shader.hpp"
+#include "mesh.hpp"
+#include "cull.hpp"
+#include <vector>
+#include <functional>
+#include <stdint.h>
+
+namespace GL
+{
+   // Collects draws for a frame, sorts them once and submits them
+   // grouped by pass, program and texture so State elides most binds.
+   //
+   // Key layout, most significant bits first:
+   // pass (4) | program (12) | texture (16) | depth (16) | VAO (16)
+   //
+   // Texture and VAO fields hold the low 16 bits of the GL names.
+   // They only affect order, the packet still draws with the mesh's own state.
+   class RenderQueue
+   {
+      public:
+         enum { max_passes = 16, max_programs = 4096 };
+
+         RenderQueue();
+
+         // begin() runs before the first packet of the pass and end() after
+         // the last one. Both run even if the pass has no packets.
+         void set_pass(unsigned pass,
+               std::function<void ()> begin,
+               std::function<void ()> end = std::function<void ()>());
+
+         // Meshes pushed to the pass afterwards are dropped by sort() if
+         // their world bounds are outside frustum. Kept until changed or disabled.
+         void set_frustum(unsigned pass, const GLU::Frustum &frustum);
+         void disable_culling(unsigned pass);
+
+         // The mesh must outlive the next execute().
+         void push(unsigned pass, const std::shared_ptr<Program> &program,
+               Mesh &mesh);
+
+         void sort();
+         void execute();
+         void clear();
+         size_t size() const;
+
+         // Meshes pushed since the last clear(). Culled meshes are counted by sort().
+         struct PassStats
+         {
+            unsigned drawn;
+            unsigned culled;
+         };
+         PassStats stats(unsigned pass) const;
+
+         struct Packet
+         {
+            uint64_t key;
+            uint32_t index;
+         };
+
+         static uint64_t sort_key(unsigned pass, unsigned program,
+               GLuint texture, float depth, GLuint vao);
+
+         // Stable LSD radix sort on Packet::key, 8 bits per round.
+         // Rounds where every key has the same digit are skipped.
+         // scratch is resized as needed and can be reused between calls.
+         static void RadixSort(std::vector<Packet> &packets,
+               std::vector<Packet> &scratch);
+
+      private:
+         void operator=(const RenderQueue&);
+         RenderQueue(const RenderQueue&);
+
+         struct Pass
+         {
+            std::function<void ()> begin;
+            std::function<void ()> end;
+
+            bool cull;
+            GLU::Frustum frustum;
+            PassStats stats;
+
+            // World bounds of the packets at these indices, tested together.
+            GLU::BoundsArray bounds;
+            std::vector<uint32_t> pending;
+         };
+         std::vector<Pass> passes;
+
+         std::vector<std::shared_ptr<Program>> programs;
+         std::vector<Packet> packets;
+         std::vector<Packet> scratch;
+         std::vector<Mesh*> meshes;
+         std::vector<uint8_t> visible;
+         std::vector<uint8_t> keep;
+
+         unsigned program_index(const std::shared_ptr<Program> &program);
+         void cull();
+   };
+}
+
+#endif
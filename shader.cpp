@@ -1,6 +1,8 @@
 #include "shader.hpp"
 #include "utils.hpp"
+#include "state.hpp"
 #include <iostream>
+#include <algorithm>
 
 namespace GL
 {
@@ -79,7 +81,7 @@ namespace GL
       if (!m_linked)
          throw Exception("Program is not linked!\n");
 
-      GLSYM(glUseProgram)(program);
+      State::use_program(program);
    }
 
    void Program::link()
@@ -93,6 +95,9 @@ namespace GL
       if (status != GL_TRUE)
          throw ShaderException(program);
 
+      introspect_uniforms();
+      introspect_blocks();
+
       //GLSYM(glValidateProgram)(program);
       //GLSYM(glGetProgramiv)(program, GL_VALIDATE_STATUS, &status);
       //if (status != GL_TRUE)
@@ -127,16 +132,119 @@ namespace GL
       {
          for (auto shader = std::begin(shaders); shader != std::end(shaders); ++shader)
             GLSYM(glDetachShader)(program, (*shader)->object());
+         State::deleted_program(program);
          GLSYM(glDeleteProgram)(program);
       }
    }
 
+   void Program::introspect_uniforms()
+   {
+      uniforms.clear();
+      key_locations.clear();
+
+      GLint count = 0, max_len = 0;
+      GLSYM(glGetProgramiv)(program, GL_ACTIVE_UNIFORMS, &count);
+      GLSYM(glGetProgramiv)(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_len);
+
+      std::vector<GLchar> buf(max_len + 1);
+      for (GLint i = 0; i < count; i++)
+      {
+         GLsizei len = 0;
+         GLint size;
+         GLenum type;
+         GLSYM(glGetActiveUniform)(program, i, static_cast<GLsizei>(buf.size()), &len, &size, &type, &buf[0]);
+
+         std::string name(&buf[0], len);
+         GLint location = GLSYM(glGetUniformLocation)(program, name.c_str());
+         if (location < 0) // Uniform block members.
+            continue;
+
+         uniforms[name] = location;
+
+         // Arrays are reported as "name[0]", but are looked up as "name"
+         // and "name[i]" as well.
+         if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+         {
+            std::string base = name.substr(0, name.size() - 3);
+            uniforms[base] = location;
+
+            for (GLint j = 1; j < size; j++)
+            {
+               std::string element = GLU::join(base, "[", j, "]");
+               GLint loc = GLSYM(glGetUniformLocation)(program, element.c_str());
+               if (loc >= 0)
+                  uniforms[element] = loc;
+            }
+         }
+      }
+   }
+
+   void Program::introspect_blocks()
+   {
+      blocks.clear();
+      block_bindings.clear();
+
+      GLint count = 0, max_len = 0;
+      GLSYM(glGetProgramiv)(program, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+      GLSYM(glGetProgramiv)(program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &max_len);
+
+      std::vector<GLchar> buf(max_len + 1);
+      for (GLint i = 0; i < count; i++)
+      {
+         GLsizei len = 0;
+         GLSYM(glGetActiveUniformBlockName)(program, i, static_cast<GLsizei>(buf.size()), &len, &buf[0]);
+         blocks[std::string(&buf[0], len)] = i;
+      }
+
+      // Blocks start out bound to point 0.
+      block_bindings.assign(count, 0);
+   }
+
+   std::vector<std::string>& Program::key_names()
+   {
+      static std::vector<std::string> names;
+      return names;
+   }
+
+   Program::UniformKey Program::uniform_key(const std::string &name)
+   {
+      auto &names = key_names();
+      auto itr = std::find(std::begin(names), std::end(names), name);
+      if (itr != std::end(names))
+         return static_cast<UniformKey>(itr - std::begin(names));
+
+      names.push_back(name);
+      return static_cast<UniformKey>(names.size() - 1);
+   }
+
+   GLint Program::uniform(UniformKey key) const
+   {
+      if (key < key_locations.size())
+         return key_locations[key];
+
+      if (!m_linked)
+         throw Exception("Program not linked.\n");
+
+      auto &names = key_names();
+      while (key_locations.size() < names.size())
+         key_locations.push_back(uniform(names[key_locations.size()]));
+
+      return key_locations[key];
+   }
+
    GLint Program::uniform(const std::string &key) const
    {
       if (!m_linked)
          throw Exception("Program not linked.\n");
 
-      return GLSYM(glGetUniformLocation)(program, key.c_str());
+      auto itr = uniforms.find(key);
+      if (itr != std::end(uniforms))
+         return itr->second;
+
+      // Struct members and the like are not all listed as active uniforms.
+      GLint location = GLSYM(glGetUniformLocation)(program, key.c_str());
+      uniforms[key] = location;
+      return location;
    }
 
    GLuint Program::uniform_block_index(const std::string &key) const
@@ -144,7 +252,8 @@ namespace GL
       if (!m_linked)
          throw Exception("Program not linked.\n");
 
-      return GLSYM(glGetUniformBlockIndex)(program, key.c_str());
+      auto itr = blocks.find(key);
+      return itr != std::end(blocks) ? itr->second : GL_INVALID_INDEX;
    }
 
    void Program::uniform_block_binding(unsigned block, unsigned index)
@@ -152,6 +261,13 @@ namespace GL
       if (!m_linked)
          throw Exception("Program not linked.\n");
 
+      if (block < block_bindings.size())
+      {
+         if (block_bindings[block] == index)
+            return;
+         block_bindings[block] = index;
+      }
+
       GLSYM(glUniformBlockBinding)(program, block, index);
    }
 
@@ -164,6 +280,6 @@ namespace GL
 
    void Program::unbind()
    {
-      GLSYM(glUseProgram)(0);
+      State::use_program(0);
    }
 }
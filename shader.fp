@@ -9,12 +9,16 @@ in vec2 tex_coord;
 #define SHADOW_MAP_SIZE 1024.0
 
 #define MAX_LIGHTS 8
-uniform vec3 light_ambient;
-uniform vec3 player_pos;
-uniform vec3 lights_pos[MAX_LIGHTS];
-uniform vec3 lights_color[MAX_LIGHTS];
-uniform ivec2 viewport_size;
-uniform int lights_count;
+// Shared by every mesh, uploaded once per frame. See Mesh::SceneBlock.
+layout(std140) uniform Scene
+{
+   vec4 lights_pos[MAX_LIGHTS];
+   vec4 lights_color[MAX_LIGHTS];
+   vec4 light_ambient;
+   vec4 player_pos;
+   ivec2 viewport_size;
+   int lights_count;
+};
 layout(binding = 0) uniform sampler2D texture;
 layout(binding = 1) uniform sampler2D shadow_texture0;
 
@@ -31,7 +35,7 @@ vec3 apply_light(vec3 pos, vec3 color, float diffuse_coeff, float specular_coeff
    float distance_correction = inversesqrt(dot(distance, distance));
 
    // Specular
-   vec3 eye_vec = normalize(player_pos - model_vector);
+   vec3 eye_vec = normalize(player_pos.xyz - model_vector);
    vec3 reflected = reflect(light_direction, normal);
    vec3 specular = pow(colorconv(specular_coeff * dot(eye_vec, reflected) * color * distance_correction), vec3(1.5));
 
@@ -58,7 +62,7 @@ void main()
    if (tex.a < 0.5)
       discard;
 
-   vec3 result0 = lights_count >= 1 ? apply_light(lights_pos[0], lights_color[0], 30.0, 12.0) : vec3(0.0);
+   vec3 result0 = lights_count >= 1 ? apply_light(lights_pos[0].xyz, lights_color[0].xyz, 30.0, 12.0) : vec3(0.0);
    vec2 shadow = vec2(gl_FragCoord.xy) / vec2(viewport_size);
 
    float shadow_factor0 = 0.0;
@@ -75,7 +79,7 @@ void main()
 
    shadow_factor0 /= filt_max;
 
-   out_color = vec4(tex.rgb * (light_ambient +
+   out_color = vec4(tex.rgb * (light_ambient.rgb +
       result0 * shadow_factor0),
       tex.a);
 }
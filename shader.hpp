@@ -3,6 +3,7 @@
 
 #include "gl.hpp"
 #include <vector>
+#include <map>
 #include "utils.hpp"
 
 namespace GL
@@ -51,6 +52,12 @@ namespace GL
          GLuint object() const;
          bool linked() const;
 
+         // Interned uniform name. Resolve once with uniform_key() and use
+         // uniform(UniformKey) on hot paths. It never queries the driver.
+         typedef unsigned UniformKey;
+         static UniformKey uniform_key(const std::string &name);
+
+         GLint uniform(UniformKey key) const;
          GLint uniform(const std::string &key) const;
          GLuint uniform_block_index(const std::string &key) const;
          void uniform_block_binding(unsigned block, unsigned index);
@@ -60,7 +67,8 @@ namespace GL
          {
             VertexStream = 0,
             TextureStream = 1,
-            NormalStream = 2
+            NormalStream = 2,
+            DrawIDStream = 3
          };
 
       private:
@@ -68,6 +76,21 @@ namespace GL
          GLuint program;
          std::vector<std::shared_ptr<Shader>> shaders;
          bool m_linked;
+
+         // Active uniforms introspected at link time, plus any other
+         // names looked up since (cached, -1 included).
+         mutable std::map<std::string, GLint> uniforms;
+         // Locations indexed by UniformKey, filled in lazily
+         // for keys interned after link().
+         mutable std::vector<GLint> key_locations;
+         // Active uniform blocks and their current bindings, so rebinding
+         // a block to the same point never reaches the driver.
+         std::map<std::string, GLuint> blocks;
+         std::vector<GLuint> block_bindings;
+
+         static std::vector<std::string>& key_names();
+         void introspect_uniforms();
+         void introspect_blocks();
    };
 }
 
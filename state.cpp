@@ -0,0 +1,213 @@
+#include "state.hpp"
+#include <algorithm>
+
+namespace GL
+{
+   GLuint State::program;
+   GLuint State::vao;
+   GLuint State::buffers[State::max_buffer_targets];
+   unsigned State::active_unit;
+   GLuint State::textures[State::max_units][State::max_texture_targets];
+   GLuint State::samplers[State::max_units];
+   GLuint State::framebuffer;
+   GLint State::viewport_rect[4] = { -1, -1, -1, -1 };
+   State::Counters State::counters;
+
+   int State::buffer_index(GLenum target)
+   {
+      switch (target)
+      {
+         case GL_ARRAY_BUFFER:
+            return 0;
+         case GL_ELEMENT_ARRAY_BUFFER:
+            return 1;
+         case GL_UNIFORM_BUFFER:
+            return 2;
+         case GL_PIXEL_UNPACK_BUFFER:
+            return 3;
+         case GL_DRAW_INDIRECT_BUFFER:
+            return 4;
+         default:
+            return -1;
+      }
+   }
+
+   int State::texture_index(GLenum target)
+   {
+      switch (target)
+      {
+         case GL_TEXTURE_2D:
+            return 0;
+         case GL_TEXTURE_2D_ARRAY:
+            return 1;
+         case GL_TEXTURE_BUFFER:
+            return 2;
+         default:
+            return -1;
+      }
+   }
+
+   bool State::filter(GLuint &cache, GLuint value)
+   {
+      if (cache == value)
+      {
+         counters.elided++;
+         return false;
+      }
+
+      cache = value;
+      counters.issued++;
+      return true;
+   }
+
+   void State::use_program(GLuint program_)
+   {
+      if (filter(program, program_))
+         GLSYM(glUseProgram)(program);
+   }
+
+   void State::bind_vertex_array(GLuint vao_)
+   {
+      if (filter(vao, vao_))
+      {
+         GLSYM(glBindVertexArray)(vao);
+         // The element array binding is part of the VAO.
+         buffers[buffer_index(GL_ELEMENT_ARRAY_BUFFER)] = unknown;
+      }
+   }
+
+   void State::bind_buffer(GLenum target, GLuint buffer)
+   {
+      int index = buffer_index(target);
+      if (index < 0)
+      {
+         counters.issued++;
+         GLSYM(glBindBuffer)(target, buffer);
+      }
+      else if (filter(buffers[index], buffer))
+         GLSYM(glBindBuffer)(target, buffer);
+   }
+
+   void State::bind_buffer_base(GLenum target, GLuint index, GLuint buffer)
+   {
+      // Indexed bindings are not tracked, but also change the generic binding.
+      counters.issued++;
+      GLSYM(glBindBufferBase)(target, index, buffer);
+
+      int target_index = buffer_index(target);
+      if (target_index >= 0)
+         buffers[target_index] = buffer;
+   }
+
+   void State::active_texture(unsigned unit)
+   {
+      if (filter(active_unit, unit))
+         GLSYM(glActiveTexture)(GL_TEXTURE0 + unit);
+   }
+
+   void State::bind_texture(unsigned unit, GLenum target, GLuint texture)
+   {
+      int index = texture_index(target);
+      if (unit >= max_units || index < 0)
+      {
+         active_texture(unit);
+         counters.issued++;
+         GLSYM(glBindTexture)(target, texture);
+         return;
+      }
+
+      if (textures[unit][index] == texture)
+      {
+         counters.elided++;
+         return;
+      }
+
+      active_texture(unit);
+      filter(textures[unit][index], texture);
+      GLSYM(glBindTexture)(target, texture);
+   }
+
+   void State::bind_sampler(unsigned unit, GLuint sampler)
+   {
+      // Sampler bindings are per unit and don't go through the active unit.
+      if (unit >= max_units)
+      {
+         counters.issued++;
+         GLSYM(glBindSampler)(unit, sampler);
+      }
+      else if (filter(samplers[unit], sampler))
+         GLSYM(glBindSampler)(unit, sampler);
+   }
+
+   GLuint State::bound_texture(unsigned unit, GLenum target)
+   {
+      int index = texture_index(target);
+      if (unit >= max_units || index < 0)
+         return 0;
+      return textures[unit][index];
+   }
+
+   void State::bind_framebuffer(GLuint framebuffer_)
+   {
+      if (filter(framebuffer, framebuffer_))
+         GLSYM(glBindFramebuffer)(GL_FRAMEBUFFER, framebuffer);
+   }
+
+   void State::viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+   {
+      if (viewport_rect[0] == x && viewport_rect[1] == y &&
+            viewport_rect[2] == width && viewport_rect[3] == height)
+      {
+         counters.elided++;
+         return;
+      }
+
+      viewport_rect[0] = x;
+      viewport_rect[1] = y;
+      viewport_rect[2] = width;
+      viewport_rect[3] = height;
+      counters.issued++;
+      GLSYM(glViewport)(x, y, width, height);
+   }
+
+   void State::deleted_program(GLuint program_)
+   {
+      // A deleted program stays current until another one is used.
+      if (program == program_)
+         program = unknown;
+   }
+
+   void State::deleted_vertex_array(GLuint vao_)
+   {
+      if (vao == vao_)
+      {
+         vao = 0;
+         buffers[buffer_index(GL_ELEMENT_ARRAY_BUFFER)] = unknown;
+      }
+   }
+
+   void State::deleted_buffer(GLuint buffer)
+   {
+      std::replace(buffers, buffers + max_buffer_targets, buffer, 0u);
+   }
+
+   void State::deleted_texture(GLuint texture)
+   {
+      for (unsigned i = 0; i < max_units; i++)
+         std::replace(textures[i], textures[i] + max_texture_targets, texture, 0u);
+   }
+
+   void State::deleted_framebuffer(GLuint framebuffer_)
+   {
+      if (framebuffer == framebuffer_)
+         framebuffer = 0;
+   }
+
+   State::Counters State::end_frame()
+   {
+      Counters ret = counters;
+      counters.issued = 0;
+      counters.elided = 0;
+      return ret;
+   }
+}
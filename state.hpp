@@ -0,0 +1,68 @@
+#ifndef STATE_HPP__
+#define STATE_HPP__
+
+#include "gl.hpp"
+
+namespace GL
+{
+   // Shadow copy of GL binding state.
+   // Every object wrapper binds through here so that binding what is
+   // already bound never reaches the driver.
+   class State
+   {
+      public:
+         static void use_program(GLuint program);
+         static void bind_vertex_array(GLuint vao);
+         static void bind_buffer(GLenum target, GLuint buffer);
+         static void bind_buffer_base(GLenum target, GLuint index, GLuint buffer);
+         static void bind_texture(unsigned unit, GLenum target, GLuint texture);
+         static void bind_sampler(unsigned unit, GLuint sampler);
+         static void bind_framebuffer(GLuint framebuffer);
+         static void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+         static GLuint bound_texture(unsigned unit, GLenum target);
+
+         // Deleted names may be handed out again by glGen*(),
+         // so they must not be assumed bound afterwards.
+         static void deleted_program(GLuint program);
+         static void deleted_vertex_array(GLuint vao);
+         static void deleted_buffer(GLuint buffer);
+         static void deleted_texture(GLuint texture);
+         static void deleted_framebuffer(GLuint framebuffer);
+
+         struct Counters
+         {
+            unsigned issued;
+            unsigned elided;
+         };
+
+         // Returns calls issued and elided since the previous call.
+         static Counters end_frame();
+
+      private:
+         enum
+         {
+            max_units = 32,
+            max_buffer_targets = 5,
+            max_texture_targets = 3,
+            unknown = ~0u
+         };
+
+         static GLuint program;
+         static GLuint vao;
+         static GLuint buffers[max_buffer_targets];
+         static unsigned active_unit;
+         static GLuint textures[max_units][max_texture_targets];
+         static GLuint samplers[max_units];
+         static GLuint framebuffer;
+         static GLint viewport_rect[4];
+         static Counters counters;
+
+         static int buffer_index(GLenum target);
+         static int texture_index(GLenum target);
+         static void active_texture(unsigned unit);
+         static bool filter(GLuint &cache, GLuint value);
+   };
+}
+
+#endif
@@ -2,6 +2,8 @@
 #define STRUCTURE_H__
 
 #include <stddef.h>
+#include <stdint.h>
+#include <vector>
 #include "linear.hpp"
 
 namespace GL
@@ -26,6 +28,22 @@ namespace GL
       {
          Coord coord[3];
       };
+
+      // Unique vertices with a triangle list indexing into them.
+      struct IndexedMesh
+      {
+         std::vector<Coord> vertices;
+         std::vector<uint32_t> indices;
+      };
+
+      // Axis aligned box and the sphere around it.
+      struct Bounds
+      {
+         float min[3];
+         float max[3];
+         float center[3];
+         float radius;
+      };
    }
 }
 
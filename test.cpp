@@ -4,8 +4,24 @@
 #include "structure.hpp"
 #include "mesh.hpp"
 #include "object.hpp"
+#include "optimize.hpp"
+#include "render_queue.hpp"
+#include "cull.hpp"
+#include "image.hpp"
+#include "compress.hpp"
+#include "texture_stream.hpp"
+#include "texture_cache.hpp"
 #include <assert.h>
 #include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <array>
+#include <unistd.h>
 
 using namespace GL;
 using namespace GLU;
@@ -27,6 +43,8 @@ struct Camera
    bool rot_down;
 
    float rot_x, rot_y;
+   // Yaw and pitch from rot_x and rot_y, updated by update_camera().
+   quat orientation;
 
    bool mouse;
    ivec2 delta;
@@ -73,9 +91,10 @@ static GLMatrix update_camera(Camera &cam, float speed)
    else if (cam.rot_x < -85.0)
       cam.rot_x = -85.0;
 
-   auto rotation = Rotate(0.0, -cam.rot_y, 0.0);
+   cam.orientation = quat::AxisAngle(vec3(0, 1, 0), cam.rot_y) *
+      quat::AxisAngle(vec3(1, 0, 0), cam.rot_x);
 
-   vec3 direction = rotation * Rotate(RotX, cam.rot_x) * vec_conv<3, 4>(speed * movement);
+   vec3 direction = cam.orientation.rotate(speed * movement);
    if (cam.up)
       direction += speed * vec3(0, 1, 0);
    if (cam.down)
@@ -83,8 +102,7 @@ static GLMatrix update_camera(Camera &cam, float speed)
 
    cam.pos = cam.pos + direction;
 
-   auto translation = Translate(-cam.pos);
-   return Rotate(RotX, -cam.rot_x) * Transpose(rotation) * translation;
+   return GLTransform(cam.orientation, cam.pos).inverse().matrix();
 }
 
 static void key_callback(unsigned key, bool pressed,
@@ -172,13 +190,13 @@ static void key_callback(unsigned key, bool pressed,
    }
 }
 
-static void gl_prog(const std::vector<std::string> &object_paths)
+static void gl_prog(const std::vector<std::string> &object_paths, bool batched,
+      size_t texture_budget, bool atlas)
 {
    auto win = Window::get(640, 480, std::pair<unsigned, unsigned>(3, 3));
    win->vsync();
 
-   Camera camera;
-   std::memset(&camera, 0, sizeof(camera)); 
+   Camera camera = Camera();
    camera.pos = vec4(0, 0, 0, 1);
    camera.rot_x = camera.rot_y = 0.0;
 
@@ -200,14 +218,14 @@ static void gl_prog(const std::vector<std::string> &object_paths)
    //GLSYM(glEnable)(GL_CULL_FACE);
 
    auto prog = std::make_shared<Program>();
-   prog->add(FileToString("shader.vp"), Shader::Vertex);
+   prog->add(FileToString(batched ? "shader_batch.vp" : "shader.vp"), Shader::Vertex);
    prog->add(FileToString("shader.fp"), Shader::Fragment);
    prog->link();
    auto shadow_prog = std::make_shared<Program>();
-   shadow_prog->add(FileToString("shadow_shader.vp"), Shader::Vertex);
+   shadow_prog->add(FileToString(batched ? "shadow_shader_batch.vp" : "shadow_shader.vp"), Shader::Vertex);
    shadow_prog->link();
    auto shadow_map_prog = std::make_shared<Program>();
-   shadow_map_prog->add(FileToString("shadow_map.vp"), Shader::Vertex);
+   shadow_map_prog->add(FileToString(batched ? "shadow_map_batch.vp" : "shadow_map.vp"), Shader::Vertex);
    shadow_map_prog->add(FileToString("shadow_map.fp"), Shader::Fragment);
    shadow_map_prog->link();
 
@@ -221,33 +239,87 @@ static void gl_prog(const std::vector<std::string> &object_paths)
    Mesh::set_shader(prog);
    Mesh::set_viewport_size(ivec2(width, height));
 
+   // Declared before the meshes so their textures are gone when it is.
+   // Packing an atlas needs textures loaded in place, so it goes without.
+   TextureStreamer streamer;
+   if (!atlas)
+      Texture::set_streamer(&streamer);
+   TextureCache textures(texture_budget);
+   TextureCache::set_current(&textures);
+
    std::vector<std::shared_ptr<Mesh>> meshes;
    for (auto path = std::begin(object_paths); path != std::end(object_paths); ++path)
    {
-      auto mesh = LoadTexturedMeshes(*path);
-      meshes.insert(meshes.end(), mesh.begin(), mesh.end());
+      if (batched)
+      {
+         auto batch = LoadBatchedMeshes(*path, true, atlas);
+         meshes.insert(meshes.end(), batch.begin(), batch.end());
+      }
+      else
+      {
+         auto mesh = LoadTexturedMeshes(*path, true, atlas);
+         meshes.insert(meshes.end(), mesh.begin(), mesh.end());
+      }
    }
+   for (auto mesh = std::begin(meshes); mesh != std::end(meshes); ++mesh)
+      (*mesh)->set_auto_normal(true);
+
+   enum { ShadowPass, ShadowMapPass, ScenePass };
+   unsigned shadow_w, shadow_h;
+   RenderQueue queue;
+
+   // 1st pass. Render depth map.
+   queue.set_pass(ShadowPass, [&]() {
+         shadow_buf[0]->bind();
+         GLSYM(glClear)(GL_DEPTH_BUFFER_BIT);
+         shadow_buf[0]->size(shadow_w, shadow_h);
+         State::viewport(0, 0, shadow_w, shadow_h);
+      }, [&]() {
+         shadow_buf[0]->unbind();
+      });
+
+   // 2nd pass. Generate a shadow map which we can blur.
+   queue.set_pass(ShadowMapPass, [&]() {
+         shadow_map_buf[0]->bind();
+         GLSYM(glClear)(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+         shadow_map_buf[0]->size(shadow_w, shadow_h);
+         State::viewport(0, 0, shadow_w, shadow_h);
+         shadow_buf[0]->bind_texture(1);
+      }, [&]() {
+         shadow_buf[0]->unbind_texture();
+         shadow_map_buf[0]->unbind();
+      });
+
+   // 3rd pass. Render final scene with blurry shadow map.
+   queue.set_pass(ScenePass, [&]() {
+         shadow_map_buf[0]->bind_texture(1);
+         GLSYM(glClear)(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+         State::viewport(0, 0, width, height);
+      }, [&]() {
+         shadow_map_buf[0]->unbind_texture();
+      });
 
    GLSYM(glClearColor)(0, 0, 0, 1);
    float frame_count = 0.0;
+   unsigned long long binds_issued = 0, binds_elided = 0, frames = 0;
+   unsigned long long drawn[3] = {0}, culled[3] = {0};
    while (win->alive() && !quit)
    {
       if (win->check_resize(width, height))
       {
-         GLSYM(glViewport)(0, 0, width, height);
-         auto proj_matrix = Scale((float)height / width, 1, 1) * Projection(2, 1000);
+         State::viewport(0, 0, width, height);
+         proj_matrix = Scale((float)height / width, 1, 1) * Projection(2, 1000);
          Mesh::set_projection(proj_matrix);
          Mesh::set_viewport_size(ivec2(width, height));
          frame_count = 0.0;
       }
 
+      streamer.update();
+
       // Update uniforms.
       scale *= scale_factor;
       for (auto mesh = std::begin(meshes); mesh != std::end(meshes); ++mesh)
       {
-         auto rotate_mat = Identity();
-         (*mesh)->set_normal(rotate_mat);
-
          auto trans_matrix = Translate(0.0f, 0.0f, -25.0f) * Scale(scale);
          (*mesh)->set_transform(trans_matrix);
       }
@@ -267,65 +339,1065 @@ static void gl_prog(const std::vector<std::string> &object_paths)
       Mesh::set_player_pos(camera.pos);
       Mesh::set_camera(camera_matrix);
 
-      for (unsigned i = 0; i < 1; i++)
-      {
-         Mesh::set_light_transform(light_camera[i]);
-         // Begin rendering
-         // 1st pass. Render depth map.
-         Mesh::set_shader(shadow_prog);
-         shadow_buf[i]->bind();
-         GLSYM(glClear)(GL_DEPTH_BUFFER_BIT);
-         unsigned shadow_w, shadow_h;
-         shadow_buf[i]->size(shadow_w, shadow_h);
-         GLSYM(glViewport)(0, 0, shadow_w, shadow_h);
+      Mesh::set_light_transform(light_camera[0]);
+      Mesh::update_transforms(meshes);
 
-         for (auto mesh = std::begin(meshes); mesh != std::end(meshes); ++mesh)
-            (*mesh)->render();
-         shadow_buf[i]->unbind();
+      // The depth map is rendered from the light, the other passes from the camera.
+      auto camera_frustum = ExtractFrustum(proj_matrix * camera_matrix);
+      queue.set_frustum(ShadowPass, ExtractFrustum(light_camera[0]));
+      queue.set_frustum(ShadowMapPass, camera_frustum);
+      queue.set_frustum(ScenePass, camera_frustum);
 
-         // 2nd pass. Generate a shadow map which we can blur.
-         shadow_map_buf[i]->bind();
-         Mesh::set_shader(shadow_map_prog);
-         GLSYM(glClear)(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-         shadow_map_buf[i]->size(shadow_w, shadow_h);
-         GLSYM(glViewport)(0, 0, shadow_w, shadow_h);
-         shadow_buf[i]->bind_texture(1);
-
-         for (auto mesh = std::begin(meshes); mesh != std::end(meshes); ++mesh)
-            (*mesh)->render();
-         shadow_buf[i]->unbind_texture();
-         shadow_map_buf[i]->unbind();
+      queue.clear();
+      for (auto mesh = std::begin(meshes); mesh != std::end(meshes); ++mesh)
+      {
+         queue.push(ShadowPass, shadow_prog, **mesh);
+         queue.push(ShadowMapPass, shadow_map_prog, **mesh);
+         queue.push(ScenePass, prog, **mesh);
       }
+      queue.sort();
+      queue.execute();
 
-      // 3rd pass. Render final scene with blurry shadow map.
-      shadow_map_buf[0]->bind_texture(1);
-      GLSYM(glClear)(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-      GLSYM(glViewport)(0, 0, width, height);
-      Mesh::set_shader(prog);
-      for (auto mesh = std::begin(meshes); mesh != std::end(meshes); ++mesh)
-         (*mesh)->render();
-      shadow_map_buf[0]->unbind_texture();
+      for (unsigned i = 0; i < 3; i++)
+      {
+         drawn[i] += queue.stats(i).drawn;
+         culled[i] += queue.stats(i).culled;
+      }
 
       frame_count += 1.0;
       win->flip();
+
+      textures.update();
+
+      auto counters = State::end_frame();
+      binds_issued += counters.issued;
+      binds_elided += counters.elided;
+      frames++;
+   }
+
+   if (frames)
+   {
+      std::cerr << "State changes per frame: " << binds_issued / frames << " issued, "
+         << binds_elided / frames << " elided." << std::endl;
+
+      auto tex_stats = textures.stats();
+      std::cerr << "Textures: " << tex_stats.textures << " (" << tex_stats.trimmed << " trimmed), "
+         << tex_stats.resident_bytes / (1024.0 * 1024.0) << " of "
+         << tex_stats.budget / (1024.0 * 1024.0) << " MB, "
+         << tex_stats.hits << " hits, " << tex_stats.misses << " misses, "
+         << tex_stats.evictions << " evictions, " << tex_stats.reloads << " reloads." << std::endl;
+
+      static const char *pass_names[3] = { "Shadow", "Shadow map", "Scene" };
+      for (unsigned i = 0; i < 3; i++)
+      {
+         std::cerr << pass_names[i] << " pass meshes per frame: " << drawn[i] / frames
+            << " drawn, " << culled[i] / frames << " culled." << std::endl;
+      }
+   }
+}
+
+// Reports post-transform cache efficiency before and after optimization.
+// Does not need a GL context.
+static void print_cache_stats(const std::vector<std::string> &object_paths)
+{
+   for (auto path = std::begin(object_paths); path != std::end(object_paths); ++path)
+   {
+      auto groups = LoadObjectGroups(*path);
+      for (auto group = std::begin(groups); group != std::end(groups); ++group)
+      {
+         auto before = AnalyzeVertexCache(group->mesh.indices, group->mesh.vertices.size());
+         OptimizeMesh(group->mesh);
+         auto after = AnalyzeVertexCache(group->mesh.indices, group->mesh.vertices.size());
+
+         std::cout << *path << " [" << (group->texture.empty() ? "untextured" : group->texture) << "]: "
+            << group->mesh.indices.size() / 3 << " triangles, "
+            << group->mesh.vertices.size() << " vertices, ACMR "
+            << before.acmr << " -> " << after.acmr << ", ATVR "
+            << before.atvr << " -> " << after.atvr << std::endl;
+      }
+   }
+}
+
+// Times RenderQueue::RadixSort() against std::sort() on synthetic packets.
+// Does not need a GL context.
+static void bench_render_queue(unsigned count)
+{
+   std::srand(0);
+   std::vector<RenderQueue::Packet> input(count);
+   for (unsigned i = 0; i < count; i++)
+   {
+      input[i].key = RenderQueue::sort_key(std::rand() % 3, std::rand() % 3,
+            std::rand() % 256, (std::rand() % 100000) * 0.01f, i);
+      input[i].index = i;
+   }
+
+   auto key_less = [](const RenderQueue::Packet &a, const RenderQueue::Packet &b) {
+      return a.key < b.key;
+   };
+
+   enum { iterations = 100 };
+   std::vector<RenderQueue::Packet> packets, scratch;
+
+   auto start = std::chrono::high_resolution_clock::now();
+   for (unsigned i = 0; i < iterations; i++)
+   {
+      packets = input;
+      RenderQueue::RadixSort(packets, scratch);
+   }
+   auto radix_time = std::chrono::high_resolution_clock::now() - start;
+   auto radix_result = packets;
+
+   start = std::chrono::high_resolution_clock::now();
+   for (unsigned i = 0; i < iterations; i++)
+   {
+      packets = input;
+      std::stable_sort(std::begin(packets), std::end(packets), key_less);
+   }
+   auto std_time = std::chrono::high_resolution_clock::now() - start;
+
+   bool match = std::equal(std::begin(packets), std::end(packets), std::begin(radix_result),
+         [](const RenderQueue::Packet &a, const RenderQueue::Packet &b) {
+            return a.key == b.key && a.index == b.index;
+         });
+
+   typedef std::chrono::duration<double, std::milli> ms;
+   std::cout << count << " packets: radix sort "
+      << std::chrono::duration_cast<ms>(radix_time).count() / iterations << " ms, std::stable_sort "
+      << std::chrono::duration_cast<ms>(std_time).count() / iterations << " ms"
+      << (match ? "" : " (MISMATCH)") << std::endl;
+}
+
+// Times GLU::Intersects() and every GLU::CullBounds() kernel the CPU supports
+// on random bounds around the default camera. Does not need a GL context.
+static void bench_culling(unsigned count)
+{
+   std::srand(0);
+   auto random = [](float range) {
+      return range * (std::rand() / (float)RAND_MAX - 0.5f);
+   };
+
+   std::vector<Geo::Bounds> bounds(count);
+   for (unsigned i = 0; i < count; i++)
+   {
+      Geo::Bounds &b = bounds[i];
+      float extent = 0.5f + std::rand() % 10;
+      for (unsigned c = 0; c < 3; c++)
+      {
+         float center = random(2000.0f);
+         b.min[c] = center - extent;
+         b.max[c] = center + extent;
+         b.center[c] = center;
+      }
+      b.radius = extent * std::sqrt(3.0f);
+   }
+
+   auto frustum = ExtractFrustum(Scale(0.75f, 1, 1) * Projection(2, 1000));
+
+   BoundsArray soa;
+   for (auto b = std::begin(bounds); b != std::end(bounds); ++b)
+      soa.push_back(*b);
+
+   enum { iterations = 10 };
+   typedef std::chrono::duration<double, std::milli> ms;
+   auto report = [count](const char *name, std::chrono::high_resolution_clock::duration time,
+         unsigned visible) {
+      double per_iteration = std::chrono::duration_cast<ms>(time).count() / iterations;
+      std::cout << count << " bounds, " << name << ": " << per_iteration << " ms, "
+         << count / (per_iteration * 1000.0) << " M boxes/s, "
+         << visible << " visible" << std::endl;
+   };
+
+   std::vector<uint8_t> reference(count);
+   auto start = std::chrono::high_resolution_clock::now();
+   for (unsigned i = 0; i < iterations; i++)
+   {
+      for (unsigned j = 0; j < count; j++)
+         reference[j] = Intersects(frustum, bounds[j]);
+   }
+   report("Intersects()", std::chrono::high_resolution_clock::now() - start,
+         std::count(std::begin(reference), std::end(reference), 1));
+
+   static const char *kernel_names[] = { "scalar", "SSE", "AVX" };
+   std::vector<uint8_t> visible(count);
+   for (unsigned kernel = CullScalar; kernel <= static_cast<unsigned>(BestCullKernel()); kernel++)
+   {
+      start = std::chrono::high_resolution_clock::now();
+      for (unsigned i = 0; i < iterations; i++)
+         CullBounds(frustum, soa, visible.data(), static_cast<CullKernel>(kernel));
+      auto time = std::chrono::high_resolution_clock::now() - start;
+
+      report(kernel_names[kernel], time, std::count(std::begin(visible), std::end(visible), 1));
+      if (visible != reference)
+         std::cout << "   (results differ from Intersects())" << std::endl;
+   }
+}
+
+// The math types stay memcpy-able and constant arithmetic folds at
+// compile time. Build failures here are the test.
+static_assert(std::is_trivially_copyable<GLMatrix>::value &&
+      std::is_trivially_copyable<vec4>::value, "Math types must be trivially copyable");
+
+namespace
+{
+   constexpr GLMatrix folded_move = Translate(3, 4, 5);
+   constexpr GLMatrix folded = Generic::Multiply(Scale(2), folded_move) - folded_move;
+   static_assert(folded(0, 0) == 1.0f && folded(1, 3) == 4.0f && folded(3, 3) == 0.0f,
+         "Matrix products do not fold");
+   constexpr GLMatrix folded_sum = Identity() + folded;
+   static_assert(folded_sum(2, 2) == 2.0f, "Matrix sums do not fold");
+   constexpr vec4 folded_vec = Generic::Multiply(folded_move, vec4(1, 1, 1, 1)) +
+      2.0f * vec_conv<3, 4>(vec3(1, 1, 1));
+   static_assert(folded_vec(2) == 8.0f && folded_vec(3) == 1.0f,
+         "Vector expressions do not fold");
+}
+
+// Milliseconds for rounds passes of func(0) ... func(count - 1).
+template <class Func>
+static double time_loop(unsigned rounds, unsigned count, const Func &func)
+{
+   typedef std::chrono::duration<double, std::milli> ms;
+   auto start = std::chrono::high_resolution_clock::now();
+   for (unsigned r = 0; r < rounds; r++)
+      for (unsigned i = 0; i < count; i++)
+         func(i);
+   return std::chrono::duration_cast<ms>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// Times GLMatrix products against GL::Generic and reports
+// the largest difference between them. Works on a cache sized set so
+// memory bandwidth does not hide the arithmetic, then times the camera
+// update. Does not need a GL context.
+static void bench_matrix(unsigned count)
+{
+   enum { set_size = 1024 };
+   std::srand(0);
+   std::vector<GLMatrix> matrices(set_size + 1);
+   std::vector<vec4> vectors(set_size);
+   for (unsigned i = 0; i <= set_size; i++)
+   {
+      for (unsigned j = 0; j < 16; j++)
+         matrices[i]()[j] = std::rand() / (float)RAND_MAX - 0.5f;
+   }
+   for (unsigned i = 0; i < set_size; i++)
+   {
+      for (unsigned j = 0; j < 4; j++)
+         vectors[i](j) = std::rand() / (float)RAND_MAX - 0.5f;
+   }
+
+   std::vector<GLMatrix> generic_out(set_size), out(set_size);
+   std::vector<vec4> generic_vec_out(set_size), vec_out(set_size);
+   unsigned rounds = count / set_size;
+   double generic_ms = time_loop(rounds, set_size, [&](unsigned i) {
+         generic_out[i] = Generic::Multiply(matrices[i], matrices[i + 1]);
+      });
+   double matrix_ms = time_loop(rounds, set_size, [&](unsigned i) {
+         out[i] = matrices[i] * matrices[i + 1];
+      });
+   double generic_vec_ms = time_loop(rounds, set_size, [&](unsigned i) {
+         generic_vec_out[i] = Generic::Multiply(matrices[i], vectors[i]);
+      });
+   double vec_ms = time_loop(rounds, set_size, [&](unsigned i) {
+         vec_out[i] = matrices[i] * vectors[i];
+      });
+
+   float max_error = 0.0f;
+   for (unsigned i = 0; i < set_size; i++)
+   {
+      for (unsigned j = 0; j < 16; j++)
+         max_error = std::max(max_error, std::fabs(out[i]()[j] - generic_out[i]()[j]));
+      for (unsigned j = 0; j < 4; j++)
+         max_error = std::max(max_error, std::fabs(vec_out[i](j) - generic_vec_out[i](j)));
+   }
+
+   double total = double(rounds) * set_size / 1000.0;
+   std::cout << "Matrix * Matrix: generic " << total / generic_ms
+      << " M/s, GLMatrix " << total / matrix_ms << " M/s" << std::endl;
+   std::cout << "Matrix * Vector: generic " << total / generic_vec_ms
+      << " M/s, GLMatrix " << total / vec_ms << " M/s" << std::endl;
+   std::cout << "Largest difference: " << max_error << std::endl;
+
+   // Inverses. Random matrices can be badly conditioned, so the
+   // residual is measured on rotations, scales and translations.
+   std::vector<GLMatrix> affine(set_size), normals(set_size);
+   for (unsigned i = 0; i < set_size; i++)
+   {
+      affine[i] = Translate(matrices[i](0, 3), matrices[i](1, 3), matrices[i](2, 3)) *
+         Rotate(360.0f * matrices[i](0, 0), 360.0f * matrices[i](1, 0), 45.0f) *
+         Scale(1.5f + matrices[i](1, 1), 1.5f + matrices[i](2, 2), 1.5f);
+   }
+   double inverse_ms = time_loop(rounds, set_size, [&](unsigned i) {
+         out[i] = Inverse(affine[i]);
+      });
+   double affine_ms = time_loop(rounds, set_size, [&](unsigned i) {
+         generic_out[i] = AffineInverse(affine[i]);
+      });
+   double normal_ms = time_loop(rounds, set_size, [&](unsigned i) {
+         normals[i] = NormalMatrix(affine[i]);
+      });
+
+   float inverse_error = 0.0f;
+   for (unsigned i = 0; i < set_size; i++)
+   {
+      GLMatrix id = affine[i] * out[i];
+      GLMatrix affine_id = affine[i] * generic_out[i];
+      for (unsigned r = 0; r < 4; r++)
+         for (unsigned c = 0; c < 4; c++)
+         {
+            float expected = r == c ? 1.0f : 0.0f;
+            inverse_error = std::max(inverse_error, std::fabs(id(r, c) - expected));
+            inverse_error = std::max(inverse_error, std::fabs(affine_id(r, c) - expected));
+         }
+   }
+
+   std::cout << "Inverse: general " << total / inverse_ms
+      << " M/s, affine " << total / affine_ms
+      << " M/s, normal matrix " << total / normal_ms << " M/s" << std::endl;
+   std::cout << "Largest inverse residual: " << inverse_error << std::endl;
+
+   // Per frame model -> projection and light matrices for many objects.
+   enum { objects = 100000 };
+   std::vector<GLMatrix> models(objects), batch_out(2 * objects);
+   for (unsigned i = 0; i < objects; i++)
+      models[i] = matrices[i % set_size];
+   const GLMatrix &view_projection = matrices[set_size];
+   const GLMatrix &light = matrices[0];
+
+   double loop_ms = time_loop(1, objects, [&](unsigned i) {
+         batch_out[2 * i + 0] = view_projection * models[i];
+         batch_out[2 * i + 1] = light * models[i];
+      });
+   double batch_ms = time_loop(1, 1, [&](unsigned) {
+         TransformBatch(models.data(), objects, view_projection, light, batch_out.data(), false);
+      });
+   double threaded_ms = time_loop(1, 1, [&](unsigned) {
+         TransformBatch(models.data(), objects, view_projection, light, batch_out.data());
+      });
+   std::cout << objects << " objects: operator* " << loop_ms << " ms, TransformBatch "
+      << batch_ms << " ms, threaded " << threaded_ms << " ms" << std::endl;
+
+   // Composing rotations, as matrices and as quaternions.
+   std::vector<quat> rotations(set_size + 1);
+   for (unsigned i = 0; i <= set_size; i++)
+      rotations[i] = quat::AxisAngle(vec3(0, 1, 0), 360.0f * matrices[i](0, 0)) *
+         quat::AxisAngle(vec3(1, 0, 0), 360.0f * matrices[i](0, 1));
+   for (unsigned i = 0; i < set_size; i++)
+      affine[i] = rotations[i].matrix();
+   std::vector<quat> quat_out(set_size);
+   double compose_ms = time_loop(rounds, set_size, [&](unsigned i) {
+         out[i] = affine[i] * affine[(i + 1) % set_size];
+      });
+   double quat_ms = time_loop(rounds, set_size, [&](unsigned i) {
+         quat_out[i] = rotations[i] * rotations[i + 1];
+      });
+   double slerp_ms = time_loop(rounds, set_size, [&](unsigned i) {
+         quat_out[i] = quat::Slerp(rotations[i], rotations[i + 1], 0.25f);
+      });
+   std::cout << "Rotation * Rotation: GLMatrix " << total / compose_ms
+      << " M/s, quat " << total / quat_ms << " M/s, slerp " << total / slerp_ms
+      << " M/s" << std::endl;
+
+   // The per frame camera update, moving and turning on every step.
+   Camera cam = Camera();
+   cam.pos = vec4(0, 0, 0, 1);
+   cam.forward = cam.left = cam.up = cam.rot_left = true;
+   GLMatrix view;
+   double camera_ms = time_loop(1, count, [&](unsigned) {
+         view = update_camera(cam, 0.01f);
+      });
+   std::cout << "Camera update: " << count / 1000.0 / camera_ms << " M/s" << std::endl;
+}
+
+// The getline() and strtok() OBJ parser used before LoadObject() parsed
+// the mapped file in place, as a baseline.
+namespace Reference
+{
+   typedef std::vector<std::array<float, 3>> lvec3;
+   typedef std::vector<std::array<float, 2>> lvec2;
+
+   static void parse_indices(char *list, size_t indices[3], size_t offsets[3])
+   {
+      for (unsigned i = 0; i < 3; i++)
+         indices[i] = 0;
+
+      char *end = list;
+      for (unsigned i = 0; i < 3; i++, end++)
+      {
+         char *old = end;
+
+         int indice = std::strtol(old, &end, 0);
+         if (indice > 0)
+            indices[i] = indice;
+         else if (indice < 0) // Relative to end
+            indices[i] = offsets[i] + indice + 1;
+
+         if (end[0] == '\0')
+            break;
+      }
+   }
+
+   enum Attr { Vertex, Normal, Texture, Elem };
+
+   static bool get_attr(char *line, Attr &attr, float elems[3], size_t indices[3][3], size_t offsets[3])
+   {
+      char *elem = std::strtok(line, " ");
+      if (!elem)
+         return false;
+
+      std::string vert_type = elem;
+      if (vert_type == "v")
+         attr = Vertex;
+      else if (vert_type == "vn")
+         attr = Normal;
+      else if (vert_type == "vt")
+         attr = Texture;
+      else if (vert_type == "f")
+         attr = Elem;
+      else
+         return false;
+
+      if (attr == Elem)
+      {
+         for (unsigned i = 0; i < 3 && elem; i++)
+         {
+            elem = std::strtok(nullptr, " ");
+            if (elem)
+               parse_indices(elem, indices[i], offsets);
+            else
+               return false;
+         }
+      }
+      else
+      {
+         for (unsigned i = 0; i < 3 && elem; i++)
+         {
+            elem = std::strtok(nullptr, " ");
+            if (elem)
+               elems[i] = static_cast<float>(strtod(elem, nullptr));
+         }
+      }
+
+      return true;
+   }
+
+   static Geo::Triangle triangle_from_indices(const lvec3 &vertices, const lvec3 &normals,
+         const lvec2 &tex_coords, size_t indices[3][3])
+   {
+      Geo::Triangle tri;
+      std::memset(&tri, 0, sizeof(tri));
+
+      for (unsigned i = 0; i < 3; i++)
+      {
+         if (indices[i][0])
+         {
+            size_t real_indice = indices[i][0] - 1;
+            if (real_indice >= vertices.size())
+               throw Exception("Object face index exceeds maximum recorded vertices!");
+            for (unsigned j = 0; j < 3; j++)
+               tri.coord[i].vertex[j] = vertices[real_indice][j];
+         }
+
+         if (indices[i][1])
+         {
+            size_t real_indice = indices[i][1] - 1;
+            if (real_indice >= tex_coords.size())
+               throw Exception("Object face index exceeds maximum recorded texture coordinates!");
+            for (unsigned j = 0; j < 2; j++)
+               tri.coord[i].tex[j] = tex_coords[real_indice][j];
+         }
+
+         if (indices[i][2])
+         {
+            size_t real_indice = indices[i][2] - 1;
+            if (real_indice >= normals.size())
+               throw Exception("Object face index exceeds maximum recorded normal coordinates!");
+            for (unsigned j = 0; j < 3; j++)
+               tri.coord[i].normal[j] = normals[real_indice][j];
+         }
+      }
+
+      return tri;
+   }
+
+   static std::vector<Geo::Triangle> load_object(const std::string &path)
+   {
+      std::vector<Geo::Triangle> triangles;
+      lvec3 vertices;
+      lvec3 normals;
+      lvec2 tex_coords;
+
+      std::fstream file(path, std::ios::in);
+      if (!file.is_open())
+         throw Exception(join("Failed to open OBJ: ", path));
+
+      while (!file.eof())
+      {
+         char buf_[256];
+         file.getline(buf_, sizeof(buf_));
+         if (file.bad())
+            throw Exception("Failed to load object!");
+
+         std::string buf(buf_);
+
+         float elems[3];
+         size_t indices[3][3];
+         Attr attr;
+         size_t arr[3] = { vertices.size(), tex_coords.size(), normals.size() };
+
+         std::vector<char> mut_buf(buf.begin(), buf.end());
+         mut_buf.push_back('\0');
+
+         if (get_attr(mut_buf.data(), attr, elems, indices, arr))
+         {
+            switch (attr)
+            {
+               case Vertex:
+               {
+                  std::array<float, 3> arr = {{ elems[0], elems[1], elems[2] }};
+                  vertices.push_back(arr);
+                  break;
+               }
+
+               case Texture:
+               {
+                  std::array<float, 2> arr = {{ elems[0], elems[1] }};
+                  tex_coords.push_back(arr);
+                  break;
+               }
+
+               case Normal:
+               {
+                  std::array<float, 3> arr = {{ elems[0], elems[1], elems[2] }};
+                  normals.push_back(arr);
+                  break;
+               }
+
+               case Elem:
+                  triangles.push_back(triangle_from_indices(vertices, normals, tex_coords, indices));
+                  break;
+            }
+         }
+      }
+
+      return triangles;
+   }
+}
+
+// Creates an empty file with a unique name in $TMPDIR (or /tmp) for the
+// benchmarks that need to load from a path. The caller removes it.
+static std::string temp_path(const std::string &suffix)
+{
+   const char *dir = std::getenv("TMPDIR");
+   std::string path = join(dir && *dir ? dir : "/tmp", "/modelviewer_XXXXXX", suffix);
+
+   std::vector<char> buf(std::begin(path), std::end(path));
+   buf.push_back('\0');
+   int fd = mkstemps(&buf[0], static_cast<int>(suffix.size()));
+   if (fd < 0)
+      throw Exception(join("Failed to create temporary file: ", path));
+   close(fd);
+
+   return &buf[0];
+}
+
+// Times LoadObject() against the old parser on each path and checks that
+// both produce the same triangles. Without paths, test.obj repeated
+// copies times is used. Does not need a GL context.
+static void bench_objects(std::vector<std::string> paths, unsigned copies)
+{
+   typedef std::chrono::duration<double, std::milli> ms;
+
+   bool generated = paths.empty();
+   if (generated)
+   {
+      std::string obj = FileToString("test.obj");
+      paths.push_back(temp_path(".obj"));
+      std::ofstream file(paths.back(), std::ios::out | std::ios::binary);
+      for (unsigned i = 0; i < copies; i++)
+         file << obj;
+   }
+
+   for (auto path = std::begin(paths); path != std::end(paths); ++path)
+   {
+      double mb = MappedFile(*path).size() / (1024.0 * 1024.0);
+      auto report = [mb](const std::string &name, double time) {
+         std::cout << "   " << name << ": " << time << " ms, " << mb * 1000.0 / time << " MB/s" << std::endl;
+      };
+
+      std::cout << *path << ", " << mb << " MB:" << std::endl;
+      auto start = std::chrono::high_resolution_clock::now();
+      auto reference = Reference::load_object(*path);
+      report("getline/strtok parser", std::chrono::duration_cast<ms>(std::chrono::high_resolution_clock::now() - start).count());
+
+      start = std::chrono::high_resolution_clock::now();
+      auto triangles = LoadObject(*path);
+      report("LoadObject", std::chrono::duration_cast<ms>(std::chrono::high_resolution_clock::now() - start).count());
+
+      if (triangles.size() != reference.size() ||
+            std::memcmp(triangles.data(), reference.data(), triangles.size() * sizeof(Geo::Triangle)))
+         std::cout << "   (LoadObject differs from the old parser)" << std::endl;
+      else
+         std::cout << "   " << triangles.size() << " identical triangles" << std::endl;
+   }
+
+   if (generated)
+      std::remove(paths.back().c_str());
+}
+
+// The Targa loader Texture used before GLU::LoadTGA(), as a baseline.
+static Image reference_load_tga(const std::string &path)
+{
+   Image img;
+
+   std::vector<uint8_t> in_file;
+   std::ifstream file(path, std::ios::in | std::ios::binary);
+   file >> std::noskipws;
+   std::copy(std::istream_iterator<uint8_t>(file),
+         std::istream_iterator<uint8_t>(),
+         std::back_inserter(in_file));
+
+   img.width = in_file[12] + in_file[13] * 256;
+   img.height = in_file[14] + in_file[15] * 256;
+   img.pixels.resize(img.width * img.height);
+
+   const uint8_t *tmp = &in_file[18];
+   unsigned bytes = in_file[16] / 8;
+   for (unsigned i = 0; i < img.width * img.height; i++)
+   {
+      uint32_t b = tmp[i * bytes + 0];
+      uint32_t g = tmp[i * bytes + 1];
+      uint32_t r = tmp[i * bytes + 2];
+      uint32_t a = bytes == 4 ? tmp[i * bytes + 3] : 0xff;
+
+      img.pixels[i] = (b << 24) | (g << 16) | (r << 8) | a;
+   }
+
+   return img;
+}
+
+// Run-length encodes the pixels of an uncompressed true color Targa.
+static std::vector<uint8_t> encode_rle_tga(const std::vector<uint8_t> &raw)
+{
+   std::vector<uint8_t> out(raw.begin(), raw.begin() + 18);
+   out[2] = 10;
+
+   unsigned bytes = raw[16] / 8;
+   const uint8_t *px = &raw[18];
+   size_t count = (raw.size() - 18) / bytes;
+   auto same = [px, bytes](size_t a, size_t b) {
+      return std::memcmp(px + a * bytes, px + b * bytes, bytes) == 0;
+   };
+
+   for (size_t i = 0; i < count; )
+   {
+      size_t run = 1;
+      while (i + run < count && run < 128 && same(i, i + run))
+         run++;
+
+      if (run > 1)
+      {
+         out.push_back(0x80 | (run - 1));
+         out.insert(out.end(), px + i * bytes, px + (i + 1) * bytes);
+      }
+      else
+      {
+         while (i + run < count && run < 128 && !same(i + run - 1, i + run))
+            run++;
+         out.push_back(run - 1);
+         out.insert(out.end(), px + i * bytes, px + (i + run) * bytes);
+      }
+      i += run;
+   }
+
+   return out;
+}
+
+static unsigned long long glsym_calls;
+static void glsym_stub()
+{
+   glsym_calls++;
+}
+
+// Times how GLSYM used to find an entry point, a copy of the window
+// shared_ptr and a std::map<std::string, ...> lookup per call, against
+// the gl_functions table load it does now. Both call what they find,
+// which is a stub, so this does not need a GL context.
+static void bench_glsym(unsigned rounds)
+{
+   static const char *names[] = {
+#define GL_FUNC_CORE(sym) #sym,
+#define GL_FUNC(sym) #sym,
+#define GL_FUNC_OPT(sym) #sym,
+#include "gl_functions.hpp"
+#undef GL_FUNC_CORE
+#undef GL_FUNC
+#undef GL_FUNC_OPT
+   };
+
+   std::map<std::string, sgl_function_t> symbols;
+   for (unsigned i = 0; i < GLFunc_Count; i++)
+      symbols[names[i]] = glsym_stub;
+   auto window = std::make_shared<int>(0);
+
+   // The table belongs to the context, so the stubs only stand in here.
+   std::vector<sgl_function_t> saved(gl_functions, gl_functions + GLFunc_Count);
+   std::fill(gl_functions, gl_functions + GLFunc_Count, glsym_stub);
+
+   // What drawing a mesh resolves.
+   static const GLFunction draw[] = {
+      GLFunc_glUseProgram, GLFunc_glBindVertexArray, GLFunc_glBindBuffer,
+      GLFunc_glUniformMatrix4fv, GLFunc_glActiveTexture, GLFunc_glBindTexture,
+      GLFunc_glBindSampler, GLFunc_glDrawElements,
+   };
+   enum { draw_count = sizeof(draw) / sizeof(draw[0]) };
+
+   double map_ms = time_loop(rounds, draw_count, [&](unsigned i) {
+         std::shared_ptr<int> hold = window;
+         symbols[names[draw[i]]]();
+      });
+   double table_ms = time_loop(rounds, draw_count, [&](unsigned i) {
+         gl_functions[draw[i]]();
+      });
+   std::copy(std::begin(saved), std::end(saved), gl_functions);
+
+   double calls = double(rounds) * draw_count;
+   std::cout << "GLSYM dispatch: std::map " << map_ms * 1e6 / calls
+      << " ns, table " << table_ms * 1e6 / calls << " ns per call" << std::endl;
+   if (glsym_calls != 2 * rounds * draw_count)
+      std::cout << "Stub called " << glsym_calls << " times, expected "
+         << 2 * rounds * draw_count << std::endl;
+}
+
+// Writes random 24 and 32-bit Targas and reports how fast the old
+// loader, LoadTGA() and each ConvertBGR() kernel get through them.
+// Then checks RLE, streamed and top origin variants of the same image.
+static void bench_tga(unsigned width, unsigned height)
+{
+   typedef std::chrono::duration<double, std::milli> ms;
+   std::srand(0);
+
+   for (unsigned bits = 24; bits <= 32; bits += 8)
+   {
+      std::vector<uint8_t> file(18 + size_t(width) * height * (bits / 8));
+      file[2] = 2;
+      file[12] = width & 0xff;
+      file[13] = width >> 8;
+      file[14] = height & 0xff;
+      file[15] = height >> 8;
+      file[16] = bits;
+      // Runs of up to 16 equal pixels, so the RLE variant compresses.
+      unsigned bytes = bits / 8;
+      for (size_t i = 18; i < file.size(); )
+      {
+         uint8_t pixel[4] = { uint8_t(std::rand()), uint8_t(std::rand()),
+            uint8_t(std::rand()), uint8_t(std::rand()) };
+         for (unsigned run = 1 + std::rand() % 16; run && i < file.size(); run--, i += bytes)
+            std::copy(pixel, pixel + bytes, &file[i]);
+      }
+
+      std::string path = temp_path(".tga");
+      std::ofstream(path, std::ios::out | std::ios::binary).write(
+            reinterpret_cast<const char*>(&file[0]), file.size());
+
+      double mb = file.size() / (1024.0 * 1024.0);
+      auto report = [mb](const std::string &name, double time) {
+         std::cout << "   " << name << ": " << time << " ms, " << mb * 1000.0 / time << " MB/s" << std::endl;
+      };
+
+      std::cout << width << "x" << height << ", " << bits << "-bit:" << std::endl;
+      auto start = std::chrono::high_resolution_clock::now();
+      auto reference = reference_load_tga(path);
+      report("istream_iterator loader", std::chrono::duration_cast<ms>(std::chrono::high_resolution_clock::now() - start).count());
+
+      start = std::chrono::high_resolution_clock::now();
+      auto image = LoadTGA(path);
+      report("LoadTGA", std::chrono::duration_cast<ms>(std::chrono::high_resolution_clock::now() - start).count());
+      if (image.pixels != reference.pixels)
+         std::cout << "   (LoadTGA differs from the old loader)" << std::endl;
+
+      static const char *kernel_names[] = { "scalar", "SSSE3", "AVX2" };
+      for (unsigned kernel = PixelScalar; kernel <= static_cast<unsigned>(BestPixelKernel()); kernel++)
+      {
+         std::fill(std::begin(image.pixels), std::end(image.pixels), 0);
+         start = std::chrono::high_resolution_clock::now();
+         ConvertBGR(&file[18], bits, image.pixels.size(), &image.pixels[0],
+               static_cast<PixelKernel>(kernel));
+         report(join("ConvertBGR ", kernel_names[kernel]),
+               std::chrono::duration_cast<ms>(std::chrono::high_resolution_clock::now() - start).count());
+         if (image.pixels != reference.pixels)
+            std::cout << "   (results differ from the old loader)" << std::endl;
+      }
+
+      std::remove(path.c_str());
+
+      auto rle = encode_rle_tga(file);
+      start = std::chrono::high_resolution_clock::now();
+      image = DecodeTGA(&rle[0], rle.size());
+      auto time = std::chrono::duration_cast<ms>(std::chrono::high_resolution_clock::now() - start).count();
+      std::cout << "   RLE, " << rle.size() / (1024.0 * 1024.0) << " MB: " << time << " ms, "
+         << mb * 1000.0 / time << " MB/s decoded" << std::endl;
+      if (image.pixels != reference.pixels)
+         std::cout << "   (RLE results differ from the old loader)" << std::endl;
+
+      // Fed in small pieces, splitting packets and pixels.
+      std::fill(std::begin(image.pixels), std::end(image.pixels), 0);
+      auto header = ParseTGAHeader(&rle[0], rle.size(), rle.size());
+      TGADecoder decoder(header, &image.pixels[0]);
+      for (size_t offset = header.data_offset; offset < rle.size(); offset += 4093)
+         decoder.feed(&rle[offset], std::min<size_t>(4093, rle.size() - offset));
+      if (!decoder.done() || image.pixels != reference.pixels)
+         std::cout << "   (streamed RLE results differ from the old loader)" << std::endl;
+
+      // Rows stored top to bottom must come out in the same order.
+      size_t row_size = size_t(width) * bytes;
+      for (unsigned y = 0; y < height / 2; y++)
+         std::swap_ranges(&file[18 + y * row_size], &file[18 + (y + 1) * row_size],
+               &file[18 + (height - 1 - y) * row_size]);
+      file[17] |= 0x20;
+      image = DecodeTGA(&file[0], file.size());
+      if (image.pixels != reference.pixels)
+         std::cout << "   (top origin results differ from the old loader)" << std::endl;
+   }
+}
+
+// Times the mip chain of a width x height image for each filter, on one
+// thread and split across threads, and loading it back from a .mips file.
+static void bench_mipmaps(unsigned width, unsigned height)
+{
+   typedef std::chrono::duration<double, std::milli> ms;
+   std::srand(0);
+
+   Image base;
+   base.width = width;
+   base.height = height;
+   base.pixels.resize(size_t(width) * height);
+   for (size_t i = 0; i < base.pixels.size(); i++)
+      base.pixels[i] = (uint32_t(std::rand() & 0xffff) << 16) | (std::rand() & 0xffff);
+
+   static const char *filter_names[] = { "box", "Kaiser" };
+   std::vector<Image> levels;
+   for (unsigned filter = MipBox; filter <= MipKaiser; filter++)
+   {
+      for (unsigned threaded = 0; threaded < 2; threaded++)
+      {
+         auto start = std::chrono::high_resolution_clock::now();
+         levels = GenerateMipmaps(base, static_cast<MipFilter>(filter), true, threaded);
+         auto time = std::chrono::duration_cast<ms>(std::chrono::high_resolution_clock::now() - start).count();
+         std::cout << width << "x" << height << " " << filter_names[filter]
+            << (threaded ? ", threaded: " : ", one thread: ") << time << " ms, "
+            << levels.size() << " levels" << std::endl;
+      }
+   }
+
+   // The cache is keyed by the source file, so one has to exist.
+   std::string path = temp_path(".tga");
+   std::ofstream(path, std::ios::out | std::ios::binary).put(0);
+   SaveMipCache(path, levels, MipKaiser, true);
+   std::vector<Image> cached;
+   auto start = std::chrono::high_resolution_clock::now();
+   bool hit = LoadMipCache(path, MipKaiser, true, cached);
+   auto time = std::chrono::duration_cast<ms>(std::chrono::high_resolution_clock::now() - start).count();
+   std::cout << "Loading " << MipCachePath(path) << ": " << time << " ms" << std::endl;
+   if (!hit || cached.size() != levels.size() || cached.back().pixels != levels.back().pixels)
+      std::cout << "   (cached levels differ)" << std::endl;
+
+   std::remove(MipCachePath(path).c_str());
+   std::remove(path.c_str());
+}
+
+// Encodes each Targa, or a synthetic width x height image without any,
+// to every block format on one thread and split across threads.
+// Reports throughput and PSNR, BC1 without alpha. Needs no GL context.
+static void bench_blocks(const std::vector<std::string> &paths,
+      unsigned width, unsigned height)
+{
+   typedef std::chrono::duration<double, std::milli> ms;
+
+   std::vector<std::pair<std::string, Image>> images;
+   for (auto path = std::begin(paths); path != std::end(paths); ++path)
+      images.push_back(std::make_pair(*path, LoadTGA(*path)));
+
+   if (images.empty())
+   {
+      // Gradients with a little noise, closer to real textures than noise alone.
+      std::srand(0);
+      Image image;
+      image.width = width;
+      image.height = height;
+      image.pixels.resize(size_t(width) * height);
+      for (unsigned y = 0; y < height; y++)
+      {
+         for (unsigned x = 0; x < width; x++)
+         {
+            int noise = std::rand() % 9 - 4;
+            uint32_t r = x * 255 / width;
+            uint32_t g = y * 255 / height;
+            uint32_t b = std::min(255, std::max(0,
+                     int(128.0f + 120.0f * std::sin((x + y) / 16.0f)) + noise));
+            uint32_t a = 255 - r / 2;
+            image.pixels[size_t(y) * width + x] = (b << 24) | (g << 16) | (r << 8) | a;
+         }
+      }
+      images.push_back(std::make_pair(join("synthetic ", width, "x", height), image));
+   }
+
+   for (auto image = std::begin(images); image != std::end(images); ++image)
+   {
+      std::cout << image->first << ":" << std::endl;
+      double mpix = image->second.pixels.size() / 1000000.0;
+      for (unsigned format = BlockBC1; format <= BlockBC7; format++)
+      {
+         for (unsigned threaded = 0; threaded < 2; threaded++)
+         {
+            auto start = std::chrono::high_resolution_clock::now();
+            auto blocks = CompressImage(image->second, static_cast<BlockFormat>(format), threaded);
+            auto time = std::chrono::duration_cast<ms>(std::chrono::high_resolution_clock::now() - start).count();
+
+            double psnr = PSNR(image->second, DecompressImage(blocks), format != BlockBC1);
+            std::cout << "   " << BlockFormatName(static_cast<BlockFormat>(format))
+               << (threaded ? ", threaded: " : ", one thread: ") << time << " ms, "
+               << mpix * 1000.0 / time << " MPix/s, PSNR " << psnr << " dB" << std::endl;
+         }
+      }
+   }
+}
+
+// Stores the mip chain of each Targa next to it, and with a block format
+// the compressed chain as well, so Texture can skip generating them at startup.
+static void bake_mipmaps(const std::vector<std::string> &paths, BlockFormat compression)
+{
+   for (auto path = std::begin(paths); path != std::end(paths); ++path)
+   {
+      auto levels = GenerateMipmaps(LoadTGA(*path));
+      SaveMipCache(*path, levels, MipBox, true);
+      std::cout << "Wrote " << MipCachePath(*path) << std::endl;
+
+      if (compression != BlockNone)
+      {
+         SaveBlockCache(*path, CompressMipmaps(levels, compression));
+         std::cout << "Wrote " << BlockCachePath(*path, compression) << std::endl;
+      }
    }
 }
 
 int main(int argc, char *argv[])
 {
-   if (argc < 2)
+   if (argc >= 2 && std::strcmp(argv[1], "--bench-queue") == 0)
+   {
+      bench_render_queue(100000);
+      return 0;
+   }
+
+   if (argc >= 2 && std::strcmp(argv[1], "--bench-cull") == 0)
+   {
+      bench_culling(1000000);
+      return 0;
+   }
+
+   if (argc >= 2 && std::strcmp(argv[1], "--bench-matrix") == 0)
+   {
+      bench_matrix(1000000);
+      return 0;
+   }
+
+   if (argc >= 2 && std::strcmp(argv[1], "--bench-obj") == 0)
+   {
+      try
+      {
+         bench_objects(std::vector<std::string>(argv + 2, argv + argc), 200);
+      }
+      catch (const Exception& e)
+      {
+         std::cerr << e.what() << std::endl;
+         return 1;
+      }
+      return 0;
+   }
+
+   if (argc >= 2 && std::strcmp(argv[1], "--bench-glsym") == 0)
+   {
+      bench_glsym(1000000);
+      return 0;
+   }
+
+   if (argc >= 2 && std::strcmp(argv[1], "--bench-tga") == 0)
+   {
+      bench_tga(4096, 4096);
+      return 0;
+   }
+
+   if (argc >= 2 && std::strcmp(argv[1], "--bench-mips") == 0)
+   {
+      bench_mipmaps(4096, 4096);
+      return 0;
+   }
+
+   if (argc >= 2 && std::strcmp(argv[1], "--bench-bc") == 0)
    {
-      std::cerr << "Usage: " << argv[0] << " <Object> [<Objects>]" << std::endl;
+      try
+      {
+         bench_blocks(std::vector<std::string>(argv + 2, argv + argc), 4096, 4096);
+      }
+      catch (const Exception& e)
+      {
+         std::cerr << e.what() << std::endl;
+         return 1;
+      }
+      return 0;
+   }
+
+   bool cache_stats = argc >= 2 && std::strcmp(argv[1], "--cache-stats") == 0;
+   bool batched = argc >= 2 && std::strcmp(argv[1], "--batch") == 0;
+   bool bake_mips = argc >= 2 && std::strcmp(argv[1], "--bake-mips") == 0;
+   int first_path = cache_stats || batched || bake_mips ? 2 : 1;
+
+   static const char *compression_flags[] = { "", "--bc1", "--bc3", "--bc7" };
+   BlockFormat compression = BlockNone;
+   for (unsigned format = BlockBC1; format <= BlockBC7 && argc > first_path; format++)
+   {
+      if (std::strcmp(argv[first_path], compression_flags[format]) == 0)
+      {
+         compression = static_cast<BlockFormat>(format);
+         first_path++;
+         break;
+      }
+   }
+
+   bool atlas = argc > first_path && std::strcmp(argv[first_path], "--atlas") == 0;
+   if (atlas)
+      first_path++;
+
+   size_t texture_budget = size_t(512) << 20;
+   if (argc > first_path + 1 && std::strcmp(argv[first_path], "--texture-budget") == 0)
+   {
+      texture_budget = size_t(std::strtoul(argv[first_path + 1], nullptr, 10)) << 20;
+      first_path += 2;
+   }
+
+   if (argc <= first_path)
+   {
+      std::cerr << "Usage: " << argv[0] << " [--cache-stats | --batch] [--bc1 | --bc3 | --bc7 | --atlas] [--texture-budget <MB>] <Object> [<Objects>]" << std::endl;
+      std::cerr << "       " << argv[0] << " --bake-mips [--bc1 | --bc3 | --bc7] <Targa> [<Targas>]" << std::endl;
+      std::cerr << "       " << argv[0] << " --bench-bc [<Targas>]" << std::endl;
+      std::cerr << "       " << argv[0] << " --bench-obj [<Objects>]" << std::endl;
+      std::cerr << "       " << argv[0] << " --bench-queue | --bench-cull | --bench-matrix | --bench-glsym | --bench-tga | --bench-mips" << std::endl;
       return 1;
    }
 
    try
    {
       std::vector<std::string> paths;
-      for (int i = 1; i < argc; i++)
+      for (int i = first_path; i < argc; i++)
          paths.push_back(argv[i]);
 
-      gl_prog(paths);
+      if (cache_stats)
+         print_cache_stats(paths);
+      else if (bake_mips)
+         bake_mipmaps(paths, compression);
+      else
+      {
+         Texture::set_compression(compression);
+         gl_prog(paths, batched, texture_budget, atlas);
+      }
    }
    catch (const Exception& e)
    {
@@ -1,42 +1,253 @@
 #include "texture.hpp"
+#include "texture_stream.hpp"
+#include "image.hpp"
 #include <string>
 #include <algorithm>
-#include <iostream>
-#include <fstream>
-#include <iterator>
 
 namespace GL
 {
-   std::list<Texture *> Texture::bound_textures;
+   Texture *Texture::units[Texture::max_units];
+   GLuint Texture::samplers[2][3];
+   GLU::BlockFormat Texture::compression = GLU::BlockNone;
+   TextureStreamer *Texture::streamer = nullptr;
+   uint64_t Texture::use_frame = 0;
 
-   Texture::Texture(const std::string &path) : obj(0), bound_index(-1)
+   GLenum Texture::gl_block_format(GLU::BlockFormat format)
    {
-      auto image = load_tga(path);
+      switch (format)
+      {
+         case GLU::BlockBC1:
+            return GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+         case GLU::BlockBC3:
+            return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+         case GLU::BlockBC7:
+            return GL_COMPRESSED_RGBA_BPTC_UNORM_ARB;
+         default:
+            throw Exception("Invalid block format!");
+      }
+   }
+
+   void Texture::load_levels(const std::string &path, GLU::BlockFormat format,
+         std::vector<GLU::Image> &levels, std::vector<GLU::CompressedImage> &blocks)
+   {
+      if (format != GLU::BlockNone && !GLU::LoadBlockCache(path, format, blocks))
+      {
+         blocks = GLU::CompressMipmaps(GLU::LoadTGAMipmaps(path), format);
+         // Only a missed speedup on the next run if the directory is read-only.
+         try
+         {
+            GLU::SaveBlockCache(path, blocks);
+         }
+         catch (const Exception&)
+         {}
+      }
+
+      // The whole chain is ready before the first upload, so levels
+      // can go up one at a time without glGenerateMipmap stalling the driver.
+      if (blocks.empty())
+         levels = GLU::LoadTGAMipmaps(path);
+   }
+
+   GLuint Texture::create(const std::vector<GLU::Image> &levels,
+         const std::vector<GLU::CompressedImage> &blocks, unsigned first_level)
+   {
+      GLuint object;
+      GLSYM(glGenTextures)(1, &object);
+
+      GLuint previous = State::bound_texture(0, GL_TEXTURE_2D);
+      State::bind_texture(0, GL_TEXTURE_2D, object);
+      for (unsigned i = first_level; i < blocks.size(); i++)
+      {
+         GLSYM(glCompressedTexImage2D)(GL_TEXTURE_2D, i - first_level,
+               gl_block_format(blocks[i].format), blocks[i].width, blocks[i].height, 0,
+               blocks[i].blocks.size(), blocks[i].blocks.data());
+      }
+      for (unsigned i = first_level; i < levels.size(); i++)
+      {
+         GLSYM(glTexImage2D)(GL_TEXTURE_2D, i - first_level, GL_RGBA,
+               levels[i].width, levels[i].height, 0,
+               GL_BGRA, GL_UNSIGNED_INT_8_8_8_8, levels[i].pixels.data());
+      }
+      GLSYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+            std::max(blocks.size(), levels.size()) - first_level - 1);
+      State::bind_texture(0, GL_TEXTURE_2D, previous);
+
+      return object;
+   }
+
+   Texture::Texture(const std::string &path)
+      : obj(0), bound_index(-1), stream(nullptr), path(path), format(compression),
+         width(0), height(0), levels(0), first_level(0), last_use(use_frame)
+   {
+      if (format != GLU::BlockNone && !compression_supported(format))
+         format = GLU::BlockNone;
+
+      if (streamer)
+      {
+         std::vector<GLU::Image> placeholder(1);
+         placeholder[0].width = placeholder[0].height = 1;
+         placeholder[0].pixels.assign(1, 0xffffffff);
+         adopt(create(placeholder, std::vector<GLU::CompressedImage>(), 0), 1, 1, 1, 0);
+      }
+
+      load(0);
+   }
+
+   Texture::Texture(const std::vector<GLU::Image> &chain)
+      : obj(0), bound_index(-1), stream(nullptr), format(GLU::BlockNone),
+         width(0), height(0), levels(0), first_level(0), last_use(use_frame)
+   {
+      if (chain.empty())
+         throw Exception("Texture needs at least one level!");
+
+      adopt(create(chain, std::vector<GLU::CompressedImage>(), 0),
+            chain[0].width, chain[0].height, chain.size(), 0);
+   }
+
+   void Texture::load(unsigned first)
+   {
+      TextureStreamer *target = stream ? stream : streamer;
+      if (target)
+      {
+         // A newer request replaces a pending one.
+         if (stream)
+            stream->cancel(this);
+         stream = target;
+         stream->load(this, path, format, first);
+         return;
+      }
+
+      std::vector<GLU::Image> levels;
+      std::vector<GLU::CompressedImage> blocks;
+      load_levels(path, format, levels, blocks);
+
+      unsigned count = std::max(levels.size(), blocks.size());
+      first = std::min(first, count - 1);
+      if (blocks.empty())
+         adopt(create(levels, blocks, first), levels[first].width, levels[first].height, count - first, first);
+      else
+         adopt(create(levels, blocks, first), blocks[first].width, blocks[first].height, count - first, first);
+   }
+
+   bool Texture::copy_supported()
+   {
+      static bool supported = GLSYM_AVAILABLE(glCopyImageSubData) &&
+         HasExtension("GL_ARB_copy_image");
+      return supported;
+   }
+
+   void Texture::trim()
+   {
+      GLuint object;
+      GLSYM(glGenTextures)(1, &object);
+
+      GLuint previous = State::bound_texture(0, GL_TEXTURE_2D);
+      State::bind_texture(0, GL_TEXTURE_2D, object);
+      for (unsigned i = 1; i < levels; i++)
+      {
+         unsigned w = std::max(1u, width >> i);
+         unsigned h = std::max(1u, height >> i);
+         if (format == GLU::BlockNone)
+         {
+            GLSYM(glTexImage2D)(GL_TEXTURE_2D, i - 1, GL_RGBA, w, h, 0,
+                  GL_BGRA, GL_UNSIGNED_INT_8_8_8_8, nullptr);
+         }
+         else
+         {
+            GLSYM(glCompressedTexImage2D)(GL_TEXTURE_2D, i - 1, gl_block_format(format), w, h, 0,
+                  ((w + 3) / 4) * ((h + 3) / 4) * GLU::BlockSize(format), nullptr);
+         }
+         GLSYM(glCopyImageSubData)(obj, GL_TEXTURE_2D, i, 0, 0, 0,
+               object, GL_TEXTURE_2D, i - 1, 0, 0, 0, w, h, 1);
+      }
+      GLSYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 2);
+      State::bind_texture(0, GL_TEXTURE_2D, previous);
+
+      adopt(object, std::max(1u, width >> 1), std::max(1u, height >> 1), levels - 1, first_level + 1);
+   }
+
+   void Texture::adopt(GLuint object, unsigned width_, unsigned height_,
+         unsigned levels_, unsigned first_level_)
+   {
+      // The old object is deleted below.
+      unbind();
+      if (obj)
+      {
+         State::deleted_texture(obj);
+         GLSYM(glDeleteTextures)(1, &obj);
+      }
+
+      obj = object;
+      stream = nullptr;
+      width = width_;
+      height = height_;
+      levels = levels_;
+      first_level = first_level_;
+   }
+
+   size_t Texture::memory() const
+   {
+      size_t total = 0;
+      for (unsigned i = 0; i < levels; i++)
+      {
+         unsigned w = std::max(1u, width >> i);
+         unsigned h = std::max(1u, height >> i);
+         if (format == GLU::BlockNone)
+            total += size_t(w) * h * 4;
+         else
+            total += size_t((w + 3) / 4) * ((h + 3) / 4) * GLU::BlockSize(format);
+      }
+      return total;
+   }
+
+   void Texture::set_compression(GLU::BlockFormat format)
+   {
+      compression = format;
+   }
 
-      GLSYM(glGenTextures)(1, &obj);
+   GLU::BlockFormat Texture::get_compression()
+   {
+      return compression;
+   }
 
-      auto itr = std::find_if(std::begin(bound_textures), std::end(bound_textures),
-            [](const Texture *tex) { return tex->bound_index == 0; });
+   bool Texture::compression_supported(GLU::BlockFormat format)
+   {
+      switch (format)
+      {
+         case GLU::BlockBC1:
+         case GLU::BlockBC3:
+            return HasExtension("GL_EXT_texture_compression_s3tc");
+         case GLU::BlockBC7:
+            return HasExtension("GL_ARB_texture_compression_bptc");
+         default:
+            return false;
+      }
+   }
 
-      Texture *rebind_tex = nullptr;
-      if (itr != std::end(bound_textures))
-         rebind_tex = *itr;
+   void Texture::set_streamer(TextureStreamer *streamer_)
+   {
+      streamer = streamer_;
+   }
 
-      GLSYM(glActiveTexture)(GL_TEXTURE0);
-      GLSYM(glBindTexture)(GL_TEXTURE_2D, obj);
-      GLSYM(glTexImage2D)(GL_TEXTURE_2D, 0, GL_RGBA,
-            image.width, image.height, 0,
-            GL_BGRA, GL_UNSIGNED_INT_8_8_8_8, &image.pixels[0]);
-      GLSYM(glGenerateMipmap)(GL_TEXTURE_2D);
+   TextureStreamer *Texture::get_streamer()
+   {
+      return streamer;
+   }
 
-      GLSYM(glBindTexture)(GL_TEXTURE_2D, rebind_tex ? rebind_tex->obj : 0);
+   bool Texture::resident() const
+   {
+      return !stream;
    }
 
    Texture::~Texture()
    {
+      if (stream)
+         stream->cancel(this);
+
       if (obj)
       {
          unbind();
+         State::deleted_texture(obj);
          GLSYM(glDeleteTextures)(1, &obj);
       }
    }
@@ -46,7 +257,7 @@ namespace GL
       switch (edge)
       {
          case Texture::Clamp:
-            return GL_CLAMP;
+            return GL_CLAMP_TO_EDGE;
          case Texture::ClampToBorder:
             return GL_CLAMP_TO_BORDER;
          case Texture::Repeat:
@@ -69,95 +280,74 @@ namespace GL
       }
    }
 
+   GLuint Texture::sampler(Texture::Filter filter, Texture::Edge edge)
+   {
+      GLint wrap = gl_edge(edge);
+      GLint mag = gl_filter(filter);
+      GLuint &sampler = samplers[filter][edge];
+      if (sampler)
+         return sampler;
+
+      GLSYM(glGenSamplers)(1, &sampler);
+      GLSYM(glSamplerParameteri)(sampler, GL_TEXTURE_WRAP_S, wrap);
+      GLSYM(glSamplerParameteri)(sampler, GL_TEXTURE_WRAP_T, wrap);
+      GLSYM(glSamplerParameteri)(sampler, GL_TEXTURE_MAG_FILTER, mag);
+      GLSYM(glSamplerParameteri)(sampler, GL_TEXTURE_MIN_FILTER,
+            filter == Linear ? GL_LINEAR_MIPMAP_LINEAR : GL_NEAREST_MIPMAP_NEAREST);
+      return sampler;
+   }
+
    void Texture::bind(unsigned index, Texture::Filter filter, Texture::Edge edge)
    {
-      if (bound_index >= 0)
-         throw Exception("Binding one texture to several units currently not supported!");
+      last_use = use_frame;
 
-      auto itr = std::find_if(std::begin(bound_textures), std::end(bound_textures),
-            [index](const Texture *tex) { return tex->bound_index == static_cast<int>(index); });
-      if (itr != std::end(bound_textures))
-         throw Exception("A texture is already bound to this texture unit!");
+      if (index >= max_units)
+         throw Exception("Texture unit out of range!");
 
-      bound_index = index;
+      // Filtering and wrapping belong to the unit, not the texture.
+      State::bind_sampler(index, sampler(filter, edge));
 
-      bound_textures.push_back(this);
+      if (bound_index != static_cast<int>(index))
+      {
+         // Other code binds through State directly, so only a unit that
+         // still holds this object counts as taken.
+         if (bound_index >= 0 && State::bound_texture(bound_index, GL_TEXTURE_2D) == obj)
+            throw Exception("Binding one texture to several units currently not supported!");
+
+         if (bound_index >= 0)
+            units[bound_index] = nullptr;
+         if (units[index])
+            units[index]->bound_index = -1;
+         units[index] = this;
+         bound_index = index;
+      }
 
-      GLSYM(glActiveTexture)(GL_TEXTURE0 + bound_index);
-      GLSYM(glBindTexture)(GL_TEXTURE_2D, obj);
-      GLSYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, gl_edge(edge));
-      GLSYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, gl_edge(edge));
-      GLSYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-      GLSYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+      // Elided by State when still bound from the previous draw.
+      State::bind_texture(index, GL_TEXTURE_2D, obj);
    }
 
    void Texture::unbind()
    {
       if (bound_index >= 0)
       {
-         bound_textures.erase(std::find_if(std::begin(bound_textures), std::end(bound_textures),
-                  [this](const Texture *tex) { return this == tex; }));
-
-         GLSYM(glActiveTexture)(GL_TEXTURE0 + bound_index);
-         GLSYM(glBindTexture)(GL_TEXTURE_2D, 0);
+         units[bound_index] = nullptr;
+         // Leave the unit alone if something else was bound to it since.
+         if (State::bound_texture(bound_index, GL_TEXTURE_2D) == obj)
+            State::bind_texture(bound_index, GL_TEXTURE_2D, 0);
       }
 
       bound_index = -1;
    }
 
-   Texture::Image Texture::load_tga(const std::string &path)
+   void Texture::unbind(unsigned index)
    {
-      Image img;
-
-      std::vector<uint8_t> in_file;
-      std::ifstream file(path, std::ios::in | std::ios::binary);
-      if (!file.is_open())
-         throw Exception(GLU::join("Cannot open file: ", path));
-
-      file >> std::noskipws;
-      std::copy(std::istream_iterator<uint8_t>(file),
-            std::istream_iterator<uint8_t>(),
-            std::back_inserter(in_file));
-
-      if (in_file[2] != 2)
-         throw Exception("Uncompressed RGB Targa not supported.");
-
-      img.width = in_file[12] + in_file[13] * 256;
-      img.height = in_file[14] + in_file[15] * 256;
-
-      img.pixels.resize(img.width * img.height);
-
-      const uint8_t *tmp = &in_file[18];
-      unsigned bits = in_file[16];
-
-      if (bits == 32)
-      {
-         for (unsigned i = 0; i < img.width * img.height; i++)
-         {
-            uint32_t b = tmp[i * 4 + 0];
-            uint32_t g = tmp[i * 4 + 1];
-            uint32_t r = tmp[i * 4 + 2];
-            uint32_t a = tmp[i * 4 + 3];
-
-            img.pixels[i] = (b << 24) | (g << 16) | (r << 8) | a;
-         }
-      }
-      else if (bits == 24)
-      {
-         for (unsigned i = 0; i < img.width * img.height; i++)
-         {
-            uint32_t b = tmp[i * 3 + 0];
-            uint32_t g = tmp[i * 3 + 1];
-            uint32_t r = tmp[i * 3 + 2];
-            uint32_t a = 0xff;
-
-            img.pixels[i] = (b << 24) | (g << 16) | (r << 8) | a;
-         }
-      }
-      else
-         throw Exception(GLU::join("Targa with bit depth ", bits, " not supported!"));
+      if (index < max_units && units[index])
+         units[index]->unbind();
+   }
 
-      return img;
+   GLuint Texture::object() const
+   {
+      return obj;
    }
 
    RenderBuffer::RenderBuffer()
@@ -173,7 +363,7 @@ namespace GL
       GLSYM(glGenFramebuffers)(1, &fb_obj);
       GLSYM(glGenTextures)(1, &tex);
       GLSYM(glGenRenderbuffers)(1, &render_buffer);
-      GLSYM(glBindTexture)(GL_TEXTURE_2D, tex);
+      State::bind_texture(0, GL_TEXTURE_2D, tex);
 
       GLSYM(glTexImage2D)(GL_TEXTURE_2D,
             0, GL_RGBA,
@@ -184,7 +374,7 @@ namespace GL
       GLSYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
       GLSYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
       GLSYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-      GLSYM(glBindTexture)(GL_TEXTURE_2D, 0);
+      State::bind_texture(0, GL_TEXTURE_2D, 0);
 
       GLSYM(glBindRenderbuffer)(GL_RENDERBUFFER, render_buffer);
       GLSYM(glRenderbufferStorage)(GL_RENDERBUFFER,
@@ -192,7 +382,7 @@ namespace GL
             width, height);
       GLSYM(glBindRenderbuffer)(GL_RENDERBUFFER, 0);
 
-      GLSYM(glBindFramebuffer)(GL_FRAMEBUFFER, fb_obj);
+      State::bind_framebuffer(fb_obj);
       GLSYM(glFramebufferTexture2D)(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
             GL_TEXTURE_2D, tex, 0);
       GLSYM(glFramebufferRenderbuffer)(GL_FRAMEBUFFER,
@@ -205,31 +395,31 @@ namespace GL
          throw Exception("Framebuffer is not complete!");
       }
 
-      GLSYM(glBindFramebuffer)(GL_FRAMEBUFFER, 0);
+      State::bind_framebuffer(0);
    }
 
    void RenderBuffer::bind()
    {
-      GLSYM(glBindFramebuffer)(GL_FRAMEBUFFER, fb_obj);
+      State::bind_framebuffer(fb_obj);
    }
 
    void RenderBuffer::bind_texture(unsigned index)
    {
-      GLSYM(glActiveTexture)(GL_TEXTURE0 + index);
-      GLSYM(glBindTexture)(GL_TEXTURE_2D, tex);
+      // A sampler left by a Texture would override the parameters set here.
+      State::bind_sampler(index, 0);
+      State::bind_texture(index, GL_TEXTURE_2D, tex);
       bound_index = index;
    }
 
    void RenderBuffer::unbind_texture()
    {
-      GLSYM(glActiveTexture)(GL_TEXTURE0 + bound_index);
-      GLSYM(glBindTexture)(GL_TEXTURE_2D, 0);
+      State::bind_texture(bound_index, GL_TEXTURE_2D, 0);
       bound_index = 0;
    }
 
    void RenderBuffer::unbind()
    {
-      GLSYM(glBindFramebuffer)(GL_FRAMEBUFFER, 0);
+      State::bind_framebuffer(0);
    }
 
    void RenderBuffer::size(unsigned &width, unsigned &height) const
@@ -240,6 +430,8 @@ namespace GL
 
    RenderBuffer::~RenderBuffer()
    {
+      State::deleted_framebuffer(fb_obj);
+      State::deleted_texture(tex);
       GLSYM(glDeleteFramebuffers)(1, &fb_obj);
       GLSYM(glDeleteTextures)(1, &tex);
       GLSYM(glDeleteRenderbuffers)(1, &render_buffer);
@@ -250,7 +442,7 @@ namespace GL
    {
       this->width = width;
       this->height = height;
-      GLSYM(glBindTexture)(GL_TEXTURE_2D, tex);
+      State::bind_texture(0, GL_TEXTURE_2D, tex);
       GLSYM(glTexImage2D)(GL_TEXTURE_2D,
             0, GL_DEPTH_COMPONENT32F,
             width, height,
@@ -261,9 +453,9 @@ namespace GL
       GLSYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
       GLSYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_R_TO_TEXTURE);
       GLSYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
-      GLSYM(glBindTexture)(GL_TEXTURE_2D, 0);
+      State::bind_texture(0, GL_TEXTURE_2D, 0);
 
-      GLSYM(glBindFramebuffer)(GL_FRAMEBUFFER, fb_obj);
+      State::bind_framebuffer(fb_obj);
 
       GLSYM(glFramebufferTexture2D)(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
             GL_TEXTURE_2D, tex, 0);
@@ -275,7 +467,7 @@ namespace GL
          throw Exception("Framebuffer is not complete!");
       }
 
-      GLSYM(glBindFramebuffer)(GL_FRAMEBUFFER, 0);
+      State::bind_framebuffer(0);
    }
 }
 
@@ -3,17 +3,25 @@
 
 #include "gl.hpp"
 #include "utils.hpp"
-#include <list>
+#include "state.hpp"
+#include "compress.hpp"
 #include <vector>
 #include <utility>
 #include <stdint.h>
 
 namespace GL
 {
+   class TextureStreamer;
+
    class Texture : public GLResource
    {
       public:
+         // With a streamer set, returns right away with a white 1x1
+         // placeholder, and the streamer swaps in the real image later.
          Texture(const std::string &path);
+         // Uploads a chain built in memory, base level first. Such textures
+         // have no path to reload from, so they can't go in a TextureCache.
+         Texture(const std::vector<GLU::Image> &levels);
          ~Texture();
 
          enum Edge { Clamp, ClampToBorder, Repeat };
@@ -23,22 +31,77 @@ namespace GL
                Filter filt = Linear,
                Edge edge = Repeat);
          void unbind();
+         // Unbinds whichever Texture is bound to unit index.
+         static void unbind(unsigned index);
+         GLuint object() const;
+
+         // Textures created afterwards are uploaded in format if the driver
+         // supports it. The chain is compressed on first use and cached next
+         // to the source, see GLU::SaveBlockCache(). Defaults to BlockNone.
+         static void set_compression(GLU::BlockFormat format);
+         static GLU::BlockFormat get_compression();
+         static bool compression_supported(GLU::BlockFormat format);
+
+         // Textures created afterwards are loaded by streamer, nullptr loads
+         // them in the constructor again. Not owned.
+         static void set_streamer(TextureStreamer *streamer);
+         static TextureStreamer *get_streamer();
+         // False while a load is pending. Until it completes the texture
+         // shows the placeholder, or the levels it had before.
+         bool resident() const;
+
+         // Bytes of texture memory the uploaded levels take.
+         size_t memory() const;
 
       private:
+         friend class TextureStreamer;
+         friend class TextureCache;
+
          void operator=(const Texture&);
          GLuint obj;
          int bound_index;
+         TextureStreamer *stream;
+
+         std::string path;
+         GLU::BlockFormat format;
+         // Size of GL level 0, which is level first_level of the full chain.
+         unsigned width, height;
+         unsigned levels;
+         unsigned first_level;
+         // use_frame when last bound.
+         uint64_t last_use;
+
+         // Uploads levels [first_level, end) of the chain as a new texture,
+         // through the streamer if there is one.
+         void load(unsigned first_level);
+         // Drops the top level by copying the others into a new object on
+         // the GPU. Needs copy_supported().
+         void trim();
+         static bool copy_supported();
+         // Replaces the current object once every level of object is uploaded.
+         void adopt(GLuint object, unsigned width, unsigned height,
+               unsigned levels, unsigned first_level);
+         static GLuint create(const std::vector<GLU::Image> &levels,
+               const std::vector<GLU::CompressedImage> &blocks, unsigned first_level);
 
-         static std::list<Texture *> bound_textures;
+         // Decodes path, or the block cache for format if there is one, and
+         // fills either levels or blocks. Safe to call from any thread.
+         static void load_levels(const std::string &path, GLU::BlockFormat format,
+               std::vector<GLU::Image> &levels, std::vector<GLU::CompressedImage> &blocks);
+         static GLenum gl_block_format(GLU::BlockFormat format);
 
-         struct Image
-         {
-            unsigned width;
-            unsigned height;
-            std::vector<uint32_t> pixels;
-         };
+         static GLU::BlockFormat compression;
+         static TextureStreamer *streamer;
+         // Advanced by TextureCache::update().
+         static uint64_t use_frame;
 
-         Image load_tga(const std::string &path);
+         enum { max_units = 32 };
+         // The Texture bound to each unit, bound_index is its index here.
+         static Texture *units[max_units];
+         // One sampler object per Filter and Edge, created on first use and
+         // kept for the lifetime of the context.
+         static GLuint samplers[2][3];
+         static GLuint sampler(Filter filter, Edge edge);
    };
 
    class RenderBuffer : public GLResource
@@ -0,0 +1,136 @@
+#include "texture_cache.hpp"
+#include <algorithm>
+#include <vector>
+
+namespace GL
+{
+   TextureCache *TextureCache::current = nullptr;
+
+   TextureCache::TextureCache(size_t budget) : budget(budget)
+   {
+      counters = Stats();
+   }
+
+   TextureCache::~TextureCache()
+   {
+      if (current == this)
+         current = nullptr;
+   }
+
+   std::shared_ptr<Texture> TextureCache::get(const std::string &path)
+   {
+      auto &tex = textures[path];
+      if (tex)
+      {
+         counters.hits++;
+         return tex;
+      }
+
+      counters.misses++;
+      tex = std::make_shared<Texture>(path);
+      return tex;
+   }
+
+   void TextureCache::set_budget(size_t budget_)
+   {
+      budget = budget_;
+   }
+
+   void TextureCache::update()
+   {
+      typedef std::map<std::string, std::shared_ptr<Texture>>::iterator Entry;
+
+      // Binds from now on count towards the next frame.
+      uint64_t frame = Texture::use_frame++;
+
+      // Without a streamer a reload decodes on this thread, so only one
+      // goes per frame to spread the cost out.
+      unsigned reloads = Texture::streamer ? ~0u : 1;
+
+      size_t total = 0;
+      std::vector<Entry> candidates;
+      for (auto entry = std::begin(textures); entry != std::end(textures); ++entry)
+      {
+         Texture &tex = *entry->second;
+         if (tex.first_level && tex.resident() && tex.last_use == frame && reloads)
+         {
+            tex.load(0);
+            counters.reloads++;
+            reloads--;
+         }
+
+         total += tex.memory();
+         if (entry->second.use_count() == 1 || frame - tex.last_use >= idle_frames)
+            candidates.push_back(entry);
+      }
+
+      if (total <= budget)
+         return;
+
+      // Trimming never goes back to the source on this thread, it either
+      // copies the remaining levels on the GPU or loads them in the background.
+      bool copy = Texture::copy_supported();
+      bool trim = copy || Texture::streamer;
+
+      // Textures nothing else holds go first, then the least recently bound.
+      std::sort(std::begin(candidates), std::end(candidates), [](const Entry &a, const Entry &b) {
+            bool a_unused = a->second.use_count() == 1;
+            bool b_unused = b->second.use_count() == 1;
+            if (a_unused != b_unused)
+               return a_unused;
+            return a->second->last_use < b->second->last_use;
+         });
+
+      for (auto entry = std::begin(candidates); entry != std::end(candidates) && total > budget; ++entry)
+      {
+         Texture &tex = *(*entry)->second;
+         if ((*entry)->second.use_count() == 1)
+         {
+            total -= tex.memory();
+            textures.erase(*entry);
+            counters.evictions++;
+         }
+         else if (trim && tex.resident() && tex.levels > 1 &&
+               std::max(tex.width, tex.height) > static_cast<unsigned>(min_size))
+         {
+            // Each level is a quarter of the one above.
+            size_t size = tex.memory();
+            if (copy)
+               tex.trim();
+            else
+               tex.load(tex.first_level + 1);
+            total -= size - size / 4;
+            counters.evictions++;
+         }
+      }
+   }
+
+   TextureCache::Stats TextureCache::stats() const
+   {
+      Stats stats = counters;
+      stats.resident_bytes = 0;
+      stats.budget = budget;
+      stats.textures = textures.size();
+      stats.trimmed = 0;
+      for (auto entry = std::begin(textures); entry != std::end(textures); ++entry)
+      {
+         stats.resident_bytes += entry->second->memory();
+         if (entry->second->first_level)
+            stats.trimmed++;
+      }
+      return stats;
+   }
+
+   void TextureCache::set_current(TextureCache *cache)
+   {
+      current = cache;
+   }
+
+   std::shared_ptr<Texture> TextureCache::load(const std::string &path)
+   {
+      if (current)
+         return current->get(path);
+      return std::make_shared<Texture>(path);
+   }
+}
+
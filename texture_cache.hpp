@@ -0,0 +1,68 @@
+#ifndef TEXTURE_CACHE_HPP__
+#define TEXTURE_CACHE_HPP__
+
+#include "gl.hpp"
+#include "texture.hpp"
+#include <map>
+#include <memory>
+#include <string>
+#include <stdint.h>
+
+namespace GL
+{
+   // Shares textures by path and keeps their memory within a budget.
+   //
+   // When over budget, update() first drops textures nothing else holds,
+   // then removes the top level of textures that haven't been bound for
+   // idle_frames, least recently bound first. Trimming copies the other
+   // levels on the GPU with GL_ARB_copy_image, or else reloads them through
+   // the texture streamer, and is skipped if neither is there. A trimmed
+   // texture that is bound again gets its full chain back, at most one per
+   // frame without a streamer. The budget is a target, textures in use are
+   // never trimmed to get under it.
+   class TextureCache
+   {
+      public:
+         enum { idle_frames = 60, min_size = 32 };
+
+         TextureCache(size_t budget);
+         ~TextureCache();
+
+         std::shared_ptr<Texture> get(const std::string &path);
+         void set_budget(size_t budget);
+
+         // Once per frame from the GL thread, after drawing.
+         void update();
+
+         struct Stats
+         {
+            size_t resident_bytes;
+            size_t budget;
+            unsigned textures;
+            unsigned trimmed;
+            unsigned long long hits;
+            unsigned long long misses;
+            unsigned long long evictions;
+            unsigned long long reloads;
+         };
+         Stats stats() const;
+
+         // LoadTexturedMeshes() and LoadBatchedMeshes() go through cache. Not owned.
+         static void set_current(TextureCache *cache);
+         // Through the current cache, or a new Texture without one.
+         static std::shared_ptr<Texture> load(const std::string &path);
+
+      private:
+         void operator=(const TextureCache&);
+         TextureCache(const TextureCache&);
+
+         std::map<std::string, std::shared_ptr<Texture>> textures;
+         size_t budget;
+         Stats counters;
+
+         static TextureCache *current;
+   };
+}
+
+#endif
+
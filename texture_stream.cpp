@@ -0,0 +1,361 @@
+#include "texture_stream.hpp"
+#include "state.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace GL
+{
+   TextureStreamer::TextureStreamer(unsigned buffers, size_t buffer_size)
+      : slots(buffers), buffer_size(buffer_size), fill_slot(0), upload_slot(0), quit(false)
+   {
+      // A row of the widest level has to fit in one buffer.
+      if (!buffers || buffer_size < (1 << 18))
+         throw Exception("Texture stream buffers too small ...\n");
+
+      for (auto slot = std::begin(slots); slot != std::end(slots); ++slot)
+      {
+         slot->state = Slot::Free;
+         slot->data = nullptr;
+         slot->fence = nullptr;
+
+         GLSYM(glGenBuffers)(1, &slot->pbo);
+         State::bind_buffer(GL_PIXEL_UNPACK_BUFFER, slot->pbo);
+         GLSYM(glBufferData)(GL_PIXEL_UNPACK_BUFFER, buffer_size, nullptr, GL_STREAM_DRAW);
+      }
+
+      // Maps every buffer before the worker starts.
+      update();
+      worker = std::thread(&TextureStreamer::run, this);
+   }
+
+   TextureStreamer::~TextureStreamer()
+   {
+      {
+         std::lock_guard<std::mutex> guard(lock);
+         quit = true;
+      }
+      cond.notify_all();
+      worker.join();
+
+      for (auto job = std::begin(active); job != std::end(active); ++job)
+      {
+         if ((*job)->texture)
+            (*job)->texture->stream = nullptr;
+         if ((*job)->obj)
+         {
+            State::deleted_texture((*job)->obj);
+            GLSYM(glDeleteTextures)(1, &(*job)->obj);
+         }
+      }
+
+      for (auto slot = std::begin(slots); slot != std::end(slots); ++slot)
+      {
+         if (slot->data)
+         {
+            State::bind_buffer(GL_PIXEL_UNPACK_BUFFER, slot->pbo);
+            GLSYM(glUnmapBuffer)(GL_PIXEL_UNPACK_BUFFER);
+         }
+         if (slot->fence)
+            GLSYM(glDeleteSync)(slot->fence);
+
+         State::deleted_buffer(slot->pbo);
+         GLSYM(glDeleteBuffers)(1, &slot->pbo);
+      }
+
+      if (Texture::streamer == this)
+         Texture::set_streamer(nullptr);
+   }
+
+   void TextureStreamer::load(Texture *texture, const std::string &path,
+         GLU::BlockFormat format, unsigned first_level)
+   {
+      auto job = std::make_shared<Job>();
+      job->texture = texture;
+      job->path = path;
+      job->format = format;
+      job->obj = 0;
+      job->first_level = first_level;
+      job->width = job->height = 0;
+      job->levels = 0;
+      job->failed = false;
+
+      {
+         std::lock_guard<std::mutex> guard(lock);
+         queue.push_back(job);
+         active.push_back(job);
+      }
+      cond.notify_all();
+   }
+
+   void TextureStreamer::cancel(Texture *texture)
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      auto itr = std::find_if(std::begin(active), std::end(active),
+            [texture](const std::shared_ptr<Job> &job) { return job->texture == texture; });
+      if (itr == std::end(active))
+         return;
+
+      // Slots still holding its data are skipped by upload().
+      (*itr)->texture = nullptr;
+      if ((*itr)->obj)
+      {
+         State::deleted_texture((*itr)->obj);
+         GLSYM(glDeleteTextures)(1, &(*itr)->obj);
+         (*itr)->obj = 0;
+      }
+      active.erase(itr);
+   }
+
+   void TextureStreamer::finish(const std::shared_ptr<Job> &job)
+   {
+      job->texture->adopt(job->obj, job->width, job->height, job->levels, job->first_level);
+      job->texture = nullptr;
+      job->obj = 0;
+      active.erase(std::find(std::begin(active), std::end(active), job));
+   }
+
+   void TextureStreamer::update()
+   {
+      std::unique_lock<std::mutex> guard(lock);
+
+      // Texture::stream is only touched on this thread. A texture whose load
+      // failed keeps what it shows now, and can be loaded or trimmed again.
+      for (auto job = std::begin(active); job != std::end(active);)
+      {
+         if ((*job)->failed)
+         {
+            (*job)->texture->stream = nullptr;
+            job = active.erase(job);
+         }
+         else
+            ++job;
+      }
+
+      if (!error.empty())
+      {
+         std::string message;
+         message.swap(error);
+         throw Exception(message);
+      }
+
+      for (auto slot = std::begin(slots); slot != std::end(slots); ++slot)
+      {
+         if (slot->state != Slot::Uploading)
+            continue;
+
+         GLenum status = GLSYM(glClientWaitSync)(slot->fence, 0, 0);
+         if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+         {
+            GLSYM(glDeleteSync)(slot->fence);
+            slot->fence = nullptr;
+            slot->state = Slot::Free;
+         }
+      }
+
+      while (slots[upload_slot].state == Slot::Filled)
+      {
+         upload(slots[upload_slot]);
+         upload_slot = (upload_slot + 1) % slots.size();
+      }
+
+      // The GPU is done reading free buffers, so nothing needs to synchronize.
+      bool mapped = false;
+      for (auto slot = std::begin(slots); slot != std::end(slots); ++slot)
+      {
+         if (slot->state != Slot::Free)
+            continue;
+
+         State::bind_buffer(GL_PIXEL_UNPACK_BUFFER, slot->pbo);
+         slot->data = GLSYM(glMapBufferRange)(GL_PIXEL_UNPACK_BUFFER, 0, buffer_size,
+               GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+         if (!slot->data)
+            throw Exception("Failed to map texture stream buffer ...\n");
+
+         slot->state = Slot::Mapped;
+         mapped = true;
+      }
+
+      // Plain glTexImage2D() calls would read from a bound unpack buffer.
+      State::bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+      guard.unlock();
+      if (mapped)
+         cond.notify_all();
+   }
+
+   void TextureStreamer::upload(Slot &slot)
+   {
+      State::bind_buffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+      GLSYM(glUnmapBuffer)(GL_PIXEL_UNPACK_BUFFER);
+      slot.data = nullptr;
+
+      std::shared_ptr<Job> job;
+      job.swap(slot.job);
+      if (!job->texture)
+      {
+         slot.state = Slot::Free;
+         return;
+      }
+
+      GLuint previous = State::bound_texture(0, GL_TEXTURE_2D);
+      if (!job->obj)
+         GLSYM(glGenTextures)(1, &job->obj);
+      State::bind_texture(0, GL_TEXTURE_2D, job->obj);
+
+      // With an unpack buffer bound, the data pointer is an offset into it.
+      // Levels split into bands are allocated first with no buffer bound.
+      bool whole = slot.rows == slot.height;
+      if (job->format == GLU::BlockNone)
+      {
+         if (!whole && slot.y == 0)
+         {
+            State::bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            GLSYM(glTexImage2D)(GL_TEXTURE_2D, slot.level, GL_RGBA,
+                  slot.width, slot.height, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8, nullptr);
+            State::bind_buffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+         }
+
+         if (whole)
+         {
+            GLSYM(glTexImage2D)(GL_TEXTURE_2D, slot.level, GL_RGBA,
+                  slot.width, slot.height, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8, nullptr);
+         }
+         else
+         {
+            GLSYM(glTexSubImage2D)(GL_TEXTURE_2D, slot.level, 0, slot.y,
+                  slot.width, slot.rows, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8, nullptr);
+         }
+      }
+      else
+      {
+         GLenum format = Texture::gl_block_format(job->format);
+         if (!whole && slot.y == 0)
+         {
+            State::bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            GLSYM(glCompressedTexImage2D)(GL_TEXTURE_2D, slot.level, format,
+                  slot.width, slot.height, 0, slot.level_size, nullptr);
+            State::bind_buffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+         }
+
+         if (whole)
+         {
+            GLSYM(glCompressedTexImage2D)(GL_TEXTURE_2D, slot.level, format,
+                  slot.width, slot.height, 0, slot.size, nullptr);
+         }
+         else
+         {
+            GLSYM(glCompressedTexSubImage2D)(GL_TEXTURE_2D, slot.level, 0, slot.y,
+                  slot.width, slot.rows, format, slot.size, nullptr);
+         }
+      }
+
+      slot.fence = GLSYM(glFenceSync)(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      slot.state = Slot::Uploading;
+
+      if (slot.last)
+         GLSYM(glTexParameteri)(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, job->levels - 1);
+      State::bind_texture(0, GL_TEXTURE_2D, previous);
+
+      if (slot.last)
+         finish(job);
+   }
+
+   void TextureStreamer::run()
+   {
+      std::unique_lock<std::mutex> guard(lock);
+      for (;;)
+      {
+         cond.wait(guard, [this] { return quit || !queue.empty(); });
+         if (quit)
+            return;
+
+         auto job = queue.front();
+         queue.pop_front();
+         if (!job->texture)
+            continue;
+
+         // Decoding, mip generation and block compression all happen
+         // without the lock, the GL thread only ever waits for copies.
+         guard.unlock();
+         std::vector<GLU::Image> levels;
+         std::vector<GLU::CompressedImage> blocks;
+         std::string failure;
+         try
+         {
+            Texture::load_levels(job->path, job->format, levels, blocks);
+         }
+         catch (const std::exception &e)
+         {
+            failure = e.what();
+         }
+         guard.lock();
+
+         if (!failure.empty())
+         {
+            job->failed = true;
+            if (error.empty())
+               error = failure;
+            continue;
+         }
+
+         unsigned count = std::max(levels.size(), blocks.size());
+         unsigned first = std::min(job->first_level, count - 1);
+         job->first_level = first;
+         job->levels = count - first;
+         job->width = blocks.empty() ? levels[first].width : blocks[first].width;
+         job->height = blocks.empty() ? levels[first].height : blocks[first].height;
+
+         bool more = true;
+         for (unsigned i = first; more && i < blocks.size(); i++)
+         {
+            more = stream(guard, job, i - first, blocks[i].width, blocks[i].height,
+                  blocks[i].blocks.data(), ((blocks[i].width + 3) / 4) * GLU::BlockSize(job->format),
+                  4, i + 1 == blocks.size());
+         }
+         for (unsigned i = first; more && i < levels.size(); i++)
+         {
+            more = stream(guard, job, i - first, levels[i].width, levels[i].height,
+                  reinterpret_cast<const uint8_t*>(levels[i].pixels.data()),
+                  levels[i].width * sizeof(uint32_t), 1, i + 1 == levels.size());
+         }
+      }
+   }
+
+   bool TextureStreamer::stream(std::unique_lock<std::mutex> &guard,
+         const std::shared_ptr<Job> &job, unsigned level, unsigned width, unsigned height,
+         const uint8_t *data, size_t unit_size, unsigned unit_rows, bool last)
+   {
+      // Units are rows, or rows of 4x4 blocks.
+      size_t units = (height + unit_rows - 1) / unit_rows;
+      size_t per_slot = buffer_size / unit_size;
+
+      for (size_t first = 0; first < units; first += per_slot)
+      {
+         cond.wait(guard, [this] { return quit || slots[fill_slot].state == Slot::Mapped; });
+         if (quit || !job->texture)
+            return false;
+
+         Slot &slot = slots[fill_slot];
+         size_t count = std::min(per_slot, units - first);
+
+         guard.unlock();
+         std::memcpy(slot.data, data + first * unit_size, count * unit_size);
+         guard.lock();
+
+         slot.job = job;
+         slot.level = level;
+         slot.width = width;
+         slot.height = height;
+         slot.y = first * unit_rows;
+         slot.rows = std::min<size_t>(count * unit_rows, height - slot.y);
+         slot.size = count * unit_size;
+         slot.level_size = units * unit_size;
+         slot.last = last && first + count == units;
+         slot.state = Slot::Filled;
+         fill_slot = (fill_slot + 1) % slots.size();
+      }
+
+      return true;
+   }
+}
+
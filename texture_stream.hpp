@@ -0,0 +1,105 @@
+#ifndef TEXTURE_STREAM_HPP__
+#define TEXTURE_STREAM_HPP__
+
+#include "gl.hpp"
+#include "texture.hpp"
+#include "compress.hpp"
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace GL
+{
+   // Loads textures without blocking the GL thread.
+   //
+   // A worker thread decodes each texture and copies it into a ring of
+   // mapped pixel buffer objects. update() issues the uploads from filled
+   // buffers and fences them, and maps buffers again once their fence has
+   // signaled, so neither side waits on the GPU. Levels larger than a
+   // buffer go up in bands of rows. Until every level of a texture is up
+   // it shows a white placeholder.
+   class TextureStreamer
+   {
+      public:
+         TextureStreamer(unsigned buffers = 4, size_t buffer_size = 4 << 20);
+         // Textures still loading keep their placeholder.
+         ~TextureStreamer();
+
+         // Call once per frame from the GL thread.
+         // Rethrows the first error the worker ran into.
+         void update();
+
+      private:
+         friend class Texture;
+
+         void operator=(const TextureStreamer&);
+         TextureStreamer(const TextureStreamer&);
+
+         struct Job
+         {
+            // nullptr once the texture is destroyed.
+            Texture *texture;
+            std::string path;
+            GLU::BlockFormat format;
+            // The real texture, created by the first upload.
+            GLuint obj;
+            // Levels [first_level, end) of the chain are uploaded.
+            unsigned first_level;
+            unsigned width, height;
+            unsigned levels;
+            // Set by the worker when decoding throws, cleaned up by update().
+            bool failed;
+         };
+
+         struct Slot
+         {
+            enum State { Free, Mapped, Filled, Uploading };
+            State state;
+            GLuint pbo;
+            void *data;
+            GLsync fence;
+
+            // What a filled buffer holds: rows [y, y + rows) of a level.
+            std::shared_ptr<Job> job;
+            unsigned level;
+            unsigned width, height;
+            unsigned y, rows;
+            size_t size;
+            size_t level_size;
+            bool last;
+         };
+
+         std::vector<Slot> slots;
+         size_t buffer_size;
+         // The worker fills and update() uploads slots in ring order.
+         unsigned fill_slot;
+         unsigned upload_slot;
+
+         std::deque<std::shared_ptr<Job>> queue;
+         std::vector<std::shared_ptr<Job>> active;
+         std::string error;
+         bool quit;
+         std::mutex lock;
+         std::condition_variable cond;
+         std::thread worker;
+
+         void load(Texture *texture, const std::string &path, GLU::BlockFormat format,
+               unsigned first_level);
+         void cancel(Texture *texture);
+         void finish(const std::shared_ptr<Job> &job);
+
+         void run();
+         // Copies a level into as many slots as it takes. False if the worker
+         // should stop or the texture was destroyed meanwhile.
+         bool stream(std::unique_lock<std::mutex> &guard, const std::shared_ptr<Job> &job,
+               unsigned level, unsigned width, unsigned height,
+               const uint8_t *data, size_t unit_size, unsigned unit_rows, bool last);
+         void upload(Slot &slot);
+   };
+}
+
+#endif
+
@@ -6,6 +6,20 @@
 #include <algorithm>
 #include <iterator>
 #include <cmath>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #ifndef M_PI
 #define M_PI 3.14159265f
@@ -24,62 +38,244 @@ namespace GLU
       return str.str();
    }
 
-   namespace Matrices
+   namespace
    {
-      GL::GLMatrix Projection(GLfloat zNear, GLfloat zFar)
+      // Threads for ParallelFor(), started on first use and joined at exit.
+      //
+      // The calling thread runs ranges too, and only waits for ranges a
+      // worker already started. Nested calls and calls from several
+      // threads at once therefore can't deadlock.
+      class WorkerPool
       {
-         GL::GLMatrix mat;
+         public:
+            struct Job
+            {
+               const std::function<void (size_t, size_t)> *func;
+               size_t count;
+               size_t ranges;
+               size_t claimed;
+               size_t done;
+               std::exception_ptr error;
+            };
 
-         mat(0, 0) = zNear;
-         mat(1, 1) = zNear;
-         mat(2, 2) = -(zFar + zNear) / (zFar - zNear);
-         mat(2, 3) = -2.0f * zFar * zNear / (zFar - zNear);
-         mat(3, 2) = -1.0f;
+            WorkerPool(unsigned threads) : quit(false)
+            {
+               workers.reserve(threads);
+               try
+               {
+                  for (unsigned i = 0; i < threads; i++)
+                     workers.push_back(std::thread(&WorkerPool::run, this));
+               }
+               catch (...)
+               {
+                  stop();
+                  throw;
+               }
+            }
 
-         return mat;
+            ~WorkerPool()
+            {
+               stop();
+            }
+
+            void execute(Job &job)
+            {
+               std::unique_lock<std::mutex> guard(lock);
+               queue.push_back(&job);
+               work.notify_all();
+
+               while (job.claimed < job.ranges)
+                  run_range(guard, job);
+
+               finished.wait(guard, [&job] { return job.done == job.ranges; });
+            }
+
+         private:
+            WorkerPool(const WorkerPool&);
+            void operator=(const WorkerPool&);
+
+            std::vector<std::thread> workers;
+            std::deque<Job*> queue;
+            bool quit;
+            std::mutex lock;
+            std::condition_variable work;
+            std::condition_variable finished;
+
+            void stop()
+            {
+               {
+                  std::lock_guard<std::mutex> guard(lock);
+                  quit = true;
+               }
+               work.notify_all();
+
+               for (auto itr = std::begin(workers); itr != std::end(workers); ++itr)
+                  itr->join();
+               workers.clear();
+            }
+
+            void run()
+            {
+               std::unique_lock<std::mutex> guard(lock);
+               for (;;)
+               {
+                  work.wait(guard, [this] { return quit || !queue.empty(); });
+                  if (quit)
+                     return;
+                  run_range(guard, *queue.front());
+               }
+            }
+
+            // Claims the next range of job and runs it without the lock.
+            void run_range(std::unique_lock<std::mutex> &guard, Job &job)
+            {
+               size_t i = job.claimed++;
+               if (job.claimed == job.ranges)
+                  queue.erase(std::find(std::begin(queue), std::end(queue), &job));
+
+               guard.unlock();
+               std::exception_ptr error;
+               try
+               {
+                  (*job.func)(job.count * i / job.ranges, job.count * (i + 1) / job.ranges);
+               }
+               catch (...)
+               {
+                  error = std::current_exception();
+               }
+               guard.lock();
+
+               if (error && !job.error)
+                  job.error = error;
+               if (++job.done == job.ranges)
+                  finished.notify_all();
+            }
+      };
+   }
+
+   void ParallelFor(size_t count, size_t min_batch,
+         const std::function<void (size_t, size_t)> &func)
+   {
+      if (count == 0)
+         return;
+
+      min_batch = std::max(min_batch, size_t(1));
+      size_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+      threads = std::min(threads, (count + min_batch - 1) / min_batch);
+
+      if (threads <= 1)
+      {
+         func(0, count);
+         return;
       }
 
-      GL::GLMatrix Identity()
+      // The caller is one of the threads.
+      static WorkerPool pool(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+
+      WorkerPool::Job job;
+      job.func = &func;
+      job.count = count;
+      job.ranges = threads;
+      job.claimed = 0;
+      job.done = 0;
+      pool.execute(job);
+
+      if (job.error)
+         std::rethrow_exception(job.error);
+   }
+
+#ifdef _WIN32
+   MappedFile::MappedFile(const std::string &path)
+      : m_data(nullptr), m_size(0), m_file(INVALID_HANDLE_VALUE), m_mapping(nullptr)
+   {
+      m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+      if (m_file == INVALID_HANDLE_VALUE)
+         throw GL::Exception(join("Failed to open file: ", path));
+
+      LARGE_INTEGER size;
+      if (!GetFileSizeEx(m_file, &size))
       {
-         GL::GLMatrix mat;
-         mat(0, 0) = 1.0;
-         mat(1, 1) = 1.0;
-         mat(2, 2) = 1.0;
-         mat(3, 3) = 1.0;
-         return mat;
+         CloseHandle(m_file);
+         throw GL::Exception(join("Failed to stat file: ", path));
       }
 
-      GL::GLMatrix Scale(GLfloat x, GLfloat y, GLfloat z)
+      m_size = static_cast<size_t>(size.QuadPart);
+      if (m_size == 0)
+         return;
+
+      m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      if (m_mapping)
+         m_data = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+
+      if (!m_data)
       {
-         GL::GLMatrix mat;
-         mat(0, 0) = x;
-         mat(1, 1) = y;
-         mat(2, 2) = z;
-         mat(3, 3) = 1.0;
-         return mat;
+         if (m_mapping)
+            CloseHandle(m_mapping);
+         CloseHandle(m_file);
+         throw GL::Exception(join("Failed to map file: ", path));
       }
+   }
 
-      GL::GLMatrix Scale(GLfloat scale)
+   MappedFile::~MappedFile()
+   {
+      if (m_data)
+         UnmapViewOfFile(m_data);
+      if (m_mapping)
+         CloseHandle(m_mapping);
+      CloseHandle(m_file);
+   }
+#else
+   MappedFile::MappedFile(const std::string &path)
+      : m_data(nullptr), m_size(0)
+   {
+      int fd = open(path.c_str(), O_RDONLY);
+      if (fd < 0)
+         throw GL::Exception(join("Failed to open file: ", path));
+
+      struct stat st;
+      if (fstat(fd, &st) < 0)
       {
-         return Scale(scale, scale, scale);
+         close(fd);
+         throw GL::Exception(join("Failed to stat file: ", path));
       }
 
-      GL::GLMatrix Translate(GLfloat x, GLfloat y, GLfloat z)
+      m_size = static_cast<size_t>(st.st_size);
+      if (m_size == 0)
       {
-         GL::GLMatrix mat;
-         mat(0, 0) = 1.0;
-         mat(1, 1) = 1.0;
-         mat(2, 2) = 1.0;
-         mat(3, 3) = 1.0;
-         mat(0, 3) = x;
-         mat(1, 3) = y;
-         mat(2, 3) = z;
-         return mat;
+         close(fd);
+         return;
       }
 
-      GL::GLMatrix Translate(const GL::vec3 &dir)
+      void *ptr = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      close(fd);
+      if (ptr == MAP_FAILED)
+         throw GL::Exception(join("Failed to map file: ", path));
+
+      madvise(ptr, m_size, MADV_SEQUENTIAL);
+      m_data = static_cast<const char*>(ptr);
+   }
+
+   MappedFile::~MappedFile()
+   {
+      if (m_data)
+         munmap(const_cast<char*>(m_data), m_size);
+   }
+#endif
+
+   namespace Matrices
+   {
+      GL::GLMatrix Projection(GLfloat zNear, GLfloat zFar)
       {
-         return Translate(dir(0), dir(1), dir(2));
+         GL::GLMatrix mat;
+
+         mat(0, 0) = zNear;
+         mat(1, 1) = zNear;
+         mat(2, 2) = -(zFar + zNear) / (zFar - zNear);
+         mat(2, 3) = -2.0f * zFar * zNear / (zFar - zNear);
+         mat(3, 2) = -1.0f;
+
+         return mat;
       }
 
       GL::GLMatrix Rotate(Rotation dir, GLfloat degrees)
@@ -135,6 +331,133 @@ namespace GLU
          return ret;
       }
 
+      GL::GLMatrix Inverse(const GL::GLMatrix &a)
+      {
+         // Laplace expansion over 2x2 minors of the top and bottom row pairs.
+         float s0 = a(0, 0) * a(1, 1) - a(1, 0) * a(0, 1);
+         float s1 = a(0, 0) * a(1, 2) - a(1, 0) * a(0, 2);
+         float s2 = a(0, 0) * a(1, 3) - a(1, 0) * a(0, 3);
+         float s3 = a(0, 1) * a(1, 2) - a(1, 1) * a(0, 2);
+         float s4 = a(0, 1) * a(1, 3) - a(1, 1) * a(0, 3);
+         float s5 = a(0, 2) * a(1, 3) - a(1, 2) * a(0, 3);
+
+         float c5 = a(2, 2) * a(3, 3) - a(3, 2) * a(2, 3);
+         float c4 = a(2, 1) * a(3, 3) - a(3, 1) * a(2, 3);
+         float c3 = a(2, 1) * a(3, 2) - a(3, 1) * a(2, 2);
+         float c2 = a(2, 0) * a(3, 3) - a(3, 0) * a(2, 3);
+         float c1 = a(2, 0) * a(3, 2) - a(3, 0) * a(2, 2);
+         float c0 = a(2, 0) * a(3, 1) - a(3, 0) * a(2, 1);
+
+         float det = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+         if (det == 0.0f)
+            throw GL::Exception("Matrix is singular ...\n");
+         float inv = 1.0f / det;
+
+         GL::GLMatrix b;
+         b(0, 0) = ( a(1, 1) * c5 - a(1, 2) * c4 + a(1, 3) * c3) * inv;
+         b(0, 1) = (-a(0, 1) * c5 + a(0, 2) * c4 - a(0, 3) * c3) * inv;
+         b(0, 2) = ( a(3, 1) * s5 - a(3, 2) * s4 + a(3, 3) * s3) * inv;
+         b(0, 3) = (-a(2, 1) * s5 + a(2, 2) * s4 - a(2, 3) * s3) * inv;
+
+         b(1, 0) = (-a(1, 0) * c5 + a(1, 2) * c2 - a(1, 3) * c1) * inv;
+         b(1, 1) = ( a(0, 0) * c5 - a(0, 2) * c2 + a(0, 3) * c1) * inv;
+         b(1, 2) = (-a(3, 0) * s5 + a(3, 2) * s2 - a(3, 3) * s1) * inv;
+         b(1, 3) = ( a(2, 0) * s5 - a(2, 2) * s2 + a(2, 3) * s1) * inv;
+
+         b(2, 0) = ( a(1, 0) * c4 - a(1, 1) * c2 + a(1, 3) * c0) * inv;
+         b(2, 1) = (-a(0, 0) * c4 + a(0, 1) * c2 - a(0, 3) * c0) * inv;
+         b(2, 2) = ( a(3, 0) * s4 - a(3, 1) * s2 + a(3, 3) * s0) * inv;
+         b(2, 3) = (-a(2, 0) * s4 + a(2, 1) * s2 - a(2, 3) * s0) * inv;
+
+         b(3, 0) = (-a(1, 0) * c3 + a(1, 1) * c1 - a(1, 2) * c0) * inv;
+         b(3, 1) = ( a(0, 0) * c3 - a(0, 1) * c1 + a(0, 2) * c0) * inv;
+         b(3, 2) = (-a(3, 0) * s3 + a(3, 1) * s1 - a(3, 2) * s0) * inv;
+         b(3, 3) = ( a(2, 0) * s3 - a(2, 1) * s1 + a(2, 2) * s0) * inv;
+
+         return b;
+      }
+
+      // Rows of the cofactor matrix of the upper 3x3, four floats apart.
+      static float cofactor3(const GL::GLMatrix &mat, float (&out)[12])
+      {
+#ifdef GL_LINEAR_SSE
+         return GL::SSE::Cofactor3(mat(), out);
+#else
+         for (unsigned i = 0; i < 3; i++)
+         {
+            unsigned r1 = (i + 1) % 3, r2 = (i + 2) % 3;
+            for (unsigned j = 0; j < 3; j++)
+            {
+               unsigned c1 = (j + 1) % 3, c2 = (j + 2) % 3;
+               out[4 * i + j] = mat(r1, c1) * mat(r2, c2) - mat(r1, c2) * mat(r2, c1);
+            }
+         }
+         return mat(0, 0) * out[0] + mat(0, 1) * out[1] + mat(0, 2) * out[2];
+#endif
+      }
+
+      GL::GLMatrix AffineInverse(const GL::GLMatrix &mat)
+      {
+         float cof[12];
+         float det = cofactor3(mat, cof);
+         if (det == 0.0f)
+            throw GL::Exception("Matrix is singular ...\n");
+         float inv = 1.0f / det;
+
+         // The inverse of the 3x3 is the transposed cofactor matrix over det.
+         GL::GLMatrix ret;
+         for (unsigned i = 0; i < 3; i++)
+            for (unsigned j = 0; j < 3; j++)
+               ret(i, j) = cof[4 * j + i] * inv;
+
+         for (unsigned i = 0; i < 3; i++)
+            ret(i, 3) = -(ret(i, 0) * mat(0, 3) + ret(i, 1) * mat(1, 3) + ret(i, 2) * mat(2, 3));
+         ret(3, 3) = 1.0f;
+
+         return ret;
+      }
+
+      GL::GLMatrix NormalMatrix(const GL::GLMatrix &model)
+      {
+         float cof[12];
+         float det = cofactor3(model, cof);
+         float inv = det != 0.0f ? 1.0f / det : 1.0f;
+
+         GL::GLMatrix ret;
+         for (unsigned i = 0; i < 3; i++)
+            for (unsigned j = 0; j < 3; j++)
+               ret(i, j) = cof[4 * i + j] * inv;
+         ret(3, 3) = 1.0f;
+
+         return ret;
+      }
+
+      void TransformBatch(const GL::GLMatrix *models, size_t count,
+            const GL::GLMatrix &view_projection, const GL::GLMatrix &light,
+            GL::GLMatrix *out, bool threaded)
+      {
+         auto transform = [models, &view_projection, &light, out](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+#ifdef GL_LINEAR_SSE
+               // Straight into the output, without the zeroed temporary of operator*.
+               GL::SSE::MultiplyMatrix(view_projection(), models[i](), out[2 * i + 0]());
+               GL::SSE::MultiplyMatrix(light(), models[i](), out[2 * i + 1]());
+#else
+               out[2 * i + 0] = view_projection * models[i];
+               out[2 * i + 1] = light * models[i];
+#endif
+            }
+         };
+
+         // Below this, handing ranges to the pool costs more than the products.
+         const size_t min_batch = 4096;
+         if (threaded)
+            ParallelFor(count, min_batch, transform);
+         else
+            transform(0, count);
+      }
+
       GL::vec3 Normalize(const GL::vec3 &dir)
       {
          float factor = 1.0f / std::sqrt(dir(0) * dir(0) + dir(1) * dir(1) + dir(2) * dir(2));
@@ -149,16 +472,24 @@ namespace GLU
          float y = norm_dir(1);
          float z = norm_dir(2);
 
-         float y_rot;
-         // Need to rotate y in reverse due to Z flipping sign in projection.
-         if (x > 0.0)
-            y_rot = -std::acos(-z) * 180 / M_PI;
-         else
-            y_rot = std::acos(-z) * 180 / M_PI;
+         // Pitch by asin(-y), then yaw by acos(-z). The half angle identities
+         // give both quaternions straight from the cosines, without any trig.
+         float cos_x = std::sqrt(std::max(0.0f, 1.0f - y * y));
+         float half_cos_x = std::sqrt(0.5f * (1.0f + cos_x));
+         float half_sin_x = std::sqrt(std::max(0.0f, 0.5f * (1.0f - cos_x)));
+         if (y > 0.0f)
+            half_sin_x = -half_sin_x;
 
-         float x_rot = std::asin(-y) * 180 / M_PI;
+         // Need to rotate y in reverse due to Z flipping sign in projection.
+         float cos_y = -z;
+         float half_cos_y = std::sqrt(std::max(0.0f, 0.5f * (1.0f + cos_y)));
+         float half_sin_y = std::sqrt(std::max(0.0f, 0.5f * (1.0f - cos_y)));
+         if (x <= 0.0f)
+            half_sin_y = -half_sin_y;
 
-         return Rotate(x_rot, y_rot, 0.0f);
+         GL::quat pitch(half_cos_x, half_sin_x, 0.0f, 0.0f);
+         GL::quat yaw(half_cos_y, 0.0f, half_sin_y, 0.0f);
+         return (pitch * yaw).matrix();
       }
    }
 }
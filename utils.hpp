@@ -3,6 +3,7 @@
 
 #include <string>
 #include <sstream>
+#include <functional>
 
 namespace GLU
 {
@@ -19,6 +20,39 @@ namespace GLU
       { std::ostringstream stream; stream << t1 << join(t2, t3, t4, t5); return stream.str(); }
 
    std::string FileToString(const std::string &path);
+
+   // Splits [0, count) into contiguous ranges and runs func(begin, end) on
+   // each range, spread over the calling thread and a pool of workers that
+   // lives until exit. At most one range per hardware core is made, and no
+   // range is smaller than min_batch unless count is. Safe to call from
+   // several threads and from within func.
+   // The first exception thrown by any range is rethrown to the caller.
+   void ParallelFor(size_t count, size_t min_batch,
+         const std::function<void (size_t, size_t)> &func);
+
+   // Read-only view of an entire file.
+   // Uses mmap() (MapViewOfFile() on Windows) so large files can be parsed
+   // in place without being copied into the heap first.
+   class MappedFile
+   {
+      public:
+         MappedFile(const std::string &path);
+         ~MappedFile();
+
+         const char* data() const { return m_data; }
+         size_t size() const { return m_size; }
+
+      private:
+         MappedFile(const MappedFile&);
+         void operator=(const MappedFile&);
+
+         const char *m_data;
+         size_t m_size;
+#ifdef _WIN32
+         void *m_file;
+         void *m_mapping;
+#endif
+   };
 }
 
 #include <memory>
@@ -31,11 +65,35 @@ namespace GLU
    namespace Matrices
    {
       GL::GLMatrix Projection(GLfloat zNear, GLfloat zFar);
-      GL::GLMatrix Identity();
-      GL::GLMatrix Scale(GLfloat x, GLfloat y, GLfloat z);
-      GL::GLMatrix Scale(GLfloat scale);
-      GL::GLMatrix Translate(GLfloat x, GLfloat y, GLfloat z);
-      GL::GLMatrix Translate(const GL::vec3 &vec);
+
+      // constexpr, so matrices built from constants fold at compile time.
+      constexpr GL::GLMatrix Identity()
+      {
+         return GL::GLMatrix(GL::vec4(1, 0, 0, 0), GL::vec4(0, 1, 0, 0),
+               GL::vec4(0, 0, 1, 0), GL::vec4(0, 0, 0, 1));
+      }
+
+      constexpr GL::GLMatrix Scale(GLfloat x, GLfloat y, GLfloat z)
+      {
+         return GL::GLMatrix(GL::vec4(x, 0.0f, 0.0f, 0.0f), GL::vec4(0.0f, y, 0.0f, 0.0f),
+               GL::vec4(0.0f, 0.0f, z, 0.0f), GL::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+      }
+
+      constexpr GL::GLMatrix Scale(GLfloat scale)
+      {
+         return Scale(scale, scale, scale);
+      }
+
+      constexpr GL::GLMatrix Translate(GLfloat x, GLfloat y, GLfloat z)
+      {
+         return GL::GLMatrix(GL::vec4(1.0f, 0.0f, 0.0f, x), GL::vec4(0.0f, 1.0f, 0.0f, y),
+               GL::vec4(0.0f, 0.0f, 1.0f, z), GL::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+      }
+
+      constexpr GL::GLMatrix Translate(const GL::vec3 &dir)
+      {
+         return Translate(dir(0), dir(1), dir(2));
+      }
 
       enum Rotation
       {
@@ -52,6 +110,24 @@ namespace GLU
 
       GL::GLMatrix Transpose(const GL::GLMatrix &mat);
 
+      // Closed form inverses. Both throw on singular matrices.
+      // AffineInverse() assumes the bottom row is 0, 0, 0, 1.
+      GL::GLMatrix Inverse(const GL::GLMatrix &mat);
+      GL::GLMatrix AffineInverse(const GL::GLMatrix &mat);
+
+      // Inverse transpose of the upper 3x3 of model, without translation.
+      // For singular models the cofactor matrix is returned instead, which
+      // still gives the right directions once the normals are normalized.
+      GL::GLMatrix NormalMatrix(const GL::GLMatrix &model);
+
+      // Writes view_projection * models[i] to out[2 * i] and
+      // light * models[i] to out[2 * i + 1], so each object's matrices are
+      // adjacent and out can be uploaded to a buffer as is.
+      // Large batches are split across threads unless threaded is false.
+      void TransformBatch(const GL::GLMatrix *models, size_t count,
+            const GL::GLMatrix &view_projection, const GL::GLMatrix &light,
+            GL::GLMatrix *out, bool threaded = true);
+
       // For debugging :D
       template <class T>
       std::ostream& operator<<(std::ostream &stream, const GL::Matrix<T> &matrix)
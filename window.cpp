@@ -36,7 +36,7 @@ namespace GL
          throw Exception("Failed to initialize SGL!");
 
       set_callbacks();
-      set_symbols();
+      LoadGLFunctions();
 
    }
 
@@ -57,8 +57,11 @@ namespace GL
       }
 
 #ifdef DEBUG
-      GLSYM(glDebugMessageControlARB)(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, nullptr, GL_TRUE);
-      GLSYM(glDebugMessageCallbackARB)(debug_cb, nullptr);
+      if (GLSYM_AVAILABLE(glDebugMessageControlARB) && GLSYM_AVAILABLE(glDebugMessageCallbackARB))
+      {
+         GLSYM(glDebugMessageControlARB)(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, nullptr, GL_TRUE);
+         GLSYM(glDebugMessageCallbackARB)(debug_cb, nullptr);
+      }
 #endif
 
       return m_ptr;
@@ -83,36 +86,6 @@ namespace GL
       sgl_set_mouse_mode(false, true, true);
    }
 
-   void Window::set_symbols()
-   {
-      // GL 1.1 stuff is not found dynamically in Windows. :(
-      // Statically initialize them.
-
-      struct mapper { const char *sym; sgl_function_t func; };
-      
-#define _D(sym) { #sym, reinterpret_cast<sgl_function_t>(sym) }
-      static const mapper bind_map[] = {
-            _D(glEnable),
-            _D(glBlendFunc),
-            _D(glClearColor),
-            _D(glTexImage2D),
-            _D(glViewport),
-            _D(glClear),
-            _D(glTexParameteri),
-            _D(glDeleteTextures),
-            _D(glGenTextures),
-            _D(glBindTexture),
-            _D(glDrawArrays),
-#ifdef DEBUG
-            _D(glGetError),
-#endif
-         };
-#undef _D
-
-      for (auto itr = std::begin(bind_map); itr != std::end(bind_map); ++itr)
-         sym_map[itr->sym] = itr->func;
-   }
-
    void Window::vsync(bool activate)
    {
       sgl_set_swap_interval(activate ? 1 : 0);
@@ -138,11 +111,6 @@ namespace GL
       return sgl_is_alive() == SGL_TRUE;
    }
 
-   sgl_function_t& Window::symbol(const std::string &str)
-   {
-      return sym_map[str];
-   }
-
    void Window::set_key_cb(const std::function<void (int, bool)>& cb)
    {
       key_cb = cb;
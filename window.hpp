@@ -32,8 +32,6 @@ namespace GL
          void set_key_cb(const std::function<void (int, bool)>& cb);
          void set_mouse_move_cb(const std::function<void (int, int)>& cb);
 
-         sgl_function_t& symbol(const std::string &sym);
-
          ~Window();
 
       private:
@@ -47,9 +45,6 @@ namespace GL
          friend void sgl_mouse_move_cb(int, int);
 
          void set_callbacks();
-         void set_symbols();
-
-         std::map<std::string, sgl_function_t> sym_map;
    };
 
    // Every global resource that manages GL state must hold a reference